@@ -12,6 +12,9 @@ PHP_ARG_WITH(gdextra-magick, [whether to enable ImageMagick image loader support
 [  --with-gdextra-magick[[=PATH]]    Enable ImageMagick image loader support.
                                   PATH is the optional pathname to Wand-config], no, no)
 
+PHP_ARG_ENABLE(gdextra-threads, [whether to enable the threaded PNG encoder and seam carver],
+[  --enable-gdextra-threads        Compress PNG bands and carve seams in parallel with POSIX threads.], no, no)
+
 if test "$PHP_GDEXTRA" != "no"; then
 
   if test -z "$AWK"; then
@@ -126,7 +129,26 @@ if test "$PHP_GDEXTRA" != "no"; then
   AC_CHECK_HEADER([ext/gd/libgd/gd.h], [], AC_MSG_ERROR(['ext/gd/libgd/gd.h' header not found]))
   export CPPFLAGS="$OLD_CPPFLAGS"
 
-  GDEXTRA_SOURCES="gdextra.c gdex_bmp.c gdex_channel.c gdex_color.c gdex_correct.c gdex_geom.c"
+  dnl
+  dnl Check for zlib (used by the PNG encoder)
+  dnl
+  AC_CHECK_HEADER([zlib.h], [], AC_MSG_ERROR(['zlib.h' header not found]))
+  PHP_ADD_LIBRARY(z, 1, GDEXTRA_SHARED_LIBADD)
+
+  dnl
+  dnl Check for POSIX threads (used by the PNG encoder)
+  dnl
+  if test "$PHP_GDEXTRA_THREADS" != "no"; then
+    AC_CHECK_HEADER([pthread.h], [], AC_MSG_ERROR(['pthread.h' header not found]))
+    AC_CHECK_LIB(pthread, pthread_create, [
+      PHP_ADD_LIBRARY(pthread, 1, GDEXTRA_SHARED_LIBADD)
+    ], [
+      AC_MSG_ERROR([libpthread not found])
+    ])
+    AC_DEFINE(PHP_GDEXTRA_WITH_PTHREADS, 1, [enable the threaded PNG encoder and seam carver])
+  fi
+
+  GDEXTRA_SOURCES="gdextra.c gdex_bmp.c gdex_carve.c gdex_channel.c gdex_color.c gdex_correct.c gdex_geom.c gdex_pipeline.c gdex_pixels.c gdex_png.c gdex_pnm.c gdex_qoi.c"
 
   dnl
   dnl Check for Liquid Rescale Library header
@@ -1,5 +1,5 @@
 /*
- * Extra image functions: BMP/ICON writer functions
+ * Extra image functions: BMP/ICON reader/writer functions
  *
  * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
  *
@@ -34,16 +34,98 @@ ZEND_EXTERN_MODULE_GLOBALS(gdextra);
 
 typedef unsigned char byte_t;
 
+/* {{{ bitmap definitions */
+
+#define BMP_BI_RGB        0
+#define BMP_BI_RLE8       1
+#define BMP_BI_RLE4       2
+#define BMP_BI_BITFIELDS  3
+#define BMP_BI_ALPHABITFIELDS 6
+
+/*
+ * Parsed bitmap header.
+ */
+typedef struct {
+	int width;
+	int height;
+	zend_bool topdown;
+	zend_bool use_alpha;
+	unsigned int bitcount;
+	unsigned int compression;
+	uint32_t mask[4];
+	size_t palette_offset;
+	size_t palette_entry_size;
+	size_t colors;
+	size_t bits_offset;
+} bmp_info_t;
+
+/*
+ * Default PNG options for icon entries.
+ * Entries of ICON_PNG_SIZE pixels are stored as PNG if 'png' => true.
+ */
+#define ICON_PNG_SIZE  256
+#define ICON_PNG_LEVEL 1
+
+/*
+ * Maximum width and height of an icon entry.
+ */
+#define ICON_MAX_SIZE  256
+
+/*
+ * Encoded image of an icon entry.
+ */
+typedef struct {
+	byte_t *buffer;
+	size_t buffer_size;
+	const byte_t *data;
+	size_t data_size;
+	size_t mask_line_size;
+	size_t mask_size;
+	uint16_t bitcount;
+} icon_entry_t;
+
+/*
+ * Directory entry of an icon or a cursor.
+ */
+typedef struct {
+	int width;
+	int height;
+	unsigned int bitcount;
+	size_t size;
+	size_t offset;
+} icon_dirent_t;
+
+/*
+ * Bit position and width of a color component.
+ */
+typedef struct {
+	uint32_t mask;
+	int shift;
+	uint32_t max;
+} bmp_field_t;
+
+/* }}} */
+
 /* {{{ private function prototypes */
 
 static int
 _verify_icon_size(const gdImagePtr im);
 
+static int
+_get_icon_options(HashTable *options, int *png_size, int *png_level TSRMLS_DC);
+
 static byte_t *
-_gdimages_to_icon(gdImagePtr *images, size_t num, size_t *result_size TSRMLS_DC);
+_write_icon_mask(byte_t *ptr, const gdImagePtr im, size_t line_size);
 
-#define gdimages_to_icon(images, num, result_size) \
-	_gdimages_to_icon((images), (num), (result_size) TSRMLS_CC)
+static gdImagePtr
+_resample_icon(const gdImagePtr src, int size);
+
+static byte_t *
+_gdimages_to_icon(gdImagePtr *images, size_t num, int png_size, int png_level,
+                  size_t *result_size TSRMLS_DC);
+
+#define gdimages_to_icon(images, num, png_size, png_level, result_size) \
+	_gdimages_to_icon((images), (num), (png_size), (png_level), (result_size) TSRMLS_CC)
 
 static byte_t *
 _write_bmp_header(byte_t *ptr,
@@ -53,16 +135,21 @@ _write_bmp_header(byte_t *ptr,
 static byte_t *
 _write_bmp_palette(byte_t *ptr, const gdImagePtr im, int ncolors);
 
+static size_t
+_write_rle_literal(byte_t *ptr, const unsigned char *row, int length, zend_bool rle4),
+_write_rle_runs(byte_t *ptr, const unsigned char *row, int width, zend_bool rle4),
+_write_rle_row(byte_t *ptr, const unsigned char *row, int width, zend_bool rle4);
+
 static byte_t
 *_gdimage_to_bmp1(const gdImagePtr im, size_t *size TSRMLS_DC),
-*_gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRMLS_DC),
-*_gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRMLS_DC),
+*_gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette, zend_bool rle TSRMLS_DC),
+*_gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette, zend_bool rle TSRMLS_DC),
 *_gdimage_to_bmp24(const gdImagePtr im, size_t *size TSRMLS_DC),
 *_gdimage_to_bmp32(const gdImagePtr im, size_t *size, zend_bool v5header TSRMLS_DC);
 
 #define gdimage_to_bmp1(im, size)       _gdimage_to_bmp1((im), (size) TSRMLS_CC)
-#define gdimage_to_bmp4(im, size, fill) _gdimage_to_bmp4((im), (size), (fill) TSRMLS_CC)
-#define gdimage_to_bmp8(im, size, fill) _gdimage_to_bmp8((im), (size), (fill) TSRMLS_CC)
+#define gdimage_to_bmp4(im, size, fill, rle) _gdimage_to_bmp4((im), (size), (fill), (rle) TSRMLS_CC)
+#define gdimage_to_bmp8(im, size, fill, rle) _gdimage_to_bmp8((im), (size), (fill), (rle) TSRMLS_CC)
 #define gdimage_to_bmp24(im, size)     _gdimage_to_bmp24((im), (size) TSRMLS_CC)
 #define gdimage_to_bmp32(im, size, v5) _gdimage_to_bmp32((im), (size), (v5) TSRMLS_CC)
 
@@ -72,6 +159,28 @@ _output_image(const char *filename, const byte_t *buffer, size_t buffer_size TSR
 #define output_image(filename, buffer, buffer_size) \
 	_output_image((filename), (buffer), (buffer_size) TSRMLS_CC)
 
+static int
+_read_bmp_info(bmp_info_t *info, const byte_t *data, size_t size, zend_bool icon TSRMLS_DC);
+
+static void
+_init_bmp_field(bmp_field_t *field, uint32_t mask);
+
+static int
+_decode_rle(gdImagePtr im, const bmp_info_t *info,
+            const byte_t *bits, size_t bits_size, const byte_t *map);
+
+static gdImagePtr
+_decode_dib(const bmp_info_t *info, const byte_t *data, size_t size TSRMLS_DC);
+
+static icon_dirent_t *
+_read_icondir(const byte_t *data, size_t size, size_t *num TSRMLS_DC);
+
+static size_t
+_select_icon_entry(const icon_dirent_t *entries, size_t num, long size);
+
+static gdImagePtr
+_decode_icon_entry(const icon_dirent_t *entry, const byte_t *data TSRMLS_DC);
+
 /* }}} */
 /* {{{ inline functions */
 
@@ -101,6 +210,19 @@ _write_int16le(byte_t *ptr, int16_t n)
 	return ptr;
 }*/
 
+static inline uint16_t
+_read_uint16le(const byte_t *ptr)
+{
+	return (uint16_t)(ptr[0] | (ptr[1] << 8));
+}
+
+static inline uint32_t
+_read_uint32le(const byte_t *ptr)
+{
+	return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8)
+		| ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
 static inline byte_t *
 _write_uint16le(byte_t *ptr, uint16_t n)
 {
@@ -151,21 +273,204 @@ _verify_icon_size(const gdImagePtr im)
 	return SUCCESS;
 }
 
+/* }}} */
+/* {{{ _get_icon_options() */
+
+/*
+ * Get the options for icon entries
+ */
+static int
+_get_icon_options(HashTable *options, int *png_size, int *png_level TSRMLS_DC)
+{
+	zval **entry = NULL;
+
+	if (hash_find(options, "png", &entry) == SUCCESS) {
+		if (Z_TYPE_PP(entry) == IS_BOOL) {
+			*png_size = (Z_BVAL_PP(entry)) ? ICON_PNG_SIZE : 0;
+		} else {
+			long l = gdex_get_lval(*entry);
+			if (l < 0L) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"'png' must not be a negative number");
+				return FAILURE;
+			}
+			*png_size = (int)MIN(l, 257L);
+		}
+	}
+
+	if (hash_find(options, "png_level", &entry) == SUCCESS) {
+		long l = gdex_get_lval(*entry);
+		if (l < 0L || l > 9L) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'png_level' must be in range 0 to 9");
+			return FAILURE;
+		}
+		*png_level = (int)l;
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _resample_icon() */
+
+/*
+ * Fit an image into a square with the transparent background
+ */
+static gdImagePtr
+_resample_icon(const gdImagePtr src, int size)
+{
+	gdImagePtr dst;
+	int x, y, width, height, src_w, src_h;
+
+	dst = gdImageCreateTrueColor(size, size);
+	if (dst == NULL) {
+		return NULL;
+	}
+	for (y = 0; y < size; y++) {
+		for (x = 0; x < size; x++) {
+			unsafeSetTrueColorPixel(dst, x, y, gdTrueColorAlpha(0, 0, 0, gdAlphaTransparent));
+		}
+	}
+
+	src_w = gdImageSX(src);
+	src_h = gdImageSY(src);
+	if (src_w > src_h) {
+		width = size;
+		height = MAX(1, (int)((double)size * (double)src_h / (double)src_w + 0.5));
+	} else {
+		width = MAX(1, (int)((double)size * (double)src_w / (double)src_h + 0.5));
+		height = size;
+	}
+
+	dst->alphaBlendingFlag = gdEffectReplace;
+	gdImageCopyResampled(dst, src, (size - width) / 2, (size - height) / 2, 0, 0,
+			width, height, src_w, src_h);
+	dst->alphaBlendingFlag = gdEffectAlphaBlend;
+	dst->saveAlphaFlag = 1;
+
+	return dst;
+}
+
+/* }}} */
+/* {{{ _write_icon_mask() */
+
+/*
+ * Write the 1-bit AND mask of an icon image
+ */
+static byte_t *
+_write_icon_mask(byte_t *ptr, const gdImagePtr im, size_t line_size)
+{
+	int x, y, width, height, transparent;
+
+	width = gdImageSX(im);
+	height = gdImageSY(im);
+	transparent = gdImageGetTransparent(im);
+	if (transparent < 0) {
+		transparent = -1;
+	}
+
+	y = height;
+	while (y > 0) {
+		byte_t shift = 7, value = 0;
+		byte_t *eol = ptr + line_size;
+
+		--y;
+		for (x = 0; x < width; x++) {
+			if (gdImageTrueColor(im)) {
+				if (gdAlphaTransparent == getA(unsafeGetTrueColorPixel(im, x, y))) {
+					value |= (1 << shift);
+				}
+			} else if (transparent != -1) {
+				if (transparent == unsafeGetPalettePixel(im, x, y)) {
+					value |= (1 << shift);
+				}
+			}
+			if (shift == 0) {
+				*ptr++ = value;
+				shift = 7;
+				value = 0;
+			} else {
+				shift--;
+			}
+		}
+		if (shift != 7) {
+			*ptr++ = value;
+		}
+		while (ptr < eol) {
+			*ptr++ = '\0';
+		}
+	}
+
+	return ptr;
+}
+
 /* }}} */
 /* {{{ gdimages_to_icon() */
 
 /*
  * Create a Windows Icon image from an image resources
+ * Images whose width or height is png_size or more are stored as PNG.
  */
 static byte_t *
-_gdimages_to_icon(gdImagePtr *images, size_t num, size_t *result_size TSRMLS_DC)
+_gdimages_to_icon(gdImagePtr *images, size_t num, int png_size, int png_level,
+                  size_t *result_size TSRMLS_DC)
 {
-	byte_t *icon, *ptr;
+	icon_entry_t *entries, *entry;
+	byte_t *icon = NULL, *ptr, *icondirentry;
 	size_t icon_size, pos;
 
-	/* allocate for ICONDIR and ICONDIRENTRY */
+	/* encode all images first, so that the icon is allocated at once */
+	entries = (icon_entry_t *)ecalloc(num, sizeof(icon_entry_t));
 	icon_size = 6 + 16 * num;
 
+	for (pos = 0; pos < num; pos++) {
+		gdImagePtr im = images[pos];
+		int width = gdImageSX(im);
+		int height = gdImageSY(im);
+
+		entry = &entries[pos];
+		if (png_size > 0 && (width >= png_size || height >= png_size)) {
+			/* get a PNG image */
+			entry->buffer = gdex_png_encode(im, png_level, &entry->buffer_size TSRMLS_CC);
+			entry->data = entry->buffer;
+			entry->data_size = entry->buffer_size;
+			entry->bitcount = (gdImageTrueColor(im)) ? 32 : 8;
+		} else {
+			/* get a BMP image */
+			if (gdImageTrueColor(im)) {
+				entry->buffer = gdimage_to_bmp32(im, &entry->buffer_size, 0);
+				entry->bitcount = 32;
+			} else {
+				int colors = gdImageColorsTotal(im);
+				if (colors > 16) {
+					entry->buffer = gdimage_to_bmp8(im, &entry->buffer_size, 1, 0);
+					entry->bitcount = 8;
+				} else if (colors > 2) {
+					entry->buffer = gdimage_to_bmp4(im, &entry->buffer_size, 1, 0);
+					entry->bitcount = 4;
+				} else {
+					entry->buffer = gdimage_to_bmp1(im, &entry->buffer_size);
+					entry->bitcount = 1;
+				}
+			}
+			/* strip BITMAPFILEHEADER */
+			entry->data = entry->buffer + 14;
+			entry->data_size = entry->buffer_size - 14;
+			entry->mask_line_size = ((size_t)width + 31) / 32 * 4;
+			entry->mask_size = entry->mask_line_size * (size_t)height;
+		}
+		if (entry->buffer == NULL) {
+			goto cleanup;
+		}
+
+		icon_size += entry->data_size + entry->mask_size;
+		if (icon_size >= (size_t)INT_MAX) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Required memory size too large");
+			goto cleanup;
+		}
+	}
+
 	/* write ICONDIR */
 	icon = (byte_t *)emalloc(icon_size);
 	ptr = icon;
@@ -173,117 +478,52 @@ _gdimages_to_icon(gdImagePtr *images, size_t num, size_t *result_size TSRMLS_DC)
 	ptr = _write_uint16le(ptr, 1); /* idType: 1 for icons, 2 for cursors */
 	ptr = _write_uint16le(ptr, (uint16_t)num); /* idCount */
 
+	icondirentry = ptr;
+	ptr = icon + 6 + 16 * num;
+
 	for (pos = 0; pos < num; pos++) {
-		byte_t *temp, *buffer, *bitmap, *icondirentry;
-		size_t buffer_size, bitmap_size, mask_size, mask_width, mask_pad;
-		int x, y, width, height, transparent;
-		gdImagePtr im;
-
-		im = images[pos];
-		width = gdImageSX(im);
-		height = gdImageSY(im);
-		transparent = gdImageGetTransparent(im);
-		if (transparent < 0) {
-			transparent = -1;
-		}
-		mask_width = ((size_t)width + 7) / 8;
-		mask_pad = mask_width % 4;
-		mask_size = (mask_width + mask_pad) * (size_t)height;
+		gdImagePtr im = images[pos];
+		int width = gdImageSX(im);
+		int height = gdImageSY(im);
+
+		entry = &entries[pos];
 
 		/* write ICONDIRENTRY */
-		icondirentry = icon + 6 + 16 * pos;
 		*icondirentry++ = (byte_t)(0xffU & width);  /* bWidth:  0 if 256 pixels */
 		*icondirentry++ = (byte_t)(0xffU & height); /* bHeight: 0 if 256 pixels */
 		*icondirentry++ = '\0'; /* bColorCount: 0 if TrueColor or just (1 << wBitCount) colors */
 		*icondirentry++ = '\0'; /* bReserved */
 		icondirentry = _write_uint16le(icondirentry, 1); /* wPlanes */
-
-		/* get a BMP image */
-		if (gdImageTrueColor(im)) {
-			buffer = gdimage_to_bmp32(im, &buffer_size, 0);
-			icondirentry = _write_uint16le(icondirentry, 32); /* wBitCount */
-		} else {
-			int colors = gdImageColorsTotal(im);
-			if (colors > 16) {
-				buffer = gdimage_to_bmp8(im, &buffer_size, 1);
-				icondirentry = _write_uint16le(icondirentry, 8); /* wBitCount */
-			} else if (colors > 2) {
-				buffer = gdimage_to_bmp4(im, &buffer_size, 1);
-				icondirentry = _write_uint16le(icondirentry, 4); /* wBitCount */
-			} else {
-				buffer = gdimage_to_bmp1(im, &buffer_size);
-				icondirentry = _write_uint16le(icondirentry, 1); /* wBitCount */
-			}
-		}
-		if (buffer == NULL) {
-			efree(icon);
-			return NULL;
+		icondirentry = _write_uint16le(icondirentry, entry->bitcount); /* wBitCount */
+		icondirentry = _write_uint32le(icondirentry,
+				(uint32_t)(entry->data_size + entry->mask_size)); /* dwBytesInRes */
+		icondirentry = _write_uint32le(icondirentry,
+				(uint32_t)(ptr - icon)); /* dwImageOffset */
+
+		/* write ICONIMAGE (icHeader + icColors + icXOR = BMP without BITMAPFILEHEADER, or PNG) */
+		(void)memcpy(ptr, entry->data, entry->data_size);
+		if (entry->mask_size > 0) {
+			/* overwrite biHeight */
+			(void)_write_int32le(ptr + 8, (int32_t)height * 2);
 		}
-		bitmap = buffer + 14;
-		bitmap_size = buffer_size - 14;
+		ptr += entry->data_size;
 
-		/* overwrite biHeight */
-		(void)_write_int32le(bitmap + 8, (int32_t)height * 2);
-
-		/* write ICONDIRENTRY (dwBytesInRes and dwImageOffset) */
-		icondirentry = _write_uint32le(icondirentry, (uint32_t)(bitmap_size + mask_size));
-		icondirentry = _write_uint32le(icondirentry, (uint32_t)icon_size);
-
-		/* reallocate for ICONIMAGE */
-		temp = erealloc(icon, icon_size + bitmap_size + mask_size);
-		if (temp == NULL) {
-			efree(buffer);
-			efree(icon);
-			php_error_docref(NULL TSRMLS_CC, E_ERROR,
-					"Failed to reallocate memory for %zu bytes",
-					icon_size + bitmap_size + mask_size);
-			return NULL;
+		/* write ICONIMAGE (icAND = 1-bit mask) */
+		if (entry->mask_size > 0) {
+			ptr = _write_icon_mask(ptr, im, entry->mask_line_size);
 		}
-		icon = temp;
-
-		/* write ICONIMAGE (icHeader + icColors + icXOR = BMP without BITMAPFILEHEADER) */
-		ptr = icon + icon_size;
-		(void)memcpy(ptr, bitmap, bitmap_size);
-		efree(buffer);
+	}
 
-		/* write ICONIMAGE (icAND = 1-bit mask) */
-		ptr = icon + icon_size + bitmap_size;
-		y = height;
-		while (y > 0) {
-			byte_t shift = 7, value = 0;
-			byte_t *eol = ptr + mask_width + mask_pad;
+	*result_size = icon_size;
 
-			--y;
-			for (x = 0; x < width; x++) {
-				if (gdImageTrueColor(im)) {
-					if (gdAlphaTransparent == getA(unsafeGetTrueColorPixel(im, x, y))) {
-						value |= (1 << shift);
-					}
-				} else if (transparent != -1) {
-					if (transparent == unsafeGetPalettePixel(im, x, y)) {
-						value |= (1 << shift);
-					}
-				}
-				if (shift == 0) {
-					*ptr++ = value;
-					shift = 7;
-					value = 0;
-				} else {
-					shift--;
-				}
-			}
-			if (shift != 7) {
-				*ptr++ = value;
-			}
-			while (ptr < eol) {
-				*ptr++ = '\0';
-			}
+  cleanup:
+	for (pos = 0; pos < num; pos++) {
+		if (entries[pos].buffer != NULL) {
+			efree(entries[pos].buffer);
 		}
-
-		icon_size += bitmap_size + mask_size;
 	}
+	efree(entries);
 
-	*result_size = icon_size;
 	return icon;
 }
 
@@ -357,6 +597,172 @@ _write_bmp_palette(byte_t *ptr, const gdImagePtr im, int ncolors)
 	return ptr;
 }
 
+/* }}} */
+/* {{{ _write_rle_literal() */
+
+#define RLE_PUT(_b) { \
+	if (ptr != NULL) { \
+		*ptr++ = (byte_t)(_b); \
+	} \
+	size++; \
+}
+
+/*
+ * Write 1 to 255 palette indices without compression.
+ * Only counts the bytes if ptr is NULL.
+ */
+static size_t
+_write_rle_literal(byte_t *ptr, const unsigned char *row, int length, zend_bool rle4)
+{
+	size_t size = 0;
+	int i = 0, run;
+
+	if (length < 3) {
+		/* too short for absolute mode */
+		while (i < length) {
+			if (rle4) {
+				run = (length - i >= 2) ? 2 : 1;
+				RLE_PUT(run);
+				RLE_PUT(((row[i] & 0x0fU) << 4)
+					| ((run == 2) ? (row[i + 1] & 0x0fU) : 0U));
+			} else {
+				run = (length - i >= 2 && row[i + 1] == row[i]) ? 2 : 1;
+				RLE_PUT(run);
+				RLE_PUT(row[i]);
+			}
+			i += run;
+		}
+	} else {
+		/* absolute mode, padded to a word boundary */
+		RLE_PUT(0);
+		RLE_PUT(length);
+		if (rle4) {
+			for (i = 0; i < length; i += 2) {
+				RLE_PUT(((row[i] & 0x0fU) << 4)
+					| ((i + 1 < length) ? (row[i + 1] & 0x0fU) : 0U));
+			}
+			if (((length + 1) / 2) & 1) {
+				RLE_PUT(0);
+			}
+		} else {
+			for (i = 0; i < length; i++) {
+				RLE_PUT(row[i]);
+			}
+			if (length & 1) {
+				RLE_PUT(0);
+			}
+		}
+	}
+
+	return size;
+}
+
+/* }}} */
+/* {{{ _write_rle_runs() */
+
+/*
+ * Write a row of palette indices in encoded mode where runs are found.
+ * Only counts the bytes if ptr is NULL.
+ */
+static size_t
+_write_rle_runs(byte_t *ptr, const unsigned char *row, int width, zend_bool rle4)
+{
+	size_t size = 0, length;
+	int i = 0, j, run;
+
+	while (i < width) {
+		/* scan a run; RLE4 runs alternate two indices */
+		run = 1;
+		if (rle4) {
+			while (i + run < width && run < 255
+					&& row[i + run] == row[i + (run & 1)])
+			{
+				run++;
+			}
+		} else {
+			while (i + run < width && run < 255 && row[i + run] == row[i]) {
+				run++;
+			}
+		}
+		if (run >= 3) {
+			RLE_PUT(run);
+			if (rle4) {
+				RLE_PUT(((row[i] & 0x0fU) << 4) | (row[i + 1] & 0x0fU));
+			} else {
+				RLE_PUT(row[i]);
+			}
+			i += run;
+			continue;
+		}
+
+		/* scan literal pixels until the next run */
+		j = i;
+		while (j < width && j - i < 255) {
+			if (j + 2 < width) {
+				if (rle4) {
+					if (row[j + 2] == row[j] && j + 3 < width && row[j + 3] == row[j + 1]) {
+						break;
+					}
+				} else if (row[j + 1] == row[j] && row[j + 2] == row[j]) {
+					break;
+				}
+			}
+			j++;
+		}
+		length = _write_rle_literal(ptr, row + i, j - i, rle4);
+		if (ptr != NULL) {
+			ptr += length;
+		}
+		size += length;
+		i = j;
+	}
+
+	return size;
+}
+
+#undef RLE_PUT
+
+/* }}} */
+/* {{{ _write_rle_row() */
+
+/*
+ * Write a row of palette indices in BI_RLE8 or BI_RLE4 followed by
+ * an end-of-line marker, and return the number of bytes.
+ * Rows that do not compress fall back to absolute mode.
+ * Only counts the bytes if ptr is NULL.
+ */
+static size_t
+_write_rle_row(byte_t *ptr, const unsigned char *row, int width, zend_bool rle4)
+{
+	size_t encoded_size, absolute_size = 0, size = 0;
+	int i, length;
+
+	encoded_size = _write_rle_runs(NULL, row, width, rle4);
+	for (i = 0; i < width; i += 255) {
+		length = MIN(width - i, 255);
+		absolute_size += _write_rle_literal(NULL, row + i, length, rle4);
+	}
+
+	if (ptr == NULL) {
+		return MIN(encoded_size, absolute_size) + 2;
+	}
+
+	if (encoded_size <= absolute_size) {
+		size = _write_rle_runs(ptr, row, width, rle4);
+	} else {
+		for (i = 0; i < width; i += 255) {
+			length = MIN(width - i, 255);
+			size += _write_rle_literal(ptr + size, row + i, length, rle4);
+		}
+	}
+
+	/* end of line */
+	ptr[size++] = '\0';
+	ptr[size++] = '\0';
+
+	return size;
+}
+
 /* }}} */
 /* {{{ _gdimage_to_bmp1() */
 
@@ -446,7 +852,7 @@ _gdimage_to_bmp1(const gdImagePtr im, size_t *size TSRMLS_DC)
  * Create an 4-bit Windows Bitmap image from an image resource
  */
 static byte_t *
-_gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRMLS_DC)
+_gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette, zend_bool rle TSRMLS_DC)
 {
 	byte_t *buffer, *ptr;
 	size_t buffer_size, image_offset, image_size, line_size;
@@ -465,7 +871,15 @@ _gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
 	/* calculate required memory size */
 	image_offset = 14 + 40 + 4 * ((fill_palette) ? 16 : (size_t)colors);
 	line_size = ((size_t)width * 4 + 31) / 32 * 4;
-	image_size = line_size * (size_t)height;
+	if (rle) {
+		/* pre-pass to get the compressed size */
+		image_size = 2; /* end of bitmap */
+		for (y = 0; y < height; y++) {
+			image_size += _write_rle_row(NULL, im->pixels[y], width, 1);
+		}
+	} else {
+		image_size = line_size * (size_t)height;
+	}
 	buffer_size = image_offset + image_size;
 	if (buffer_size >= (size_t)INT_MAX) {
 		php_error_docref(NULL TSRMLS_CC, E_ERROR, "Required memory size too large");
@@ -484,6 +898,10 @@ _gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
 	/* write header */
 	ptr = _write_bmp_header(ptr,
 			buffer_size, image_offset, image_size, width, height, 4U);
+	if (rle) {
+		/* overwrite biCompression */
+		(void)_write_uint32le(buffer + 14 + 16, BMP_BI_RLE4);
+	}
 	if (colors != 16 && !fill_palette) {
 		/* overwrite biClrUsed */
 		(void)_write_uint32le(buffer + 14 + 32, (uint32_t)colors);
@@ -493,21 +911,31 @@ _gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
 	ptr = _write_bmp_palette(ptr, im, ((fill_palette) ? 16 : -1));
 
 	/* write image data */
-	y = height;
-	while (y > 0) {
-		byte_t *eol = ptr + line_size;
-
-		--y;
-		x = 0;
-		while (x < width - 1) {
-			*ptr = (byte_t)(0xf0U & (unsafeGetPalettePixel(im, x++, y) << 4));
-			*ptr++ |= (byte_t)(0x0fU & unsafeGetPalettePixel(im, x++, y));
-		}
-		if (x == width - 1) {
-			*ptr++ = (byte_t)(0xf0U & (unsafeGetPalettePixel(im, x, y) << 4));
+	if (rle) {
+		y = height;
+		while (y > 0) {
+			--y;
+			ptr += _write_rle_row(ptr, im->pixels[y], width, 1);
 		}
-		while (ptr < eol) {
-			*ptr++ = '\0';
+		*ptr++ = '\0';
+		*ptr++ = '\1';
+	} else {
+		y = height;
+		while (y > 0) {
+			byte_t *eol = ptr + line_size;
+
+			--y;
+			x = 0;
+			while (x < width - 1) {
+				*ptr = (byte_t)(0xf0U & (unsafeGetPalettePixel(im, x++, y) << 4));
+				*ptr++ |= (byte_t)(0x0fU & unsafeGetPalettePixel(im, x++, y));
+			}
+			if (x == width - 1) {
+				*ptr++ = (byte_t)(0xf0U & (unsafeGetPalettePixel(im, x, y) << 4));
+			}
+			while (ptr < eol) {
+				*ptr++ = '\0';
+			}
 		}
 	}
 
@@ -524,7 +952,7 @@ _gdimage_to_bmp4(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
  * Create an 8-bit Windows Bitmap image from an image resource
  */
 static byte_t *
-_gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRMLS_DC)
+_gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette, zend_bool rle TSRMLS_DC)
 {
 	byte_t *buffer, *ptr;
 	size_t buffer_size, image_offset, image_size, line_size;
@@ -543,8 +971,16 @@ _gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
 	/* calculate required memory size */
 	image_offset = 14 + 40 + 4 * ((fill_palette) ? 256 : (size_t)colors);
 	line_size = ((size_t)width * 8 + 31) / 32 * 4;
-	image_size = line_size * (size_t)height;
-	buffer_size = image_offset + image_size;
+	if (rle) {
+		/* pre-pass to get the compressed size */
+		image_size = 2; /* end of bitmap */
+		for (y = 0; y < height; y++) {
+			image_size += _write_rle_row(NULL, im->pixels[y], width, 0);
+		}
+	} else {
+		image_size = line_size * (size_t)height;
+	}
+	buffer_size = image_offset + image_size;
 	if (buffer_size >= (size_t)INT_MAX) {
 		php_error_docref(NULL TSRMLS_CC, E_ERROR, "Required memory size too large");
 		return NULL;
@@ -562,6 +998,10 @@ _gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
 	/* write header */
 	ptr = _write_bmp_header(ptr,
 			buffer_size, image_offset, image_size, width, height, 8U);
+	if (rle) {
+		/* overwrite biCompression */
+		(void)_write_uint32le(buffer + 14 + 16, BMP_BI_RLE8);
+	}
 	if (colors != 256 && !fill_palette) {
 		/* overwrite biClrUsed */
 		(void)_write_uint32le(buffer + 14 + 32, (uint32_t)colors);
@@ -571,16 +1011,26 @@ _gdimage_to_bmp8(const gdImagePtr im, size_t *size, zend_bool fill_palette TSRML
 	ptr = _write_bmp_palette(ptr, im, ((fill_palette) ? 256 : -1));
 
 	/* write image data */
-	y = height;
-	while (y > 0) {
-		byte_t *eol = ptr + line_size;
-
-		--y;
-		for (x = 0; x < width; x++) {
-			*ptr++ = unsafeGetPalettePixel(im, x, y);
+	if (rle) {
+		y = height;
+		while (y > 0) {
+			--y;
+			ptr += _write_rle_row(ptr, im->pixels[y], width, 0);
 		}
-		while (ptr < eol) {
-			*ptr++ = '\0';
+		*ptr++ = '\0';
+		*ptr++ = '\1';
+	} else {
+		y = height;
+		while (y > 0) {
+			byte_t *eol = ptr + line_size;
+
+			--y;
+			for (x = 0; x < width; x++) {
+				*ptr++ = unsafeGetPalettePixel(im, x, y);
+			}
+			while (ptr < eol) {
+				*ptr++ = '\0';
+			}
 		}
 	}
 
@@ -773,10 +1223,718 @@ _output_image(const char *filename, const byte_t *buffer, size_t buffer_size TSR
 }
 
 /* }}} */
-/* {{{ bool imagebmp(resource im[, string filename]) */
+/* {{{ _read_bmp_info() */
+
+/*
+ * Parse BITMAPCOREHEADER, BITMAPINFOHEADER or its successors
+ */
+static int
+_read_bmp_info(bmp_info_t *info, const byte_t *data, size_t size, zend_bool icon TSRMLS_DC)
+{
+	uint32_t header_size, colors_used = 0;
+	int32_t height;
+	size_t palette_size;
+
+	memset(info, 0, sizeof(bmp_info_t));
+
+	if (size < 12) {
+		goto truncated;
+	}
+	header_size = _read_uint32le(data);
+
+	if (header_size == 12) {
+		/* BITMAPCOREHEADER */
+		info->width = (int)_read_uint16le(data + 4);
+		height = (int32_t)_read_uint16le(data + 6);
+		info->bitcount = _read_uint16le(data + 10);
+		info->compression = BMP_BI_RGB;
+		info->palette_entry_size = 3;
+	} else if (header_size >= 40) {
+		/* BITMAPINFOHEADER, BITMAPV4HEADER, BITMAPV5HEADER, etc. */
+		if (header_size > size) {
+			goto truncated;
+		}
+		info->width = (int)(int32_t)_read_uint32le(data + 4);
+		height = (int32_t)_read_uint32le(data + 8);
+		info->bitcount = _read_uint16le(data + 14);
+		info->compression = _read_uint32le(data + 16);
+		colors_used = _read_uint32le(data + 32);
+		info->palette_entry_size = 4;
+	} else {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Unsupported bitmap header size (%u)", (unsigned int)header_size);
+		return FAILURE;
+	}
+	info->palette_offset = (size_t)header_size;
+
+	/* the height of an icon includes the AND mask */
+	if (icon) {
+		height /= 2;
+	}
+	if (height < 0 && height != INT32_MIN && !icon) {
+		info->topdown = 1;
+		height = -height;
+	}
+	info->height = (int)height;
+
+	if (info->width < 1 || info->height < 1) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Invalid image dimensions (%dx%d)", info->width, info->height);
+		return FAILURE;
+	}
+	if ((size_t)info->width > (size_t)(INT_MAX / 4) / (size_t)info->height) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Image dimensions too large");
+		return FAILURE;
+	}
+
+	/* verify the combination of the bit count and the compression */
+	switch (info->compression) {
+		case BMP_BI_RGB:
+			switch (info->bitcount) {
+				case 1: case 4: case 8: case 16: case 24: case 32:
+					break;
+				default:
+					goto unsupported;
+			}
+			break;
+		case BMP_BI_RLE8:
+			if (info->bitcount != 8 || info->topdown) {
+				goto unsupported;
+			}
+			break;
+		case BMP_BI_RLE4:
+			if (info->bitcount != 4 || info->topdown) {
+				goto unsupported;
+			}
+			break;
+		case BMP_BI_BITFIELDS:
+		case BMP_BI_ALPHABITFIELDS:
+			if (info->bitcount != 16 && info->bitcount != 32) {
+				goto unsupported;
+			}
+			break;
+		default:
+			goto unsupported;
+	}
+
+	/* get the color masks */
+	if (info->compression == BMP_BI_BITFIELDS || info->compression == BMP_BI_ALPHABITFIELDS) {
+		const byte_t *masks;
+		int num = (info->compression == BMP_BI_ALPHABITFIELDS) ? 4 : 3;
+
+		if (header_size >= 52) {
+			masks = data + 40;
+			if (header_size >= 56) {
+				num = 4;
+			}
+		} else {
+			/* the masks follow BITMAPINFOHEADER */
+			if (info->palette_offset + 4 * (size_t)num > size) {
+				goto truncated;
+			}
+			masks = data + info->palette_offset;
+			info->palette_offset += 4 * (size_t)num;
+		}
+		info->mask[0] = _read_uint32le(masks);
+		info->mask[1] = _read_uint32le(masks + 4);
+		info->mask[2] = _read_uint32le(masks + 8);
+		if (num == 4) {
+			info->mask[3] = _read_uint32le(masks + 12);
+		}
+	} else if (info->bitcount == 16) {
+		info->mask[0] = 0x7c00U;
+		info->mask[1] = 0x03e0U;
+		info->mask[2] = 0x001fU;
+	} else if (info->bitcount == 32) {
+		info->mask[0] = 0x00ff0000U;
+		info->mask[1] = 0x0000ff00U;
+		info->mask[2] = 0x000000ffU;
+		/* 32-bit icons have the alpha channel */
+		if (icon) {
+			info->mask[3] = 0xff000000U;
+		}
+	}
+	info->use_alpha = (info->mask[3] != 0);
+
+	/* get the number of palette entries */
+	if (info->bitcount <= 8) {
+		info->colors = (size_t)1 << info->bitcount;
+		if (colors_used > 0 && colors_used < info->colors) {
+			info->colors = (size_t)colors_used;
+		}
+		palette_size = info->colors * info->palette_entry_size;
+	} else {
+		palette_size = (size_t)MIN(colors_used, 256U) * info->palette_entry_size;
+	}
+	if (info->palette_offset + palette_size > size) {
+		goto truncated;
+	}
+	info->bits_offset = info->palette_offset + palette_size;
+
+	return SUCCESS;
+
+  unsupported:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING,
+			"Unsupported bitmap format (%u-bit, compression %u)",
+			info->bitcount, info->compression);
+	return FAILURE;
+
+  truncated:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "Truncated bitmap header");
+	return FAILURE;
+}
+
+/* }}} */
+/* {{{ _init_bmp_field() */
+
+/*
+ * Get the bit position and width of a color mask
+ */
+static void
+_init_bmp_field(bmp_field_t *field, uint32_t mask)
+{
+	field->mask = mask;
+	field->shift = 0;
+	field->max = 0;
+
+	if (mask != 0) {
+		while (!(mask & 1U)) {
+			mask >>= 1;
+			field->shift++;
+		}
+		field->max = mask;
+	}
+}
+
+#define BMP_FIELD_VALUE(_f, _p) \
+	(((_f).max == 255U) ? (((_p) & (_f).mask) >> (_f).shift) \
+	                    : (uint32_t)(((uint64_t)(((_p) & (_f).mask) >> (_f).shift) * 255U + (_f).max / 2) / (_f).max))
+
+/* }}} */
+/* {{{ _decode_rle() */
+
+/*
+ * Decode BI_RLE8 or BI_RLE4 bitmap bits
+ */
+static int
+_decode_rle(gdImagePtr im, const bmp_info_t *info,
+            const byte_t *bits, size_t bits_size, const byte_t *map)
+{
+	const byte_t *ptr = bits, *end = bits + bits_size;
+	int x = 0, y = 0, i;
+	int width = info->width, height = info->height;
+	zend_bool rle4 = (info->compression == BMP_BI_RLE4);
+	unsigned char *dst = im->pixels[height - 1];
+
+#define RLE_SET_PIXEL(_c) { \
+	if (x < width) { \
+		dst[x++] = map[(_c)]; \
+	} \
+}
+
+	while (ptr + 2 <= end && y < height) {
+		byte_t count = *ptr++;
+		byte_t value = *ptr++;
+
+		if (count > 0) {
+			/* encoded mode */
+			if (rle4) {
+				byte_t hi = (byte_t)(value >> 4), lo = (byte_t)(value & 0x0fU);
+				for (i = 0; i < count; i++) {
+					RLE_SET_PIXEL((i & 1) ? lo : hi);
+				}
+			} else {
+				for (i = 0; i < count; i++) {
+					RLE_SET_PIXEL(value);
+				}
+			}
+		} else if (value == 0) {
+			/* end of line */
+			x = 0;
+			if (++y < height) {
+				dst = im->pixels[height - 1 - y];
+			}
+		} else if (value == 1) {
+			/* end of bitmap */
+			return SUCCESS;
+		} else if (value == 2) {
+			/* delta */
+			if (ptr + 2 > end) {
+				break;
+			}
+			if (ptr[0] > width - x || ptr[1] > height - y) {
+				return FAILURE;
+			}
+			x += *ptr++;
+			y += *ptr++;
+			if (y < height) {
+				dst = im->pixels[height - 1 - y];
+			}
+		} else {
+			/* absolute mode, padded to a word boundary */
+			size_t length = (rle4) ? ((size_t)value + 1) / 2 : (size_t)value;
+			if (ptr + length > end) {
+				break;
+			}
+			if (rle4) {
+				for (i = 0; i < value; i++) {
+					RLE_SET_PIXEL((i & 1) ? (ptr[i >> 1] & 0x0fU) : (ptr[i >> 1] >> 4));
+				}
+			} else {
+				for (i = 0; i < value; i++) {
+					RLE_SET_PIXEL(ptr[i]);
+				}
+			}
+			ptr += (length + 1) & ~(size_t)1;
+		}
+	}
+
+#undef RLE_SET_PIXEL
+
+	/* tolerate a missing end-of-bitmap marker */
+	return (y >= height - 1) ? SUCCESS : FAILURE;
+}
+
+/* }}} */
+/* {{{ _decode_dib() */
+
+/*
+ * Create an image resource from a device-independent bitmap
+ */
+static gdImagePtr
+_decode_dib(const bmp_info_t *info, const byte_t *data, size_t size TSRMLS_DC)
+{
+	gdImagePtr im;
+	const byte_t *bits;
+	size_t bits_size, line_size, i;
+	byte_t map[256];
+	int x, y, width, height;
+
+	width = info->width;
+	height = info->height;
+
+	if (info->bits_offset >= size) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Truncated bitmap data");
+		return NULL;
+	}
+	bits = data + info->bits_offset;
+	bits_size = size - info->bits_offset;
+
+	/* create an image and fill the palette */
+	if (info->bitcount <= 8) {
+		im = gdImageCreate(width, height);
+	} else {
+		im = gdImageCreateTrueColor(width, height);
+	}
+	if (im == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to create an image");
+		return NULL;
+	}
+
+	if (info->bitcount <= 8) {
+		const byte_t *entry = data + info->palette_offset;
+		for (i = 0; i < info->colors; i++) {
+			im->red[i] = entry[2];
+			im->green[i] = entry[1];
+			im->blue[i] = entry[0];
+			im->alpha[i] = gdAlphaOpaque;
+			im->open[i] = 0;
+			entry += info->palette_entry_size;
+		}
+		im->colorsTotal = (int)info->colors;
+
+		/* out-of-range indices fall back to the first color */
+		for (i = 0; i < 256; i++) {
+			map[i] = (byte_t)((i < info->colors) ? i : 0);
+		}
+	} else if (info->use_alpha) {
+		im->saveAlphaFlag = 1;
+	}
+
+	/* decode compressed bits */
+	if (info->compression == BMP_BI_RLE8 || info->compression == BMP_BI_RLE4) {
+		if (_decode_rle(im, info, bits, bits_size, map) == FAILURE) {
+			goto truncated;
+		}
+		return im;
+	}
+
+	/* decode uncompressed bits */
+	line_size = ((size_t)width * info->bitcount + 31) / 32 * 4;
+	if (height > 1 && line_size > bits_size / (size_t)(height - 1)) {
+		goto truncated;
+	}
+	if (line_size * (size_t)(height - 1) + ((size_t)width * info->bitcount + 7) / 8 > bits_size) {
+		goto truncated;
+	}
+
+	if (info->bitcount <= 8) {
+		zend_bool identity = (info->colors == 256);
+
+		for (y = 0; y < height; y++) {
+			const byte_t *src = bits + line_size * (size_t)y;
+			unsigned char *dst = im->pixels[(info->topdown) ? y : height - 1 - y];
+
+			switch (info->bitcount) {
+				case 1:
+					for (x = 0; x < width; x++) {
+						dst[x] = map[(src[x >> 3] >> (7 - (x & 7))) & 1];
+					}
+					break;
+				case 4:
+					for (x = 0; x < width; x++) {
+						dst[x] = map[(x & 1) ? (src[x >> 1] & 0x0fU) : (src[x >> 1] >> 4)];
+					}
+					break;
+				default:
+					if (identity) {
+						memcpy(dst, src, (size_t)width);
+					} else {
+						for (x = 0; x < width; x++) {
+							dst[x] = map[src[x]];
+						}
+					}
+			}
+		}
+	} else if (info->bitcount == 24) {
+		for (y = 0; y < height; y++) {
+			const byte_t *src = bits + line_size * (size_t)y;
+			int *dst = im->tpixels[(info->topdown) ? y : height - 1 - y];
+
+			for (x = 0; x < width; x++, src += 3) {
+				dst[x] = gdTrueColor(src[2], src[1], src[0]);
+			}
+		}
+	} else if (info->bitcount == 32
+			&& info->mask[0] == 0x00ff0000U
+			&& info->mask[1] == 0x0000ff00U
+			&& info->mask[2] == 0x000000ffU
+			&& (info->mask[3] == 0 || info->mask[3] == 0xff000000U))
+	{
+		/* BGRA, the most common layout */
+		for (y = 0; y < height; y++) {
+			const byte_t *src = bits + line_size * (size_t)y;
+			int *dst = im->tpixels[(info->topdown) ? y : height - 1 - y];
+
+			if (info->use_alpha) {
+				for (x = 0; x < width; x++, src += 4) {
+					dst[x] = gdTrueColorAlpha(src[2], src[1], src[0], _gray2alpha(src[3]));
+				}
+			} else {
+				for (x = 0; x < width; x++, src += 4) {
+					dst[x] = gdTrueColor(src[2], src[1], src[0]);
+				}
+			}
+		}
+	} else {
+		/* arbitrary bit fields */
+		bmp_field_t fr, fg, fb, fa;
+
+		_init_bmp_field(&fr, info->mask[0]);
+		_init_bmp_field(&fg, info->mask[1]);
+		_init_bmp_field(&fb, info->mask[2]);
+		_init_bmp_field(&fa, info->mask[3]);
+		if (fr.max == 0 || fg.max == 0 || fb.max == 0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid color masks");
+			gdImageDestroy(im);
+			return NULL;
+		}
+
+		for (y = 0; y < height; y++) {
+			const byte_t *src = bits + line_size * (size_t)y;
+			int *dst = im->tpixels[(info->topdown) ? y : height - 1 - y];
+
+			for (x = 0; x < width; x++) {
+				uint32_t p;
+				int a = gdAlphaOpaque;
+
+				if (info->bitcount == 16) {
+					p = _read_uint16le(src);
+					src += 2;
+				} else {
+					p = _read_uint32le(src);
+					src += 4;
+				}
+				if (fa.max != 0) {
+					a = _gray2alpha((int)BMP_FIELD_VALUE(fa, p));
+				}
+				dst[x] = gdTrueColorAlpha((int)BMP_FIELD_VALUE(fr, p),
+				                          (int)BMP_FIELD_VALUE(fg, p),
+				                          (int)BMP_FIELD_VALUE(fb, p), a);
+			}
+		}
+	}
+
+	return im;
+
+  truncated:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "Truncated bitmap data");
+	gdImageDestroy(im);
+	return NULL;
+}
+
+/* }}} */
+/* {{{ gdex_bmp_decode() */
+
+/*
+ * Decode a Windows Bitmap image in memory
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_bmp_decode(const unsigned char *data, size_t size TSRMLS_DC)
+{
+	bmp_info_t info;
+	size_t offset;
+
+	if (size < 14 || data[0] != 'B' || data[1] != 'M') {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Not a BMP image");
+		return NULL;
+	}
+
+	if (_read_bmp_info(&info, data + 14, size - 14, 0 TSRMLS_CC) == FAILURE) {
+		return NULL;
+	}
+
+	/* prefer bfOffBits unless it points into the headers */
+	offset = (size_t)_read_uint32le(data + 10);
+	if (offset >= 14 + info.palette_offset) {
+		info.bits_offset = offset - 14;
+	}
+
+	return _decode_dib(&info, data + 14, size - 14 TSRMLS_CC);
+}
+
+/* }}} */
+/* {{{ _read_icondir() */
+
+/*
+ * Read ICONDIR and ICONDIRENTRY[] without decoding the images
+ */
+static icon_dirent_t *
+_read_icondir(const byte_t *data, size_t size, size_t *num TSRMLS_DC)
+{
+	icon_dirent_t *entries;
+	const byte_t *ptr;
+	size_t count, i;
+	unsigned int type;
+
+	if (size < 6 || _read_uint16le(data) != 0) {
+		goto invalid;
+	}
+	type = _read_uint16le(data + 2); /* idType: 1 for icons, 2 for cursors */
+	count = (size_t)_read_uint16le(data + 4);
+	if ((type != 1 && type != 2) || count == 0) {
+		goto invalid;
+	}
+	if (6 + 16 * count > size) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Truncated icon directory");
+		return NULL;
+	}
+
+	entries = (icon_dirent_t *)safe_emalloc(count, sizeof(icon_dirent_t), 0);
+	ptr = data + 6;
+	for (i = 0; i < count; i++, ptr += 16) {
+		icon_dirent_t *entry = &entries[i];
+
+		entry->width = (ptr[0] == 0) ? 256 : (int)ptr[0];
+		entry->height = (ptr[1] == 0) ? 256 : (int)ptr[1];
+		entry->bitcount = (type == 1) ? _read_uint16le(ptr + 6) : 0;
+		entry->size = (size_t)_read_uint32le(ptr + 8);
+		entry->offset = (size_t)_read_uint32le(ptr + 12);
+
+		if (entry->offset > size || entry->size > size - entry->offset || entry->size < 16) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Invalid icon entry (#%lu)", (unsigned long)i);
+			efree(entries);
+			return NULL;
+		}
+
+		/* cursors and some writers leave wBitCount zero */
+		if (entry->bitcount == 0 && memcmp(data + entry->offset, "\x89PNG", 4) != 0) {
+			entry->bitcount = _read_uint16le(data + entry->offset + 14);
+		}
+	}
+
+	*num = count;
+	return entries;
+
+  invalid:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "Not an icon or a cursor image");
+	return NULL;
+}
+
+/* }}} */
+/* {{{ _select_icon_entry() */
+
+/*
+ * Get the index of the entry closest to the size, or the largest entry if size is 0
+ * Ties are broken by the larger size and then by the higher bit count.
+ */
+static size_t
+_select_icon_entry(const icon_dirent_t *entries, size_t num, long size)
+{
+	size_t i, best = 0;
+	long best_diff = -1L;
+
+	for (i = 0; i < num; i++) {
+		const icon_dirent_t *entry = &entries[i];
+		long dim = (long)MAX(entry->width, entry->height);
+		long diff = (size > 0L) ? labs(dim - size) : 256L - dim;
+		long best_dim = (long)MAX(entries[best].width, entries[best].height);
+
+		if (best_diff < 0L || diff < best_diff
+				|| (diff == best_diff && (dim > best_dim
+					|| (dim == best_dim && entry->bitcount > entries[best].bitcount))))
+		{
+			best = i;
+			best_diff = diff;
+		}
+	}
+
+	return best;
+}
+
+/* }}} */
+/* {{{ _decode_icon_entry() */
+
+/*
+ * Create an image resource from an icon entry
+ * PNG entries are decoded by GD, and the AND mask of BMP entries
+ * is applied to the alpha channel.
+ */
+static gdImagePtr
+_decode_icon_entry(const icon_dirent_t *entry, const byte_t *data TSRMLS_DC)
+{
+	gdImagePtr im;
+	bmp_info_t info;
+	const byte_t *dib = data + entry->offset, *mask;
+	size_t mask_offset, line_size;
+	int x, y, width, height, has_alpha = 0, has_mask = 0;
+
+	/* embedded PNG */
+	if (memcmp(dib, "\x89PNG\r\n\x1a\n", 8) == 0) {
+		im = gdImageCreateFromPngPtr((int)entry->size, (void *)dib);
+		if (im == NULL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to decode the PNG entry");
+			return NULL;
+		}
+		if (gdImageTrueColor(im)) {
+			im->saveAlphaFlag = 1;
+		}
+		return im;
+	}
+
+	/* BMP without BITMAPFILEHEADER, followed by the AND mask */
+	if (_read_bmp_info(&info, dib, entry->size, 1 TSRMLS_CC) == FAILURE) {
+		return NULL;
+	}
+	if (info.compression != BMP_BI_RGB && info.compression != BMP_BI_BITFIELDS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Compressed icon entries are not supported");
+		return NULL;
+	}
+	im = _decode_dib(&info, dib, entry->size TSRMLS_CC);
+	if (im == NULL) {
+		return NULL;
+	}
+	width = info.width;
+	height = info.height;
+
+	/* 32-bit entries with the alpha channel ignore the mask */
+	if (info.use_alpha) {
+		for (y = 0; y < height && !has_alpha; y++) {
+			for (x = 0; x < width; x++) {
+				if (getA(unsafeGetTrueColorPixel(im, x, y)) != gdAlphaTransparent) {
+					has_alpha = 1;
+					break;
+				}
+			}
+		}
+		if (has_alpha) {
+			return im;
+		}
+	}
+
+	/* get the AND mask */
+	mask_offset = info.bits_offset
+		+ ((size_t)width * info.bitcount + 31) / 32 * 4 * (size_t)height;
+	line_size = ((size_t)width + 31) / 32 * 4;
+	if (mask_offset > entry->size || line_size * (size_t)height > entry->size - mask_offset) {
+		/* no mask; 32-bit pixels are opaque */
+		if (info.use_alpha) {
+			for (y = 0; y < height; y++) {
+				for (x = 0; x < width; x++) {
+					im->tpixels[y][x] &= 0xffffff;
+				}
+			}
+		}
+		return im;
+	}
+	mask = dib + mask_offset;
+
+	for (y = 0; y < height && !has_mask; y++) {
+		const byte_t *src = mask + line_size * (size_t)y;
+		for (x = 0; x < width; x++) {
+			if (src[x >> 3] & (0x80U >> (x & 7))) {
+				has_mask = 1;
+				break;
+			}
+		}
+	}
+	if (!has_mask && !info.use_alpha) {
+		return im;
+	}
+
+	/* apply the mask to the alpha channel */
+	if (!gdImageTrueColor(im) && gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+		gdImageDestroy(im);
+		return NULL;
+	}
+	for (y = 0; y < height; y++) {
+		const byte_t *src = mask + line_size * (size_t)y;
+		int *dst = im->tpixels[height - 1 - y];
+
+		for (x = 0; x < width; x++) {
+			int c = dst[x] & 0xffffff;
+			if (src[x >> 3] & (0x80U >> (x & 7))) {
+				c |= gdAlphaTransparent << 24;
+			}
+			dst[x] = c;
+		}
+	}
+	im->saveAlphaFlag = 1;
+
+	return im;
+}
+
+/* }}} */
+/* {{{ gdex_icon_decode() */
+
+/*
+ * Decode the largest entry of an icon or a cursor in memory
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_icon_decode(const unsigned char *data, size_t size TSRMLS_DC)
+{
+	icon_dirent_t *entries;
+	size_t num = 0;
+	gdImagePtr im;
+
+	entries = _read_icondir(data, size, &num TSRMLS_CC);
+	if (entries == NULL) {
+		return NULL;
+	}
+	im = _decode_icon_entry(&entries[_select_icon_entry(entries, num, ICON_LARGEST)],
+			data TSRMLS_CC);
+	efree(entries);
+
+	return im;
+}
+
+/* }}} */
+/* {{{ bool imagebmp(resource im[, string filename[, bool rle]]) */
 
 /*
  * Output a BMP image to either the browser or a file
+ * Palette images with 3 to 256 colors can be RLE compressed.
  */
 GDEXTRA_LOCAL GDEX_FUNCTION(imagebmp)
 {
@@ -786,11 +1944,12 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagebmp)
 	int filename_len = 0;
 	byte_t *buffer = NULL;
 	size_t buffer_size = 0;
+	zend_bool rle = 0;
 	zend_bool success = 0;
 
 	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|s",
-			&zim, &filename, &filename_len) == FAILURE)
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|sb",
+			&zim, &filename, &filename_len, &rle) == FAILURE)
 	{
 		return;
 	}
@@ -806,9 +1965,9 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagebmp)
 	} else {
 		int colors = gdImageColorsTotal(im);
 		if (colors > 16) {
-			buffer = gdimage_to_bmp8(im, &buffer_size, 0);
+			buffer = gdimage_to_bmp8(im, &buffer_size, 0, rle);
 		} else if (colors > 2) {
-			buffer = gdimage_to_bmp4(im, &buffer_size, 0);
+			buffer = gdimage_to_bmp4(im, &buffer_size, 0, rle);
 		} else {
 			buffer = gdimage_to_bmp1(im, &buffer_size);
 		}
@@ -824,7 +1983,7 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagebmp)
 }
 
 /* }}} */
-/* {{{ bool imageicon(resource im[, string filename]) */
+/* {{{ bool imageicon(mixed im[, string filename[, array options]]) */
 
 /*
  * Output an Icon image to either the browser or a file
@@ -836,17 +1995,24 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imageicon)
 	gdImagePtr *images = NULL;
 	char *filename = NULL;
 	int filename_len = 0;
+	zval *zoptions = NULL;
 	byte_t *icon;
 	size_t num, icon_size = 0;
+	int png_size = 0, png_level = ICON_PNG_LEVEL;
 	zend_bool is_multiple = 0;
 	zend_bool success = 0;
 
 	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "z|s",
-			&zim, &filename, &filename_len) == FAILURE)
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "z|sa",
+			&zim, &filename, &filename_len, &zoptions) == FAILURE)
 	{
 		return;
 	}
+	if (zoptions != NULL && _get_icon_options(Z_ARRVAL_P(zoptions),
+			&png_size, &png_level TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
 
 	if (Z_TYPE_P(zim) == IS_ARRAY) {
 		is_multiple = 1;
@@ -902,10 +2068,13 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imageicon)
 	}
 
 	/* create an icon data */
-	icon = gdimages_to_icon(images, num, &icon_size);
+	icon = gdimages_to_icon(images, num, png_size, png_level, &icon_size);
 	if (is_multiple) {
 		efree(images);
 	}
+	if (icon == NULL) {
+		RETURN_FALSE;
+	}
 
 	/* write the image */
 	success = output_image(((filename_len > 0) ? filename : NULL), icon, icon_size);
@@ -913,6 +2082,202 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imageicon)
 	RETURN_BOOL(success);
 }
 
+/* }}} */
+/* {{{ bool imageiconfromimage(resource im, array sizes[, string filename[, array options]]) */
+
+/*
+ * Output an Icon image of multiple sizes to either the browser or a file
+ * Each size is resampled from the next larger size.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imageiconfromimage)
+{
+	zval *zim = NULL, *zsizes = NULL, *zoptions = NULL;
+	zval **entry = NULL;
+	gdImagePtr src = NULL, level;
+	gdImagePtr *images = NULL;
+	HashTable *sizeh;
+	HashPosition pos;
+	char *filename = NULL;
+	int filename_len = 0;
+	zend_bool wanted[ICON_MAX_SIZE + 1];
+	byte_t *icon = NULL;
+	size_t num = 0, i, icon_size = 0;
+	int size, png_size = 0, png_level = ICON_PNG_LEVEL;
+	zend_bool success = 0;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ra|sa",
+			&zim, &zsizes, &filename, &filename_len, &zoptions) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(src, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	/* get the sizes */
+	memset(wanted, 0, sizeof(wanted));
+	sizeh = Z_ARRVAL_P(zsizes);
+	zend_hash_internal_pointer_reset_ex(sizeh, &pos);
+	while (zend_hash_get_current_data_ex(sizeh, (void **)&entry, &pos) == SUCCESS) {
+		long l = gdex_get_lval(*entry);
+		if (l < 1L || l > (long)ICON_MAX_SIZE) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid icon size (%ld)", l);
+			RETURN_FALSE;
+		}
+		if (!wanted[l]) {
+			wanted[l] = 1;
+			num++;
+		}
+		zend_hash_move_forward_ex(sizeh, &pos);
+	}
+	if (num == 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "No size given");
+		RETURN_FALSE;
+	}
+
+	/* get the options */
+	if (zoptions != NULL && _get_icon_options(Z_ARRVAL_P(zoptions),
+			&png_size, &png_level TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
+
+	/* build the pyramid from the largest size, in ascending order */
+	images = (gdImagePtr *)ecalloc(num, sizeof(gdImagePtr));
+	level = src;
+	i = num;
+	for (size = ICON_MAX_SIZE; size > 0; size--) {
+		if (!wanted[size]) {
+			continue;
+		}
+		images[--i] = _resample_icon(level, size);
+		if (images[i] == NULL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to create an image");
+			goto cleanup;
+		}
+		level = images[i];
+	}
+
+	/* create an icon data */
+	icon = gdimages_to_icon(images, num, png_size, png_level, &icon_size);
+	if (icon != NULL) {
+		success = output_image(((filename_len > 0) ? filename : NULL), icon, icon_size);
+		efree(icon);
+	}
+
+  cleanup:
+	for (i = 0; i < num; i++) {
+		if (images[i] != NULL) {
+			gdImageDestroy(images[i]);
+		}
+	}
+	efree(images);
+
+	RETURN_BOOL(success);
+}
+
+/* }}} */
+/* {{{ resource imagecreatefrombmp(string filename) */
+
+/*
+ * Create a new image from a BMP file
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefrombmp)
+{
+	char *filename = NULL;
+	int filename_len = 0;
+	gdex_input_t input;
+	gdImagePtr im;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s",
+			&filename, &filename_len) == FAILURE)
+	{
+		return;
+	}
+
+	/* read and decode the file */
+	if (gdex_input_open(&input, filename TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	im = gdex_bmp_decode(input.data, input.size TSRMLS_CC);
+	gdex_input_close(&input TSRMLS_CC);
+
+	if (im == NULL) {
+		RETURN_FALSE;
+	}
+	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+}
+
+/* }}} */
+/* {{{ mixed imagecreatefromicon(string filename[, int size]) */
+
+/*
+ * Create a new image from an icon or a cursor file
+ * Only the entry closest to the size is decoded, or all entries
+ * are returned as an array if size is IMAGE_EX_ICON_ALL.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefromicon)
+{
+	char *filename = NULL;
+	int filename_len = 0;
+	long size = ICON_LARGEST;
+	gdex_input_t input;
+	icon_dirent_t *entries;
+	size_t num = 0, i;
+	gdImagePtr im;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|l",
+			&filename, &filename_len, &size) == FAILURE)
+	{
+		return;
+	}
+	if (size < ICON_ALL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid icon size (%ld)", size);
+		RETURN_FALSE;
+	}
+
+	/* read the directory */
+	if (gdex_input_open(&input, filename TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	entries = _read_icondir(input.data, input.size, &num TSRMLS_CC);
+	if (entries == NULL) {
+		gdex_input_close(&input TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	if (size == ICON_ALL) {
+		/* decode all entries */
+		array_init_size(return_value, (uint)num);
+		for (i = 0; i < num; i++) {
+			zval *zim;
+
+			im = _decode_icon_entry(&entries[i], input.data TSRMLS_CC);
+			if (im == NULL) {
+				zval_dtor(return_value);
+				RETVAL_FALSE;
+				break;
+			}
+			MAKE_STD_ZVAL(zim);
+			ZEND_REGISTER_RESOURCE(zim, im, GDEXG(le_gd));
+			add_next_index_zval(return_value, zim);
+		}
+	} else {
+		/* decode the selected entry */
+		i = _select_icon_entry(entries, num, size);
+		im = _decode_icon_entry(&entries[i], input.data TSRMLS_CC);
+		if (im == NULL) {
+			RETVAL_FALSE;
+		} else {
+			ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+		}
+	}
+
+	efree(entries);
+	gdex_input_close(&input TSRMLS_CC);
+}
+
 /* }}} */
 
 /*
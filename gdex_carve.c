@@ -0,0 +1,1079 @@
+/*
+ * Extra image functions: native seam carving functions
+ *
+ * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * @package     php-gdextra
+ * @author      Ryusuke SEKIYAMA <rsky0711@gmail.com>
+ * @copyright   2007-2012 Ryusuke SEKIYAMA
+ * @license     http://www.opensource.org/licenses/mit-license.php  MIT License
+ */
+
+#include "php_gdextra.h"
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#if PHP_GDEXTRA_WITH_PTHREADS
+#include <pthread.h>
+#endif
+
+ZEND_EXTERN_MODULE_GLOBALS(gdextra);
+
+/* {{{ macros */
+
+#define CARVE_MAX_THREADS 16
+#define CARVE_BAND_ROWS   64   /* minimum rows per thread */
+#define CARVE_AUTO_BATCH  32   /* remove width / 32 seams per pass by default */
+
+#define CARVE_TASK_ENERGY 1
+#define CARVE_TASK_REMOVE 2
+#define CARVE_TASK_EXPAND 3
+
+/* }}} */
+/* {{{ type definitions */
+
+typedef struct {
+	gdex_carve_options_t common;
+	int forward_energy;
+	int batch;
+	int threads;
+	int64_t deadline;     /* monotonic time in microseconds, 0 for no limit */
+} carve_options_t;
+
+/*
+ * Pixels of one pass, stored row by row
+ * Height is always carved as the width of a transposed copy.
+ */
+typedef struct {
+	int width;
+	int height;
+	int stride;
+	int *pixels;          /* NULL when only searching seams */
+	float *gray;          /* brightness in [0, 1], weighted by the opacity */
+	float *energy;
+	int *index;           /* source column of each pixel, or NULL */
+	unsigned char *mask;  /* pixels on the accepted seams */
+	unsigned char *marks; /* source pixels removed, indexed by 'index' */
+	int save_alpha;
+} carve_image_t;
+
+typedef struct {
+	carve_image_t *image;
+	int task;
+	int count;
+	int y_start;
+	int y_end;
+} carve_band_t;
+
+/* }}} */
+/* {{{ private function prototypes */
+
+static int
+_get_carve_options(HashTable *options, carve_options_t *opts TSRMLS_DC);
+
+static int
+_carve_image_init(carve_image_t *image, const gdImagePtr im,
+                  int transpose, int stride, int save_alpha);
+
+static void
+_carve_image_free(carve_image_t *image);
+
+static gdImagePtr
+_carve_image_to_gdimage(const carve_image_t *image, int transpose);
+
+static void *
+_carve_band(void *arg);
+
+static void
+_carve_run(carve_image_t *image, int task, int count, int threads);
+
+static int
+_carve_find_seams(carve_image_t *image, int count,
+                  const carve_options_t *opts, float *cost, int *from,
+                  uint64_t *keys, int *seam);
+
+static int64_t
+_carve_clock(void);
+
+static int
+_carve_reduce(carve_image_t *image, int width,
+              const carve_options_t *opts, float *cost, int *from,
+              uint64_t *keys, int *seam);
+
+static int
+_carve_enlarge(carve_image_t *image, int width,
+               const carve_options_t *opts TSRMLS_DC);
+
+static gdImagePtr
+_carve_axis(const gdImagePtr im, int size, int transpose,
+            const carve_options_t *opts, int *timed_out TSRMLS_DC);
+
+/* }}} */
+/* {{{ _carve_gray() */
+
+static inline float
+_carve_gray(int c, int save_alpha)
+{
+	float v = (float)_rgb2gray(getR(c), getG(c), getB(c)) / 255.0f;
+
+	if (save_alpha) {
+		v *= (float)_alpha2gray(getA(c)) / 255.0f;
+	}
+	return v;
+}
+
+/* }}} */
+/* {{{ _carve_blend() */
+
+/*
+ * Average two pixels for a duplicated seam
+ */
+static inline int
+_carve_blend(int a, int b)
+{
+	return gdTrueColorAlpha((getR(a) + getR(b) + 1) >> 1,
+	                        (getG(a) + getG(b) + 1) >> 1,
+	                        (getB(a) + getB(b) + 1) >> 1,
+	                        (getA(a) + getA(b) + 1) >> 1);
+}
+
+/* }}} */
+/* {{{ gdex_get_carve_options() */
+
+/*
+ * Get 'max_step', 'rigidity', 'vertical_seam', 'save_alpha', 'timeout_ms'
+ * and 'fallback' options
+ */
+GDEXTRA_LOCAL int
+gdex_get_carve_options(HashTable *options, gdex_carve_options_t *opts TSRMLS_DC)
+{
+	zval **entry = NULL;
+
+	memset(opts, 0, sizeof(gdex_carve_options_t));
+	opts->max_step = 1;
+	if (options == NULL) {
+		return SUCCESS;
+	}
+
+	if (hash_find(options, "max_step", &entry) == SUCCESS) {
+		long l = gdex_get_lval(*entry);
+		if (l < 0L) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'max_step' must not be a negative number");
+			return FAILURE;
+		}
+		opts->max_step = (int)MIN(l, (long)INT_MAX);
+	}
+
+	if (hash_find(options, "rigidity", &entry) == SUCCESS) {
+		double d = gdex_get_dval(*entry);
+		if (!zend_finite(d)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'rigidity' must be a finite number");
+			return FAILURE;
+		} else if (d < 0.0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'rigidity' must not be a negative number");
+			return FAILURE;
+		}
+		opts->rigidity = (float)d;
+	}
+
+	if (hash_find(options, "vertical_seam", &entry) == SUCCESS) {
+		opts->vertical_seam = zval_is_true(*entry);
+	}
+
+	if (hash_find(options, "save_alpha", &entry) == SUCCESS) {
+		opts->save_alpha = zval_is_true(*entry);
+	}
+
+	if (hash_find(options, "timeout_ms", &entry) == SUCCESS) {
+		long l = gdex_get_lval(*entry);
+		if (l < 0L) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'timeout_ms' must not be a negative number");
+			return FAILURE;
+		}
+		opts->timeout_ms = l;
+	}
+
+	if (hash_find(options, "fallback", &entry) == SUCCESS) {
+		opts->fallback = zval_is_true(*entry);
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _get_carve_options() */
+
+/*
+ * Get native seam carving options
+ * Accepts the same names as liquid rescaling, plus 'forward_energy',
+ * 'batch' and 'threads' (default gdextra.threads, 0 for the number of
+ * CPUs). The progress callback and the proxy are only supported by liblqr.
+ * 'batch' is the number of seams found on one energy map (0 for width/32).
+ * With more than 1, the seams of a batch do not see each other's removal,
+ * so the result can differ from carving one seam at a time.
+ */
+static int
+_get_carve_options(HashTable *options, carve_options_t *opts TSRMLS_DC)
+{
+	zval **entry = NULL;
+
+	opts->forward_energy = 0;
+	opts->batch = 0;
+	opts->threads = -1;
+	opts->deadline = 0;
+
+	if (gdex_get_carve_options(options, &opts->common TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+	if (options == NULL) {
+		return SUCCESS;
+	}
+
+	if (hash_find(options, "forward_energy", &entry) == SUCCESS) {
+		opts->forward_energy = zval_is_true(*entry);
+	}
+
+	if (hash_find(options, "batch", &entry) == SUCCESS) {
+		long l = gdex_get_lval(*entry);
+		if (l < 0L) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'batch' must not be a negative number");
+			return FAILURE;
+		}
+		opts->batch = (int)MIN(l, (long)INT_MAX);
+	}
+
+	if (hash_find(options, "threads", &entry) == SUCCESS) {
+		opts->threads = (int)MINMAX(gdex_get_lval(*entry), 0L, (long)CARVE_MAX_THREADS);
+	}
+
+	if (hash_find(options, "progress", &entry) == SUCCESS
+		&& Z_TYPE_PP(entry) != IS_NULL)
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"'progress' is not supported by the native carver");
+	}
+
+	if (hash_find(options, "proxy_scale", &entry) == SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"'proxy_scale' is not supported by the native carver");
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _carve_image_init() */
+
+/*
+ * Copy gdImage into the carving buffers, optionally transposed
+ * The rows are allocated 'stride' pixels long to make room for enlarging.
+ */
+static int
+_carve_image_init(carve_image_t *image, const gdImagePtr im,
+                  int transpose, int stride, int save_alpha)
+{
+	int x, y, c, sx, sy;
+	size_t size;
+
+	sx = gdImageSX(im);
+	sy = gdImageSY(im);
+	memset(image, 0, sizeof(carve_image_t));
+	image->width = (transpose) ? sy : sx;
+	image->height = (transpose) ? sx : sy;
+	image->stride = MAX(stride, image->width);
+	image->save_alpha = save_alpha;
+
+	size = (size_t)image->stride * (size_t)image->height;
+	if (size / (size_t)image->height != (size_t)image->stride
+		|| size > (size_t)INT_MAX / sizeof(float))
+	{
+		return FAILURE;
+	}
+	image->pixels = (int *)safe_emalloc(size, sizeof(int), 0);
+	image->gray = (float *)safe_emalloc(size, sizeof(float), 0);
+	image->energy = (float *)safe_emalloc(size, sizeof(float), 0);
+	image->mask = (unsigned char *)ecalloc(size, 1);
+
+	for (y = 0; y < sy; y++) {
+		for (x = 0; x < sx; x++) {
+			if (gdImageTrueColor(im)) {
+				c = unsafeGetTrueColorPixel(im, x, y);
+			} else {
+				int i = unsafeGetPalettePixel(im, x, y);
+				c = gdTrueColorAlpha(paletteR(im, i), paletteG(im, i),
+						paletteB(im, i), paletteA(im, i));
+			}
+			if (!save_alpha) {
+				c &= 0xffffff;
+			}
+			if (transpose) {
+				image->pixels[(size_t)x * image->stride + y] = c;
+			} else {
+				image->pixels[(size_t)y * image->stride + x] = c;
+			}
+		}
+	}
+
+	for (y = 0; y < image->height; y++) {
+		const int *row = image->pixels + (size_t)y * image->stride;
+		float *gray = image->gray + (size_t)y * image->stride;
+
+		for (x = 0; x < image->width; x++) {
+			gray[x] = _carve_gray(row[x], save_alpha);
+		}
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _carve_image_free() */
+
+static void
+_carve_image_free(carve_image_t *image)
+{
+	if (image->pixels) {
+		efree(image->pixels);
+	}
+	if (image->gray) {
+		efree(image->gray);
+	}
+	if (image->energy) {
+		efree(image->energy);
+	}
+	if (image->index) {
+		efree(image->index);
+	}
+	if (image->mask) {
+		efree(image->mask);
+	}
+	if (image->marks) {
+		efree(image->marks);
+	}
+	memset(image, 0, sizeof(carve_image_t));
+}
+
+/* }}} */
+/* {{{ _carve_image_to_gdimage() */
+
+/*
+ * Convert the carving buffers to gdImage
+ */
+static gdImagePtr
+_carve_image_to_gdimage(const carve_image_t *image, int transpose)
+{
+	gdImagePtr im;
+	int x, y;
+
+	if (transpose) {
+		im = gdImageCreateTrueColor(image->height, image->width);
+	} else {
+		im = gdImageCreateTrueColor(image->width, image->height);
+	}
+	if (im == NULL) {
+		return NULL;
+	}
+
+	for (y = 0; y < image->height; y++) {
+		const int *row = image->pixels + (size_t)y * image->stride;
+		if (transpose) {
+			for (x = 0; x < image->width; x++) {
+				im->tpixels[x][y] = row[x];
+			}
+		} else {
+			memcpy(im->tpixels[y], row, (size_t)image->width * sizeof(int));
+		}
+	}
+
+	return im;
+}
+
+/* }}} */
+/* {{{ _carve_band() */
+
+/*
+ * Process a band of rows
+ * Runs in worker threads; every buffer is allocated by the caller.
+ */
+static void *
+_carve_band(void *arg)
+{
+	carve_band_t *band = (carve_band_t *)arg;
+	carve_image_t *image = band->image;
+	int x, y, n;
+	int width = image->width;
+	int height = image->height;
+	size_t stride = (size_t)image->stride;
+
+	for (y = band->y_start; y < band->y_end; y++) {
+		float *gray = image->gray + (size_t)y * stride;
+		unsigned char *mask = image->mask + (size_t)y * stride;
+
+		switch (band->task) {
+			case CARVE_TASK_ENERGY:
+			{
+				/* gradient magnitude, written to be auto-vectorized */
+				const float *above = image->gray + (size_t)((y > 0) ? y - 1 : y) * stride;
+				const float *below = image->gray + (size_t)((y < height - 1) ? y + 1 : y) * stride;
+				float *energy = image->energy + (size_t)y * stride;
+
+				if (width < 2) {
+					energy[0] = fabsf(below[0] - above[0]);
+					break;
+				}
+				energy[0] = fabsf(gray[1] - gray[0]) + fabsf(below[0] - above[0]);
+				for (x = 1; x < width - 1; x++) {
+					energy[x] = fabsf(gray[x + 1] - gray[x - 1]) * 0.5f
+					          + fabsf(below[x] - above[x]) * 0.5f;
+				}
+				energy[width - 1] = fabsf(gray[width - 1] - gray[width - 2])
+				                  + fabsf(below[width - 1] - above[width - 1]);
+				break;
+			}
+
+			case CARVE_TASK_REMOVE:
+			{
+				/* drop the pixels on the accepted seams */
+				int *pixels = (image->pixels) ? image->pixels + (size_t)y * stride : NULL;
+				int *index = (image->index) ? image->index + (size_t)y * stride : NULL;
+				unsigned char *marks = (image->marks) ? image->marks + (size_t)y * stride : NULL;
+
+				for (x = 0, n = 0; x < width; x++) {
+					if (mask[x]) {
+						mask[x] = 0;
+						if (marks) {
+							marks[index[x]] = 1;
+						}
+						continue;
+					}
+					if (n != x) {
+						gray[n] = gray[x];
+						if (pixels) {
+							pixels[n] = pixels[x];
+						}
+						if (index) {
+							index[n] = index[x];
+						}
+					}
+					n++;
+				}
+				break;
+			}
+
+			case CARVE_TASK_EXPAND:
+			{
+				/* duplicate the marked pixels, from the right end backwards */
+				int *pixels = image->pixels + (size_t)y * stride;
+				const unsigned char *marks = image->marks + (size_t)y * stride;
+
+				n = width + band->count;
+				for (x = width - 1; x >= 0; x--) {
+					if (marks[x]) {
+						int c = (x < width - 1) ? _carve_blend(pixels[x], pixels[x + 1]) : pixels[x];
+						pixels[--n] = c;
+						gray[n] = _carve_gray(c, image->save_alpha);
+					}
+					pixels[--n] = pixels[x];
+					gray[n] = gray[x];
+				}
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* }}} */
+/* {{{ _carve_run() */
+
+/*
+ * Run a task over all rows, splitting them into bands of threads
+ */
+static void
+_carve_run(carve_image_t *image, int task, int count, int threads)
+{
+	carve_band_t bands[CARVE_MAX_THREADS];
+	int i, rows;
+#if PHP_GDEXTRA_WITH_PTHREADS
+	pthread_t tids[CARVE_MAX_THREADS];
+	int started[CARVE_MAX_THREADS];
+#endif
+
+	threads = MINMAX(threads, 1, CARVE_MAX_THREADS);
+	threads = MIN(threads, (image->height + CARVE_BAND_ROWS - 1) / CARVE_BAND_ROWS);
+	threads = MAX(threads, 1);
+	rows = (image->height + threads - 1) / threads;
+
+	for (i = 0; i < threads; i++) {
+		bands[i].image = image;
+		bands[i].task = task;
+		bands[i].count = count;
+		bands[i].y_start = MIN(i * rows, image->height);
+		bands[i].y_end = MIN(bands[i].y_start + rows, image->height);
+	}
+
+#if PHP_GDEXTRA_WITH_PTHREADS
+	/* the first band runs in the calling thread */
+	for (i = 1; i < threads; i++) {
+		started[i] = (pthread_create(&tids[i], NULL, _carve_band, &bands[i]) == 0);
+	}
+	_carve_band(&bands[0]);
+	for (i = 1; i < threads; i++) {
+		if (started[i]) {
+			pthread_join(tids[i], NULL);
+		} else {
+			_carve_band(&bands[i]);
+		}
+	}
+#else
+	for (i = 0; i < threads; i++) {
+		_carve_band(&bands[i]);
+	}
+#endif
+}
+
+/* }}} */
+/* {{{ _carve_find_seams() */
+
+/*
+ * Find up to 'count' disjoint seams from one cumulative cost map
+ * Each row of the dynamic programming is a data-parallel minimum over the
+ * neighbors within 'max_step' columns. The seams are traced back from the
+ * cheapest ends, and any seam touching an accepted one, on the same pixel
+ * or the next one in a row, is skipped, so that no two seams cross.
+ * Returns the number of seams marked in image->mask.
+ */
+static int
+_carve_find_seams(carve_image_t *image, int count,
+                  const carve_options_t *opts, float *cost, int *from,
+                  uint64_t *keys, int *seam)
+{
+	int x, y, d, i, found;
+	int width = image->width;
+	int height = image->height;
+	int max_step = MIN(opts->common.max_step, width - 1);
+	size_t stride = (size_t)image->stride;
+
+	/* the first row */
+	if (opts->forward_energy) {
+		memset(cost, 0, (size_t)width * sizeof(float));
+	} else {
+		memcpy(cost, image->energy, (size_t)width * sizeof(float));
+	}
+
+	for (y = 1; y < height; y++) {
+		const float *prev = cost + (size_t)(y - 1) * stride;
+		const float *energy = image->energy + (size_t)y * stride;
+		const float *gray = image->gray + (size_t)y * stride;
+		const float *above = image->gray + (size_t)(y - 1) * stride;
+		float *cur = cost + (size_t)y * stride;
+		int *step = from + (size_t)y * stride;
+
+		if (opts->forward_energy) {
+			/* the cost of the new edges made by joining the neighbors */
+			for (x = 0; x < width; x++) {
+				float l = gray[(x > 0) ? x - 1 : x];
+				float r = gray[(x < width - 1) ? x + 1 : x];
+				cur[x] = prev[x] + fabsf(r - l);
+				step[x] = 0;
+			}
+			for (d = 1; d <= max_step; d++) {
+				float penalty = opts->common.rigidity * powf((float)d, 1.5f) / (float)height;
+				for (x = d; x < width; x++) {
+					float l = gray[x - 1];
+					float r = gray[(x < width - 1) ? x + 1 : x];
+					float c = prev[x - d] + penalty + fabsf(r - l)
+					        + fabsf(above[x] - l) * (float)d;
+					if (c < cur[x]) {
+						cur[x] = c;
+						step[x] = -d;
+					}
+				}
+				for (x = 0; x < width - d; x++) {
+					float l = gray[(x > 0) ? x - 1 : x];
+					float r = gray[x + 1];
+					float c = prev[x + d] + penalty + fabsf(r - l)
+					        + fabsf(above[x] - r) * (float)d;
+					if (c < cur[x]) {
+						cur[x] = c;
+						step[x] = d;
+					}
+				}
+			}
+		} else {
+			memcpy(cur, prev, (size_t)width * sizeof(float));
+			memset(step, 0, (size_t)width * sizeof(int));
+			for (d = 1; d <= max_step; d++) {
+				float penalty = opts->common.rigidity * powf((float)d, 1.5f) / (float)height;
+				for (x = d; x < width; x++) {
+					float c = prev[x - d] + penalty;
+					if (c < cur[x]) {
+						cur[x] = c;
+						step[x] = -d;
+					}
+				}
+				for (x = 0; x < width - d; x++) {
+					float c = prev[x + d] + penalty;
+					if (c < cur[x]) {
+						cur[x] = c;
+						step[x] = d;
+					}
+				}
+			}
+			for (x = 0; x < width; x++) {
+				cur[x] += energy[x];
+			}
+		}
+	}
+
+	/* sort the ends by the cost; non-negative floats order as integers */
+	{
+		const float *last = cost + (size_t)(height - 1) * stride;
+		for (x = 0; x < width; x++) {
+			uint32_t bits;
+			memcpy(&bits, &last[x], sizeof(uint32_t));
+			keys[x] = ((uint64_t)bits << 32) | (uint64_t)x;
+		}
+		if (count > 1) {
+			qsort(keys, (size_t)width, sizeof(uint64_t), gdex_compare_keys);
+		} else {
+			for (x = 1; x < width; x++) {
+				if (keys[x] < keys[0]) {
+					keys[0] = keys[x];
+				}
+			}
+		}
+	}
+
+	/* trace back the seams */
+	found = 0;
+	for (i = 0; i < width && found < count; i++) {
+		int ok = 1;
+
+		x = (int)(keys[i] & 0xffffffffU);
+		for (y = height - 1; y >= 0; y--) {
+			const unsigned char *mask = image->mask + (size_t)y * stride;
+			if (mask[x] || (x > 0 && mask[x - 1]) || (x < width - 1 && mask[x + 1])) {
+				ok = 0;
+				break;
+			}
+			seam[y] = x;
+			if (y > 0) {
+				x += from[(size_t)y * stride + x];
+			}
+		}
+		if (!ok) {
+			continue;
+		}
+		for (y = 0; y < height; y++) {
+			image->mask[(size_t)y * stride + seam[y]] = 1;
+		}
+		found++;
+	}
+
+	return found;
+}
+
+/* }}} */
+/* {{{ _carve_clock() */
+
+/*
+ * Get the monotonic time in microseconds
+ */
+static int64_t
+_carve_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (int64_t)ts.tv_sec * 1000000 + (int64_t)(ts.tv_nsec / 1000);
+	}
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return (int64_t)tv.tv_sec * 1000000 + (int64_t)tv.tv_usec;
+	}
+}
+
+/* }}} */
+/* {{{ _carve_reduce() */
+
+/*
+ * Remove seams in batches until the image is 'width' pixels wide
+ * Returns FAILURE when the time budget runs out between the batches.
+ */
+static int
+_carve_reduce(carve_image_t *image, int width,
+              const carve_options_t *opts, float *cost, int *from,
+              uint64_t *keys, int *seam)
+{
+	while (image->width > width) {
+		int count, batch = opts->batch;
+
+		if (opts->deadline > 0 && _carve_clock() > opts->deadline) {
+			return FAILURE;
+		}
+
+		if (batch < 1) {
+			batch = MAX(image->width / CARVE_AUTO_BATCH, 1);
+		}
+		count = MIN(batch, image->width - width);
+		if (!opts->forward_energy) {
+			_carve_run(image, CARVE_TASK_ENERGY, 0, opts->threads);
+		}
+		count = _carve_find_seams(image, count, opts, cost, from, keys, seam);
+		_carve_run(image, CARVE_TASK_REMOVE, count, opts->threads);
+		image->width -= count;
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _carve_enlarge() */
+
+/*
+ * Insert seams until the image is 'width' pixels wide
+ * The seams to duplicate are found by removing them from a copy which
+ * remembers the source column of each pixel. Each round inserts at most
+ * width - 1 seams, so that the inserted pixels stay evenly spread.
+ * Returns FAILURE when the time budget runs out.
+ */
+static int
+_carve_enlarge(carve_image_t *image, int width,
+               const carve_options_t *opts TSRMLS_DC)
+{
+	carve_image_t search;
+	size_t size = (size_t)image->stride * (size_t)image->height;
+	float *cost;
+	int *from, *seam;
+	uint64_t *keys;
+	int x, y, result = SUCCESS;
+
+	cost = (float *)safe_emalloc(size, sizeof(float), 0);
+	from = (int *)safe_emalloc(size, sizeof(int), 0);
+	keys = (uint64_t *)safe_emalloc((size_t)image->stride, sizeof(uint64_t), 0);
+	seam = (int *)safe_emalloc((size_t)image->height, sizeof(int), 0);
+
+	memset(&search, 0, sizeof(carve_image_t));
+	search.stride = image->stride;
+	search.height = image->height;
+	search.save_alpha = image->save_alpha;
+	search.gray = (float *)safe_emalloc(size, sizeof(float), 0);
+	search.energy = (float *)safe_emalloc(size, sizeof(float), 0);
+	search.index = (int *)safe_emalloc(size, sizeof(int), 0);
+	search.mask = (unsigned char *)ecalloc(size, 1);
+	search.marks = (unsigned char *)ecalloc(size, 1);
+
+	while (image->width < width) {
+		int count = MIN(width - image->width, image->width - 1);
+
+		if (count < 1) {
+			/* a single column is simply repeated */
+			count = width - image->width;
+			for (y = 0; y < image->height; y++) {
+				int *row = image->pixels + (size_t)y * image->stride;
+				float *gray = image->gray + (size_t)y * image->stride;
+				for (x = 1; x <= count; x++) {
+					row[x] = row[0];
+					gray[x] = gray[0];
+				}
+			}
+			image->width += count;
+			break;
+		}
+
+		search.width = image->width;
+		for (y = 0; y < image->height; y++) {
+			size_t offset = (size_t)y * image->stride;
+			memcpy(search.gray + offset, image->gray + offset,
+					(size_t)image->width * sizeof(float));
+			memset(search.marks + offset, 0, (size_t)image->width);
+			for (x = 0; x < image->width; x++) {
+				search.index[offset + x] = x;
+			}
+		}
+		if (_carve_reduce(&search, image->width - count,
+				opts, cost, from, keys, seam) == FAILURE)
+		{
+			result = FAILURE;
+			break;
+		}
+
+		/* share the marks with the image to expand */
+		image->marks = search.marks;
+		_carve_run(image, CARVE_TASK_EXPAND, count, opts->threads);
+		image->marks = NULL;
+		image->width += count;
+	}
+
+	_carve_image_free(&search);
+	efree(cost);
+	efree(from);
+	efree(keys);
+	efree(seam);
+
+	return result;
+}
+
+/* }}} */
+/* {{{ _carve_axis() */
+
+/*
+ * Carve the width of the image, or the height if 'transpose' is set
+ * Sets 'timed_out' and returns NULL when the time budget runs out.
+ */
+static gdImagePtr
+_carve_axis(const gdImagePtr im, int size, int transpose,
+            const carve_options_t *opts, int *timed_out TSRMLS_DC)
+{
+	carve_image_t image;
+	gdImagePtr dst;
+	int result = SUCCESS;
+
+	if (_carve_image_init(&image, im, transpose, size, opts->common.save_alpha) == FAILURE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Required memory size too large");
+		return NULL;
+	}
+
+	if (size < image.width) {
+		size_t area = (size_t)image.stride * (size_t)image.height;
+		float *cost = (float *)safe_emalloc(area, sizeof(float), 0);
+		int *from = (int *)safe_emalloc(area, sizeof(int), 0);
+		uint64_t *keys = (uint64_t *)safe_emalloc((size_t)image.stride, sizeof(uint64_t), 0);
+		int *seam = (int *)safe_emalloc((size_t)image.height, sizeof(int), 0);
+
+		result = _carve_reduce(&image, size, opts, cost, from, keys, seam);
+		efree(cost);
+		efree(from);
+		efree(keys);
+		efree(seam);
+	} else if (size > image.width) {
+		result = _carve_enlarge(&image, size, opts TSRMLS_CC);
+	}
+	if (result == FAILURE) {
+		_carve_image_free(&image);
+		*timed_out = 1;
+		return NULL;
+	}
+
+	dst = _carve_image_to_gdimage(&image, transpose);
+	_carve_image_free(&image);
+	if (dst == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Cannot create the post-carving image");
+	}
+	return dst;
+}
+
+/* }}} */
+/* {{{ gdex_compare_keys() */
+
+GDEXTRA_LOCAL int
+gdex_compare_keys(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t *)a;
+	uint64_t kb = *(const uint64_t *)b;
+
+	return (ka < kb) ? -1 : ((ka > kb) ? 1 : 0);
+}
+
+/* }}} */
+/* {{{ gdex_carve_fallback() */
+
+/*
+ * Resample the image when carving ran out of time
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_carve_fallback(const gdImagePtr src, int width, int height)
+{
+	gdImagePtr dst;
+	int restoreAlphaBlending;
+
+	dst = gdImageCreateTrueColor(width, height);
+	if (dst == NULL) {
+		return NULL;
+	}
+	restoreAlphaBlending = dst->alphaBlendingFlag;
+	dst->alphaBlendingFlag = gdEffectReplace;
+	gdImageCopyResampled(dst, src, 0, 0, 0, 0, width, height, gdImageSX(src), gdImageSY(src));
+	dst->alphaBlendingFlag = restoreAlphaBlending;
+
+	return dst;
+}
+
+/* }}} */
+/* {{{ gdex_seam_carve() */
+
+/*
+ * Do seam carving without liblqr
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_seam_carve(const gdImagePtr src, int width, int height,
+                HashTable *options TSRMLS_DC)
+{
+	carve_options_t opts;
+	gdImagePtr im, tmp = NULL;
+	int pass, timed_out = 0;
+
+	if (_get_carve_options(options, &opts TSRMLS_CC) == FAILURE) {
+		return NULL;
+	}
+	if (opts.common.timeout_ms > 0L) {
+		opts.deadline = _carve_clock() + (int64_t)opts.common.timeout_ms * 1000;
+	}
+
+	opts.threads = gdex_get_threads((long)opts.threads, CARVE_MAX_THREADS TSRMLS_CC);
+
+	/* the unchanged image is returned as a copy */
+	if (width == gdImageSX(src) && height == gdImageSY(src)) {
+		return _carve_axis(src, width, 0, &opts, &timed_out TSRMLS_CC);
+	}
+
+	im = src;
+	for (pass = 0; pass < 2; pass++) {
+		int vertical = (pass == 0) ? opts.common.vertical_seam : !opts.common.vertical_seam;
+
+		if (!vertical && width != gdImageSX(im)) {
+			tmp = _carve_axis(im, width, 0, &opts, &timed_out TSRMLS_CC);
+		} else if (vertical && height != gdImageSY(im)) {
+			tmp = _carve_axis(im, height, 1, &opts, &timed_out TSRMLS_CC);
+		} else {
+			continue;
+		}
+		if (im != src) {
+			gdImageDestroy(im);
+		}
+		if (tmp == NULL) {
+			break;
+		}
+		im = tmp;
+	}
+	if (tmp != NULL) {
+		return im;
+	}
+	if (!timed_out) {
+		return NULL;
+	}
+	if (!opts.common.fallback) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Seam carving timed out (%ld ms)", opts.common.timeout_ms);
+		return NULL;
+	}
+
+	im = gdex_carve_fallback(src, width, height);
+	if (im == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Cannot create the resampled image");
+	}
+	return im;
+}
+
+/* }}} */
+/* {{{ gdex_carve() */
+
+/*
+ * Do content-aware rescaling with liblqr, or with the native carver
+ * when liblqr is unavailable or the 'native' option is set.
+ * Warns about the native-only options when liblqr does the work.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_carve(const gdImagePtr src, int width, int height,
+           HashTable *options TSRMLS_DC)
+{
+#if PHP_GDEXTRA_WITH_LQR
+	zval **entry = NULL;
+
+	if (options == NULL || hash_find(options, "native", &entry) == FAILURE
+		|| !zval_is_true(*entry))
+	{
+		static const char *native_only[] = { "forward_energy", "batch", "threads" };
+		size_t i;
+
+		for (i = 0; options != NULL && i < sizeof(native_only) / sizeof(native_only[0]); i++) {
+			if (zend_hash_exists(options, (char *)native_only[i],
+					(uint)strlen(native_only[i]) + 1))
+			{
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"'%s' is only supported by the native carver", native_only[i]);
+			}
+		}
+		return gdex_liquid_rescale(src, width, height, options TSRMLS_CC);
+	}
+#endif
+	return gdex_seam_carve(src, width, height, options TSRMLS_CC);
+}
+
+/* }}} */
+/* {{{ resource imagecarve(resource src, int width, int height[, array options]) */
+
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecarve)
+{
+	zval *zsrc;
+	gdImagePtr src, dst;
+	long width, height;
+	zval *zoptions = NULL;
+	HashTable *options = NULL;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rll|a!",
+			&zsrc, &width, &height, &zoptions) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(src, gdImagePtr, &zsrc, -1, "Image", GDEXG(le_gd));
+
+	if (width < 1L || height < 1L || width > INT_MAX || height > INT_MAX) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid image dimensions");
+		RETURN_FALSE;
+	}
+
+	if (zoptions != NULL && Z_TYPE_P(zoptions) == IS_ARRAY) {
+		options = Z_ARRVAL_P(zoptions);
+	}
+
+	/* resize the image */
+	dst = gdex_carve(src, (int)width, (int)height, options TSRMLS_CC);
+	if (dst == NULL) {
+		RETURN_FALSE;
+	}
+	ZEND_REGISTER_RESOURCE(return_value, dst, GDEXG(le_gd));
+}
+
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -68,6 +68,13 @@ struct _channel_t {
 
 typedef void (*mask_alpha_func_t)(MASK_ALPHA_PARAMETERS);
 
+struct _gdex_alphamask_t {
+	channel_t ach;
+	mask_alpha_func_t func;
+	int tile;
+	long position;
+};
+
 /* }}} */
 /* {{{ globals */
 
@@ -116,6 +123,15 @@ _is_grayscale(const gdImagePtr im);
 static gdImagePtr
 _create_grayscale_image(int width, int height);
 
+static gdImagePtr
+_init_plane(gdImagePtr plane, unsigned char *data, int width, int height);
+
+static void
+_free_plane(gdImagePtr plane);
+
+static int
+_fetch_channel(channel_t *ch, gdImagePtr plane, zval **entry, long width TSRMLS_DC);
+
 static void
 _channel_merge_rgb(gdImagePtr im,
                    const channel_t *rch,
@@ -802,6 +818,86 @@ _create_grayscale_image(int width, int height)
 	return im;
 }
 
+/* }}} */
+/* {{{ _init_plane() */
+
+/*
+ * Set up a gray scale image whose rows point into a planar byte string.
+ * Only the members which the channel functions use are initialized,
+ * so it must not be passed to GD functions.
+ */
+static gdImagePtr
+_init_plane(gdImagePtr plane, unsigned char *data, int width, int height)
+{
+	int y;
+
+	memset(plane, 0, sizeof(gdImage));
+	if (data == NULL) {
+		data = (unsigned char *)safe_emalloc((size_t)width, (size_t)height, 1);
+		data[(size_t)width * (size_t)height] = '\0';
+	}
+
+	plane->pixels = (unsigned char **)safe_emalloc((size_t)height, sizeof(unsigned char *), 0);
+	for (y = 0; y < height; y++) {
+		plane->pixels[y] = data + (size_t)width * (size_t)y;
+	}
+	plane->sx = width;
+	plane->sy = height;
+	plane->cx1 = 0;
+	plane->cy1 = 0;
+	plane->cx2 = width - 1;
+	plane->cy2 = height - 1;
+	plane->transparent = -1;
+
+	return plane;
+}
+
+/* }}} */
+/* {{{ _free_plane() */
+
+/*
+ * Release the row pointers of a planar gray scale image.
+ */
+static void
+_free_plane(gdImagePtr plane)
+{
+	if (plane->pixels != NULL) {
+		efree(plane->pixels);
+		plane->pixels = NULL;
+	}
+}
+
+/* }}} */
+/* {{{ _fetch_channel() */
+
+/*
+ * Get a channel from either an image resource or a planar byte string.
+ */
+static int
+_fetch_channel(channel_t *ch, gdImagePtr plane, zval **entry, long width TSRMLS_DC)
+{
+	if (Z_TYPE_PP(entry) == IS_STRING) {
+		long length = (long)Z_STRLEN_PP(entry);
+
+		if (width < 1L || width > length || length % width != 0L) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Planar channel of %ld bytes does not match the width (%ld)",
+					length, width);
+			return FAILURE;
+		}
+		ch->im = _init_plane(plane, (unsigned char *)Z_STRVAL_PP(entry),
+				(int)width, (int)(length / width));
+	} else {
+		ch->im = (gdImagePtr)zend_fetch_resource(entry TSRMLS_CC, -1, "Image",
+				NULL, 1, GDEXG(le_gd));
+		if (ch->im == NULL) {
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+
 /* }}} */
 /* {{{ _channel_merge_rgb() */
 
@@ -1108,7 +1204,7 @@ _channel_extract_4ch(const gdImagePtr im,
 
 /* }}} */
 /* {{{ resource imagechannelmerge(array channels
-                                  [, int colorspace[, int position]]) */
+                                  [, int colorspace[, int position[, int width]]]) */
 
 GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 {
@@ -1117,6 +1213,9 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 	HashPosition pos;
 	zval **entry = NULL;
 	channel_t ch[MAX_CHANNELS];
+	gdImage planes[MAX_CHANNELS];
+	int is_plane[MAX_CHANNELS];
+	long plane_width = 0L;
 	int i, n;
 	long orig_colorspace = COLORSPACE_RGB;
 	int colorspace;
@@ -1124,12 +1223,12 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 	int crop = 0;
 	int use_alpha = 0;
 	int raw_alpha = 0;
-	gdImagePtr im;
+	gdImagePtr im = NULL;
 	int width, height;
 
 	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a|ll",
-			&zchannels, &orig_colorspace, &position) == FAILURE)
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a|lll",
+			&zchannels, &orig_colorspace, &position, &plane_width) == FAILURE)
 	{
 		return;
 	}
@@ -1141,7 +1240,7 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 			raw_alpha = 1;
 		}
 	}
-	colorspace = (int)(orig_colorspace & ~COLORSPACE_RAW_ALPHA);
+	colorspace = (int)(orig_colorspace & ~(COLORSPACE_RAW_ALPHA | COLORSPACE_PLANAR));
 	if (colorspace != COLORSPACE_RGB &&
 		colorspace != COLORSPACE_HSV &&
 		colorspace != COLORSPACE_HSL &&
@@ -1154,6 +1253,8 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 
 	/* fetch the channels */
 	memset(ch, 0, sizeof(ch));
+	memset(planes, 0, sizeof(planes));
+	memset(is_plane, 0, sizeof(is_plane));
 	if (colorspace == COLORSPACE_CMYK) {
 		n = (use_alpha) ? 5 : 4;
 	} else {
@@ -1164,14 +1265,17 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 		php_error_docref(NULL TSRMLS_CC, E_WARNING,
 				"Number of the channels is not enough for %s color space,"
 					" %d channels required but %d channels given",
-				gdex_get_colorspace_name((int)orig_colorspace),
+				gdex_get_colorspace_name((int)(orig_colorspace & ~COLORSPACE_PLANAR)),
 				n, zend_hash_num_elements(channels_ht));
 		RETURN_FALSE;
 	}
 	if (use_alpha) {
 		zend_hash_internal_pointer_end_ex(channels_ht, &pos);
 		zend_hash_get_current_data_ex(channels_ht, (void **)&entry, &pos);
-		ZEND_FETCH_RESOURCE(ch[0].im, gdImagePtr, entry, -1, "Image", GDEXG(le_gd));
+		if (_fetch_channel(&ch[0], &planes[0], entry, plane_width TSRMLS_CC) == FAILURE) {
+			goto cleanup;
+		}
+		is_plane[0] = (ch[0].im == &planes[0]);
 		n--;
 	} else {
 		ch[0].im = NULL;
@@ -1179,7 +1283,10 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 	zend_hash_internal_pointer_reset_ex(channels_ht, &pos);
 	for (i = 0; i < n; i++) {
 		zend_hash_get_current_data_ex(channels_ht, (void **)&entry, &pos);
-		ZEND_FETCH_RESOURCE(ch[i + 1].im, gdImagePtr, entry, -1, "Image", GDEXG(le_gd));
+		if (_fetch_channel(&ch[i + 1], &planes[i + 1], entry, plane_width TSRMLS_CC) == FAILURE) {
+			goto cleanup;
+		}
+		is_plane[i + 1] = (ch[i + 1].im == &planes[i + 1]);
 		zend_hash_move_forward_ex(channels_ht, &pos);
 	}
 
@@ -1190,12 +1297,20 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 		width = 0;
 		height = 0;
 	} else {
-		ch[0].get = _get_alpha_converter(ch[0].im, raw_alpha);
+		if (is_plane[0]) {
+			ch[0].get = (raw_alpha) ? _get_raw_alpha_grayindex : _get_alpha_grayindex;
+		} else {
+			ch[0].get = _get_alpha_converter(ch[0].im, raw_alpha);
+		}
 		width = ch[0].width = gdImageSX(ch[0].im);
 		height = ch[0].height = gdImageSY(ch[0].im);
 	}
 	for (i = 1; i <= n; i++) {
-		ch[i].get = _get_intensity_converter(ch[i].im);
+		if (is_plane[i]) {
+			ch[i].get = _get_intensity_grayindex;
+		} else {
+			ch[i].get = _get_intensity_converter(ch[i].im);
+		}
 		ch[i].width = gdImageSX(ch[i].im);
 		ch[i].height = gdImageSY(ch[i].im);
 		if (crop) {
@@ -1229,7 +1344,7 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 	im = gdImageCreateTrueColor(width, height);
 	if (im == NULL) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create a new image");
-		RETURN_FALSE;
+		goto cleanup;
 	}
 
 	/* merge channels */
@@ -1251,6 +1366,16 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge)
 		gdImageSaveAlpha(im, 1);
 	}
 
+  cleanup:
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		if (is_plane[i]) {
+			_free_plane(&planes[i]);
+		}
+	}
+	if (im == NULL) {
+		RETURN_FALSE;
+	}
+
 	/* register the image to the return value */
 	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
 }
@@ -1262,10 +1387,12 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract)
 {
 	zval *zim, *zch;
 	gdImagePtr im, ch[MAX_CHANNELS];
+	gdImage planes[MAX_CHANNELS];
 	long orig_colorspace = COLORSPACE_RGB;
 	int colorspace;
 	int use_alpha = 0;
 	int raw_alpha = 0;
+	int planar = 0;
 	int i, width, height;
 	int errid = -1;
 
@@ -1284,7 +1411,10 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract)
 			raw_alpha = 1;
 		}
 	}
-	colorspace = (int)(orig_colorspace & ~COLORSPACE_RAW_ALPHA);
+	if (orig_colorspace & COLORSPACE_PLANAR) {
+		planar = 1;
+	}
+	colorspace = (int)(orig_colorspace & ~(COLORSPACE_RAW_ALPHA | COLORSPACE_PLANAR));
 	if (colorspace != COLORSPACE_RGB &&
 		colorspace != COLORSPACE_HSV &&
 		colorspace != COLORSPACE_HSL &&
@@ -1300,6 +1430,17 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract)
 	width = gdImageSX(im);
 	height = gdImageSY(im);
 
+	if (planar) {
+		for (i = 0; i < MAX_CHANNELS; i++) {
+			if ((i == 0 && use_alpha) || (i >= 1 && i <= 3)
+				|| (i == 4 && colorspace == COLORSPACE_CMYK))
+			{
+				ch[i] = _init_plane(&planes[i], NULL, width, height);
+			}
+		}
+		goto extract;
+	}
+
 	for (i = 1; i <= 3; i++) {
 		ch[i] = _create_grayscale_image(width, height);
 		if (ch[i] == NULL) {
@@ -1324,6 +1465,7 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract)
 		}
 	}
 
+  extract:
 	/* extract channels */
 	switch (colorspace) {
 		case COLORSPACE_RGB:
@@ -1340,6 +1482,22 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract)
 			break;
 	}
 
+	/* return planar byte strings */
+	if (planar) {
+		int order[MAX_CHANNELS] = { 1, 2, 3, 4, 0 };
+
+		array_init_size(return_value, use_alpha ? 4 : 8);
+		for (i = 0; i < MAX_CHANNELS; i++) {
+			gdImagePtr plane = ch[order[i]];
+			if (plane != NULL) {
+				add_next_index_stringl(return_value, (char *)plane->pixels[0],
+						width * height, 0);
+				_free_plane(plane);
+			}
+		}
+		return;
+	}
+
 	/* return new image resources */
 	array_init_size(return_value, use_alpha ? 4 : 8);
 	for (i = 1; i <= 3; i++) {
@@ -1373,31 +1531,16 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract)
 }
 
 /* }}} */
-/* {{{ bool imagealphamask(resource im, resource mask
-                           [, int mode[, int position]]) */
+/* {{{ gdex_alphamask_new() */
 
 /*
- * Apply the mask to the image's alpha channel.
+ * Create an alpha mask from the mask image.
  */
-GDEXTRA_LOCAL GDEX_FUNCTION(imagealphamask)
+GDEXTRA_LOCAL gdex_alphamask_t *
+gdex_alphamask_new(gdImagePtr mask, long orig_mode, long position TSRMLS_DC)
 {
-	zval *zim = NULL, *zmask = NULL;
-	gdImagePtr im, mask;
-	long orig_mode = MASK_SET;
-	long position = POSITION_DEFAULT;
-	int x, y, width, height;
+	gdex_alphamask_t *am;
 	int mode, raw_alpha, index = -1;
-	mask_alpha_func_t mask_alpha;
-	channel_t ach;
-
-	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rr|ll",
-			&zim, &zmask, &orig_mode, &position) == FAILURE)
-	{
-		return;
-	}
-	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
-	ZEND_FETCH_RESOURCE(mask, gdImagePtr, &zmask, -1, "Image", GDEXG(le_gd));
 
 	/* verify the mask mode */
 	mode = (int)(orig_mode & ~(MASK_NOT | MASK_TILE | COLORSPACE_RAW_ALPHA));
@@ -1418,92 +1561,151 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagealphamask)
 	if (index < 0 || index >= MASK_NUM_MODES) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING,
 				"Unsupported mask mode given (%ld)", orig_mode);
-		RETURN_FALSE;
-	}
-	mask_alpha = _mask_alpha_funcs[index];
-
-	/* convert to true color */
-	if (gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
-		RETURN_FALSE;
+		return NULL;
 	}
-	gdImageSaveAlpha(im, 1);
 
 	/* setup parmeters */
+	am = (gdex_alphamask_t *)emalloc(sizeof(gdex_alphamask_t));
+	am->func = _mask_alpha_funcs[index];
+	am->tile = (orig_mode & MASK_TILE) ? 1 : 0;
+	am->position = position;
+	am->ach.im = mask;
+	am->ach.get = _get_alpha_converter(mask, raw_alpha);
+	am->ach.width = gdImageSX(mask);
+	am->ach.height = gdImageSY(mask);
+	am->ach.xOffset = 0;
+	am->ach.yOffset = 0;
+
+	return am;
+}
+
+/* }}} */
+/* {{{ gdex_alphamask_apply() */
+
+/*
+ * Apply the alpha mask to the rows [y0..y1) of a true color image.
+ *
+ * The tile offsets are derived from the row number, so that the rows
+ * can be processed in any order and in any number of bands.
+ */
+GDEXTRA_LOCAL void
+gdex_alphamask_apply(const gdex_alphamask_t *am, gdImagePtr im, int y0, int y1)
+{
+	mask_alpha_func_t mask_alpha = am->func;
+	long position = am->position;
+	channel_t ach = am->ach;
+	int x, y, width, height;
+	int tx0, tx1, x2, ty0, ty1;
+
 	width = gdImageSX(im);
 	height = gdImageSY(im);
-	ach.im = mask;
-	ach.get = _get_alpha_converter(mask, raw_alpha);
-	ach.width = gdImageSX(mask);
-	ach.height = gdImageSY(mask);
 	ach.xOffset = calc_x_offset(width, ach.width, position);
 	ach.yOffset = calc_y_offset(height, ach.height, position);
 
-	/* apply the mask */
-	if (orig_mode & MASK_TILE) {
-		int x0, x1, x2, y0, y1, y2;
-
-		if (width > ach.width) {
-			if (position & POSITION_RIGHT) {
-				x0 = (width % ach.width) - ach.width;
-			} else if (position & POSITION_CENTER) {
-				x0 = (width % ach.width) / 2 - ach.width;
-			} else {
-				x0 = 0;
-			}
-			x1 = x0 + ach.width;
-		} else {
-			x0 = ach.xOffset;
-			x1 = width;
+	if (!am->tile) {
+		for (y = y0; y < y1; y++) {
+			mask_alpha(im, &ach, 0, y, width);
 		}
+		return;
+	}
 
-		if (height > ach.height) {
-			if (position & POSITION_BOTTOM) {
-				y0 = (height % ach.height) - ach.height;
-			} else if (position & POSITION_MIDDLE) {
-				y0 = (height % ach.height) / 2 - ach.height;
-			} else {
-				y0 = 0;
-			}
-			y1 = y0 + ach.width;
+	if (width > ach.width) {
+		if (position & POSITION_RIGHT) {
+			tx0 = (width % ach.width) - ach.width;
+		} else if (position & POSITION_CENTER) {
+			tx0 = (width % ach.width) / 2 - ach.width;
 		} else {
-			y0 = ach.yOffset;
-			y1 = height;
+			tx0 = 0;
 		}
+		tx1 = tx0 + ach.width;
+	} else {
+		tx0 = ach.xOffset;
+		tx1 = width;
+	}
 
-		ach.yOffset = y0;
-		for (y = 0; y < y1; y++) {
-			ach.xOffset = x0;
-			mask_alpha(im, &ach, 0, y, x1);
-			x = x1;
-			while (x < width) {
-				ach.xOffset += ach.width;
-				x2 = x + ach.width;
-				mask_alpha(im, &ach, x, y, MIN(x2, width));
-				x = x2;
-			}
+	if (height > ach.height) {
+		if (position & POSITION_BOTTOM) {
+			ty0 = (height % ach.height) - ach.height;
+		} else if (position & POSITION_MIDDLE) {
+			ty0 = (height % ach.height) / 2 - ach.height;
+		} else {
+			ty0 = 0;
 		}
+		ty1 = ty0 + ach.height;
+	} else {
+		ty0 = ach.yOffset;
+		ty1 = height;
+	}
 
-		y2 = 0;
-		for (y = y1; y < height; y++) {
-			if (y2 % ach.height == 0) {
-				ach.yOffset += ach.height;
-			}
-			ach.xOffset = x0;
-			mask_alpha(im, &ach, 0, y, x1);
-			x = x1;
-			while (x < width) {
-				ach.xOffset += ach.width;
-				x2 = x + ach.width;
-				mask_alpha(im, &ach, x, y, MIN(x2, width));
-				x = x2;
-			}
-			y2++;
+	for (y = y0; y < y1; y++) {
+		if (y < ty1) {
+			ach.yOffset = ty0;
+		} else {
+			ach.yOffset = ty0 + ((y - ty0) / ach.height) * ach.height;
 		}
-	} else {
-		for (y = 0; y < height; y++) {
-			mask_alpha(im, &ach, 0, y, width);
+		ach.xOffset = tx0;
+		mask_alpha(im, &ach, 0, y, tx1);
+		x = tx1;
+		while (x < width) {
+			ach.xOffset += ach.width;
+			x2 = x + ach.width;
+			mask_alpha(im, &ach, x, y, MIN(x2, width));
+			x = x2;
 		}
 	}
+}
+
+/* }}} */
+/* {{{ gdex_alphamask_destroy() */
+
+/*
+ * Free the alpha mask.
+ */
+GDEXTRA_LOCAL void
+gdex_alphamask_destroy(gdex_alphamask_t *am)
+{
+	efree(am);
+}
+
+/* }}} */
+/* {{{ bool imagealphamask(resource im, resource mask
+                           [, int mode[, int position]]) */
+
+/*
+ * Apply the mask to the image's alpha channel.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagealphamask)
+{
+	zval *zim = NULL, *zmask = NULL;
+	gdImagePtr im, mask;
+	long mode = MASK_SET;
+	long position = POSITION_DEFAULT;
+	gdex_alphamask_t *am;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rr|ll",
+			&zim, &zmask, &mode, &position) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+	ZEND_FETCH_RESOURCE(mask, gdImagePtr, &zmask, -1, "Image", GDEXG(le_gd));
+
+	am = gdex_alphamask_new(mask, mode, position TSRMLS_CC);
+	if (am == NULL) {
+		RETURN_FALSE;
+	}
+
+	/* convert to true color */
+	if (gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+		gdex_alphamask_destroy(am);
+		RETURN_FALSE;
+	}
+	gdImageSaveAlpha(im, 1);
+
+	/* apply the mask */
+	gdex_alphamask_apply(am, im, 0, gdImageSY(im));
+	gdex_alphamask_destroy(am);
 
 	RETURN_TRUE;
 }
@@ -1546,23 +1748,35 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagehistgram)
 		zval *ch;
 		unsigned int i, counts[256];
 
-		ZEND_FETCH_RESOURCE(im, gdImagePtr, entry, -1, "Image", GDEXG(le_gd));
-		if (im == NULL || im->trueColor || im->colorsTotal != 256) {
-			zval_ptr_dtor(&extracted);
-			zval_dtor(return_value);
-			php_error_docref(NULL TSRMLS_CC, E_ERROR,
-					"Failed to extract channels");
-			RETURN_FALSE;
-		}
+		memset(counts, 0, sizeof(counts));
 
-		width = gdImageSX(im);
-		height = gdImageSY(im);
-		pixels = (double)width * (double)height;
+		/* IMAGE_EX_COLORSPACE_PLANAR gives byte strings */
+		if (Z_TYPE_PP(entry) == IS_STRING) {
+			const unsigned char *p = (const unsigned char *)Z_STRVAL_PP(entry);
+			int length = Z_STRLEN_PP(entry);
 
-		memset(counts, 0, sizeof(counts));
-		for (y = 0; y < height; y++) {
-			for (x = 0; x < width; x++) {
-				counts[unsafeGetPalettePixel(im, x, y)]++;
+			pixels = (double)length;
+			for (x = 0; x < length; x++) {
+				counts[p[x]]++;
+			}
+		} else {
+			ZEND_FETCH_RESOURCE(im, gdImagePtr, entry, -1, "Image", GDEXG(le_gd));
+			if (im == NULL || im->trueColor || im->colorsTotal != 256) {
+				zval_ptr_dtor(&extracted);
+				zval_dtor(return_value);
+				php_error_docref(NULL TSRMLS_CC, E_ERROR,
+						"Failed to extract channels");
+				RETURN_FALSE;
+			}
+
+			width = gdImageSX(im);
+			height = gdImageSY(im);
+			pixels = (double)width * (double)height;
+
+			for (y = 0; y < height; y++) {
+				for (x = 0; x < width; x++) {
+					counts[unsafeGetPalettePixel(im, x, y)]++;
+				}
 			}
 		}
 
@@ -29,17 +29,24 @@
 
 #include "php_gdextra.h"
 #include "spline.h"
+#if PHP_GDEXTRA_WITH_PTHREADS
+#include <pthread.h>
+#endif
 
 ZEND_EXTERN_MODULE_GLOBALS(gdextra);
 
 #define GAMMA_MAX 1000.0
 #define GAMMA_MIN 0.001
 
-#define COLORCORRECT_PARAMETERS \
-	gdImagePtr im, HashTable *params TSRMLS_DC
+#define CLUT_SIZE_MIN 2
+#define CLUT_SIZE_MAX 256
+#define CLUT_HALD_LEVEL_MAX 16
+#define CLUT_LINE_MAX 256
 
-#define COLORCORRECT_PARAMS_PASSTHRU \
-	im, params TSRMLS_CC
+#define CLUT_FRAC_BITS 12
+#define CLUT_FRAC_ONE (1 << CLUT_FRAC_BITS)
+#define CLUT_MAX_THREADS 16
+#define CLUT_BAND_ROWS 64  /* minimum rows per thread */
 
 /* {{{ private type definitions */
 
@@ -49,6 +56,66 @@ typedef enum _correct_result {
 	CORRECT_ERROR   = -1
 } correct_result;
 
+typedef struct _correct_channel_t {
+	float ibk;     /* input black point [0..1]  */
+	float iwt;     /* input white point [0..1]  */
+	float irn;     /* input range [0..1]        */
+	float obk;     /* output black point [0..1] */
+	float owt;     /* output white point [0..1] */
+	float orn;     /* output range [0..1]       */
+	float icl;     /* inclination (orn/irn)     */
+	float rgm;     /* reciprocal gamma (> 0)    */
+	int lvl;       /* levels (bool)             */
+	int ngt;       /* negate (bool)             */
+	spline_t *tcv; /* tone curve (3D spline)    */
+} correct_channel_t;
+
+struct _gdex_corrector_t {
+	int colorspace;           /* color space without flags    */
+	int has_color;            /* color parameters (bool)      */
+	int has_alpha;            /* alpha parameters (bool)      */
+	float rotH;               /* hue rotation [0..1)          */
+	correct_channel_t common; /* common parameters for RGB    */
+	correct_channel_t ch[4];  /* parameters for each channel  */
+	correct_channel_t ach;    /* parameters for alpha channel */
+	unsigned char lut[3][256];          /* baked RGB curves     */
+	unsigned char alut[gdAlphaMax + 1]; /* baked alpha curve    */
+};
+
+typedef struct _corrector_object {
+	zend_object std;
+	gdex_corrector_t *corrector;
+} corrector_object;
+
+struct _gdex_clut_t {
+	int size;                /* number of lattice points per axis       */
+	unsigned short *lattice; /* size^3 RGB triplets, red varies fastest */
+	int index[3][256];       /* offset of the lower lattice point       */
+	int frac[3][256];        /* distance from the lower lattice point   */
+	int step[3];             /* offset to the next lattice point        */
+};
+
+typedef struct _clut_object {
+	zend_object std;
+	gdex_clut_t *clut;
+} clut_object;
+
+typedef struct {
+	const gdex_clut_t *clut;
+	gdImagePtr im;
+	int y_start;
+	int y_end;
+} clut_band_t;
+
+/* }}} */
+/* {{{ globals */
+
+static zend_class_entry *_ce_corrector = NULL;
+static zend_object_handlers _corrector_handlers;
+
+static zend_class_entry *_ce_clut = NULL;
+static zend_object_handlers _clut_handlers;
+
 /* }}} */
 /* {{{ private function prototypes */
 
@@ -67,17 +134,23 @@ static spline_t *
 _get_tonecurve(zval *zv, zend_bool no_edge TSRMLS_DC);
 
 static correct_result
-_get_parameters(HashTable *ht TSRMLS_DC,
-                int *levels, float *inclination,
-                float *in_black,  float *in_white,  float *in_range,
-                float *out_black, float *out_white, float *out_range,
-                float *r_gamma, spline_t **tonecurve, int *negate);
+_get_parameters(HashTable *ht, correct_channel_t *ch TSRMLS_DC);
 
 static correct_result
-_color_correct_rgb(COLORCORRECT_PARAMETERS),
-_color_correct_hsv(COLORCORRECT_PARAMETERS, zend_bool is_hsl),
-_color_correct_cmyk(COLORCORRECT_PARAMETERS),
-_color_correct_alpha(COLORCORRECT_PARAMETERS);
+_get_channel_parameters(HashTable *params, const char *key, uint key_len,
+                        correct_channel_t *ch TSRMLS_DC);
+
+static void
+_correct_hsv(const gdex_corrector_t *corrector, gdImagePtr im, int y0, int y1),
+_correct_cmyk(const gdex_corrector_t *corrector, gdImagePtr im, int y0, int y1);
+
+static void
+_apply_luts(gdImagePtr im, int y0, int y1,
+            const unsigned char *lutR, const unsigned char *lutG,
+            const unsigned char *lutB, const unsigned char *lutA);
+
+static int
+_get_lut(zval *zv, const char *name, unsigned char *lut TSRMLS_DC);
 
 /* }}} */
 /* {{{ _get_levels() */
@@ -306,11 +379,7 @@ _get_tonecurve(zval *zv, zend_bool no_edge TSRMLS_DC)
  * Get color correction parameters.
  */
 static correct_result
-_get_parameters(HashTable *ht TSRMLS_DC,
-                int *levels, float *inclination,
-                float *in_black,  float *in_white,  float *in_range,
-                float *out_black, float *out_white, float *out_range,
-                float *r_gamma, spline_t **tonecurve, int *negate)
+_get_parameters(HashTable *ht, correct_channel_t *ch TSRMLS_DC)
 {
 	zval **entry = NULL;
 	spline_t *spl = NULL;
@@ -318,19 +387,19 @@ _get_parameters(HashTable *ht TSRMLS_DC,
 
 	/* get levels */
 	if (hash_find(ht, "levels", &entry) == SUCCESS) {
-		if (_get_levels(*entry TSRMLS_CC, inclination,
-		                in_black,  in_white,  in_range,
-		                out_black, out_white, out_range) == FAILURE)
+		if (_get_levels(*entry TSRMLS_CC, &ch->icl,
+		                &ch->ibk, &ch->iwt, &ch->irn,
+		                &ch->obk, &ch->owt, &ch->orn) == FAILURE)
 		{
 			return CORRECT_ERROR;
 		}
-		*levels = 1;
+		ch->lvl = 1;
 		nparams++;
 	}
 
 	/* get reciprocal gamma */
 	if (hash_find(ht, "gamma", &entry) == SUCCESS) {
-		*r_gamma = _get_rgamma(*entry);
+		ch->rgm = _get_rgamma(*entry);
 		nparams++;
 	}
 
@@ -340,20 +409,20 @@ _get_parameters(HashTable *ht TSRMLS_DC,
 		if (spl == NULL) {
 			return CORRECT_ERROR;
 		}
-		*tonecurve = spl;
+		ch->tcv = spl;
 		nparams++;
 	} else if (hash_find(ht, "tonecurve", &entry) == SUCCESS) {
 		spl = _get_tonecurve(*entry, 1 TSRMLS_CC);
 		if (spl == NULL) {
 			return CORRECT_ERROR;
 		}
-		*tonecurve = spl;
+		ch->tcv = spl;
 		nparams++;
 	}
 
 	/* get negation */
 	if (hash_find(ht, "negate", &entry) == SUCCESS) {
-		*negate = zval_is_true(*entry);
+		ch->ngt = zval_is_true(*entry);
 		nparams++;
 	}
 
@@ -361,94 +430,51 @@ _get_parameters(HashTable *ht TSRMLS_DC,
 }
 
 /* }}} */
-/* {{{ macros for declaration of variables */
-
-#define COLORCORRECT_DECLARE_COMMON() \
-	zval **entry = NULL; \
-	correct_result has_params = CORRECT_NOTHING;
-
-#define COLORCORRECT_DECLARE_EX(_Z) \
-	    float ibk##_Z = 0.0f; /* input black point [0..1]  */ \
-	    float iwt##_Z = 1.0f; /* input white point [0..1]  */ \
-	    float irn##_Z = 1.0f; /* input range [0..1]        */ \
-	    float obk##_Z = 0.0f; /* output black point [0..1] */ \
-	    float owt##_Z = 1.0f; /* output white point [0..1] */ \
-	    float orn##_Z = 1.0f; /* output range [0..1]       */ \
-	    float icl##_Z = 1.0f; /* inclination (orn/irn)     */ \
-	    float rgm##_Z = 1.0f; /* reciprocal gamma (> 0)    */ \
-	      int lvl##_Z = 0;    /* levels (bool)             */ \
-	      int ngt##_Z = 0;    /* negate (bool)             */ \
-	spline_t *tcv##_Z = NULL; /* tone curve (3D spline)    */
+/* {{{ _get_channel_parameters() */
 
-#define COLORCORRECT_DECLARE(_z, _Z) \
-	float _z = 0.0f; /* channel value   [0..1] */ \
-	COLORCORRECT_DECLARE_EX(_Z)
-
-/* }}} */
-/* {{{ macros for fetching parameters */
+/*
+ * Get color correction parameters for the channel.
+ */
+static correct_result
+_get_channel_parameters(HashTable *params, const char *key, uint key_len,
+                        correct_channel_t *ch TSRMLS_DC)
+{
+	zval **entry = NULL;
+	HashTable *ht;
 
-#define COLORCORRECT_GETOPT_SP(_Z, _ht, _on_failure) \
-	has_params = _get_parameters((_ht) TSRMLS_CC, \
-			&lvl##_Z, &icl##_Z, \
-			&ibk##_Z, &iwt##_Z, &irn##_Z, \
-			&obk##_Z, &owt##_Z, &orn##_Z, \
-			&rgm##_Z, &tcv##_Z, &ngt##_Z); \
-	if (has_params == CORRECT_ERROR) { \
-		_on_failure; \
+	if (zend_hash_find(params, key, key_len, (void **)&entry) == FAILURE) {
+		return CORRECT_NOTHING;
 	}
 
-#define COLORCORRECT_GETOPT_EX(_Z, _ht) \
-	COLORCORRECT_GETOPT_SP(_Z, _ht, return CORRECT_ERROR)
-
-#define COLORCORRECT_GETOPT(_z, _Z) \
-	if (hash_find(params, #_z, &entry) == SUCCESS) { \
-		HashTable *params##_Z = HASH_OF(*entry); \
-		if (params##_Z != NULL) { \
-			COLORCORRECT_GETOPT_EX(_Z, params##_Z); \
-		} \
+	ht = HASH_OF(*entry);
+	if (ht == NULL) {
+		return CORRECT_NOTHING;
 	}
 
-#define COLORCORRECT_SET_LEVELS(_X, _Y) \
-	ibk##_X = ibk##_Y; \
-	iwt##_X = iwt##_Y; \
-	irn##_X = irn##_Y; \
-	obk##_X = obk##_Y; \
-	owt##_X = owt##_Y; \
-	orn##_X = orn##_Y; \
-	icl##_X = icl##_Y; \
-	lvl##_X = lvl##_Y;
-
-#define COLORCORRECT_SET_GAMMA(_X, _Y) rgm##_X = rgm##_Y;
-
-#define COLORCORRECT_SET_TONECURVE(_X, _Y) tcv##_X = tcv##_Y;
-
-#define COLORCORRECT_SET_NEGATE(_X, _Y) ngt##_X = ngt##_Y;
+	return _get_parameters(ht, ch TSRMLS_CC);
+}
 
-#define COLORCORRECT_FREE_TONECURVE(_X) \
-	if (tcv##_X != NULL) { \
-		spline_destroy(tcv##_X); \
-	}
+/* }}} */
+/* {{{ macros for fetching parameters */
 
-#define COLORCORRECT_FREE_TONECURVE2(_X, _Y) \
-	if (tcv##_X != NULL && tcv##_X != tcv##_Y) { \
-		spline_destroy(tcv##_X); \
+#define COLORCORRECT_GETOPT(_z, _ch) \
+	switch (_get_channel_parameters(params, #_z, sizeof(#_z), (_ch) TSRMLS_CC)) { \
+		case CORRECT_SUCCESS: \
+			has_params = CORRECT_SUCCESS; \
+			break; \
+		case CORRECT_ERROR: \
+			goto error_return_null; \
+		case CORRECT_NOTHING: \
+			break; \
 	}
 
 /* }}} */
 /* {{{ macros for color correction */
 
-#define COLORCORRECT_TO_TRUECOLOR(_i) \
-	if (!gdImageTrueColor((_i))) { \
-		if (gdex_palette_to_truecolor((_i) TSRMLS_CC) == FAILURE) { \
-			return CORRECT_ERROR; \
-		} \
-	}
-
-#define COLORCORRECT_ITERATE_BEGIN() { \
-	int ic, ix, iy, width, height; \
+#define COLORCORRECT_ITERATE_BEGIN(_y0, _y1) { \
+	int ic, ix, iy, width; \
 	width = gdImageSX(im); \
-	height = gdImageSY(im); \
-	for (iy = 0; iy < height; iy++) { \
+	for (iy = (_y0); iy < (_y1); iy++) { \
 		for (ix = 0; ix < width; ix++) { \
 			ic = unsafeGetTrueColorPixel(im, ix, iy);
 
@@ -458,138 +484,67 @@ _get_parameters(HashTable *ht TSRMLS_DC,
 	} /* y */ \
 } /* block */
 
-#define COLORCORRECT_DO(_z, _Z) { \
-	if (lvl##_Z) { \
-		if (_z <= ibk##_Z) { \
-			_z = obk##_Z; \
-		} else if (_z >= iwt##_Z) { \
-			_z = owt##_Z; \
-		} else if (rgm##_Z != 1.0f) { \
-			_z = obk##_Z + orn##_Z * powf((_z - ibk##_Z) / irn##_Z, rgm##_Z); \
+#define COLORCORRECT_DO_LEVELS(_z, _ch) { \
+	if ((_ch)->lvl) { \
+		if (_z <= (_ch)->ibk) { \
+			_z = (_ch)->obk; \
+		} else if (_z >= (_ch)->iwt) { \
+			_z = (_ch)->owt; \
+		} else if ((_ch)->rgm != 1.0f) { \
+			_z = (_ch)->obk + (_ch)->orn * powf((_z - (_ch)->ibk) / (_ch)->irn, (_ch)->rgm); \
 		} else { \
-			_z = obk##_Z + icl##_Z * (_z - ibk##_Z); \
+			_z = (_ch)->obk + (_ch)->icl * (_z - (_ch)->ibk); \
 		} \
-	} else if (rgm##_Z != 1.0f) { \
-		_z = powf(_z, rgm##_Z); \
+	} else if ((_ch)->rgm != 1.0f) { \
+		_z = powf(_z, (_ch)->rgm); \
 	} \
-	if (tcv##_Z != NULL) { \
-		_z = (float)spline_interpolate(tcv##_Z, (double)_z); \
+}
+
+#define COLORCORRECT_DO(_z, _ch) { \
+	COLORCORRECT_DO_LEVELS(_z, _ch); \
+	if ((_ch)->tcv != NULL) { \
+		_z = (float)spline_interpolate((_ch)->tcv, (double)_z); \
 	} \
-	if (ngt##_Z) { \
+	if ((_ch)->ngt) { \
 		_z = 1.0f - _z; \
 	} \
 }
 
 /* }}} */
-/* {{{ _color_correct_rgb() */
+/* {{{ _apply_luts() */
 
 /*
- * Correct color in RGB color space.
+ * Apply the lookup tables for each channel.
+ * lutA is indexed by GD's 7-bit alpha value.
  */
-static correct_result
-_color_correct_rgb(COLORCORRECT_PARAMETERS)
-{
-	COLORCORRECT_DECLARE_COMMON();
-	COLORCORRECT_DECLARE_EX(V);
-	COLORCORRECT_DECLARE(r, R);
-	COLORCORRECT_DECLARE(g, G);
-	COLORCORRECT_DECLARE(b, B);
-
-	/* get common parameters */
-	COLORCORRECT_GETOPT_EX(V, params);
-	if (lvlV) {
-		COLORCORRECT_SET_LEVELS(R, V);
-		COLORCORRECT_SET_LEVELS(G, V);
-		COLORCORRECT_SET_LEVELS(B, V);
-	}
-	if (rgmV != 1.0f) {
-		COLORCORRECT_SET_GAMMA(R, V);
-		COLORCORRECT_SET_GAMMA(G, V);
-		COLORCORRECT_SET_GAMMA(B, V);
-	}
-	if (tcvV != NULL) {
-		COLORCORRECT_SET_TONECURVE(R, V);
-		COLORCORRECT_SET_TONECURVE(G, V);
-		COLORCORRECT_SET_TONECURVE(B, V);
-	}
-	if (ngtV) {
-		COLORCORRECT_SET_NEGATE(R, V);
-		COLORCORRECT_SET_NEGATE(G, V);
-		COLORCORRECT_SET_NEGATE(B, V);
-	}
-
-	/* get channel specific parameters */
-	COLORCORRECT_GETOPT(r, R);
-	COLORCORRECT_GETOPT(g, G);
-	COLORCORRECT_GETOPT(b, B);
-
-	if (has_params == CORRECT_NOTHING) {
-		return CORRECT_NOTHING;
-	}
-
-	/* convert to true color */
-	COLORCORRECT_TO_TRUECOLOR(im);
-
-	/* correct */
-	COLORCORRECT_ITERATE_BEGIN();
-	r = (float)getR(ic) / 255.0f;
-	g = (float)getG(ic) / 255.0f;
-	b = (float)getB(ic) / 255.0f;
-
-	COLORCORRECT_DO(r, R);
-	COLORCORRECT_DO(g, G);
-	COLORCORRECT_DO(b, B);
-	COLORCORRECT_ITERATE_END(_float2byte(r), _float2byte(g), _float2byte(b), getA(ic));
-
-	/* cleanup */
-	COLORCORRECT_FREE_TONECURVE2(R, V);
-	COLORCORRECT_FREE_TONECURVE2(G, V);
-	COLORCORRECT_FREE_TONECURVE2(B, V);
-	COLORCORRECT_FREE_TONECURVE(V);
-
-	return CORRECT_SUCCESS;
+static void
+_apply_luts(gdImagePtr im, int y0, int y1,
+            const unsigned char *lutR, const unsigned char *lutG,
+            const unsigned char *lutB, const unsigned char *lutA)
+{
+	COLORCORRECT_ITERATE_BEGIN(y0, y1);
+	COLORCORRECT_ITERATE_END(lutR[getR(ic)], lutG[getG(ic)], lutB[getB(ic)], lutA[getA(ic)]);
 }
 
 /* }}} */
-/* {{{ _color_correct_hsv() */
+/* {{{ _correct_hsv() */
 
 /*
  * Correct color in HSV/HSL color space.
  */
-static correct_result
-_color_correct_hsv(COLORCORRECT_PARAMETERS, zend_bool is_hsl)
+static void
+_correct_hsv(const gdex_corrector_t *corrector, gdImagePtr im, int y0, int y1)
 {
-	COLORCORRECT_DECLARE_COMMON();
+	const correct_channel_t *chS = &corrector->ch[0];
+	const correct_channel_t *chV = &corrector->ch[1];
+	float rotH = corrector->rotH;
 	int r = 0, g = 0, b = 0;
-	float h = 0.0f, rotH = 0.0f;
-	COLORCORRECT_DECLARE(s, S);
-	COLORCORRECT_DECLARE(v, V);
+	float h = 0.0f, s = 0.0f, v = 0.0f;
 	gdex_rgb_to_3ch_func_t rgb2hsv;
 	gdex_3ch_to_rgb_func_t hsv2rgb;
 
-	/* get parameters */
-	if (hash_find(params, "h", &entry) == SUCCESS) {
-		rotH += _get_rotation(*entry);
-		if (rotH >= 1.0f) {
-			rotH -= 1.0f;
-		}
-		has_params = CORRECT_SUCCESS;
-	}
-	COLORCORRECT_GETOPT(s, S);
-	if (is_hsl) {
-		COLORCORRECT_GETOPT(l, V);
-	} else {
-		COLORCORRECT_GETOPT(v, V);
-	}
-	if (has_params == CORRECT_NOTHING) {
-		return CORRECT_NOTHING;
-	}
-
-	/* convert to true color */
-	COLORCORRECT_TO_TRUECOLOR(im);
-
 	/* determine conversion functions */
-	if (is_hsl) {
+	if (corrector->colorspace == COLORSPACE_HSL) {
 		rgb2hsv = gdex_rgb_to_hsl;
 		hsv2rgb = gdex_hsl_to_rgb;
 	} else {
@@ -597,8 +552,7 @@ _color_correct_hsv(COLORCORRECT_PARAMETERS, zend_bool is_hsl)
 		hsv2rgb = gdex_hsv_to_rgb;
 	}
 
-	/* correct */
-	COLORCORRECT_ITERATE_BEGIN();
+	COLORCORRECT_ITERATE_BEGIN(y0, y1);
 	rgb2hsv(getR(ic), getG(ic), getB(ic), &h, &s, &v);
 
 	if (rotH != 0.0f) {
@@ -607,128 +561,169 @@ _color_correct_hsv(COLORCORRECT_PARAMETERS, zend_bool is_hsl)
 			h -= 1.0f;
 		}
 	}
-	COLORCORRECT_DO(s, S);
-	COLORCORRECT_DO(v, V);
+	COLORCORRECT_DO(s, chS);
+	COLORCORRECT_DO(v, chV);
 
 	hsv2rgb(h, s, v, &r, &g, &b);
 	COLORCORRECT_ITERATE_END(r, g, b, getA(ic));
-
-	/* cleanup */
-	COLORCORRECT_FREE_TONECURVE(S);
-	COLORCORRECT_FREE_TONECURVE(V);
-
-	return CORRECT_SUCCESS;
 }
 
 /* }}} */
-/* {{{ _color_correct_cmyk() */
+/* {{{ _correct_cmyk() */
 
 /*
  * Correct color in CMYK color space.
  */
-static correct_result
-_color_correct_cmyk(COLORCORRECT_PARAMETERS)
+static void
+_correct_cmyk(const gdex_corrector_t *corrector, gdImagePtr im, int y0, int y1)
 {
-	COLORCORRECT_DECLARE_COMMON();
+	const correct_channel_t *chC = &corrector->ch[0];
+	const correct_channel_t *chM = &corrector->ch[1];
+	const correct_channel_t *chY = &corrector->ch[2];
+	const correct_channel_t *chK = &corrector->ch[3];
 	int r = 0, g = 0, b = 0;
-	COLORCORRECT_DECLARE(c, C);
-	COLORCORRECT_DECLARE(m, M);
-	COLORCORRECT_DECLARE(y, Y);
-	COLORCORRECT_DECLARE(k, K);
-
-	/* get parameters */
-	COLORCORRECT_GETOPT(c, C);
-	COLORCORRECT_GETOPT(m, M);
-	COLORCORRECT_GETOPT(y, Y);
-	COLORCORRECT_GETOPT(k, K);
+	float c = 0.0f, m = 0.0f, y = 0.0f, k = 0.0f;
 
-	if (has_params == CORRECT_NOTHING) {
-		return CORRECT_NOTHING;
-	}
-
-	/* convert to true color */
-	COLORCORRECT_TO_TRUECOLOR(im);
-
-	/* correct */
-	COLORCORRECT_ITERATE_BEGIN();
+	COLORCORRECT_ITERATE_BEGIN(y0, y1);
 	gdex_rgb_to_cmyk(getR(ic), getG(ic), getB(ic), &c, &m, &y, &k);
 
-	COLORCORRECT_DO(c, C);
-	COLORCORRECT_DO(m, M);
-	COLORCORRECT_DO(y, Y);
-	COLORCORRECT_DO(k, K);
+	COLORCORRECT_DO(c, chC);
+	COLORCORRECT_DO(m, chM);
+	COLORCORRECT_DO(y, chY);
+	COLORCORRECT_DO(k, chK);
 
 	gdex_cmyk_to_rgb(c, m, y, k, &r, &g, &b);
 	COLORCORRECT_ITERATE_END(r, g, b, getA(ic));
+}
+
+/* }}} */
+/* {{{ _bake_curve() */
+
+/*
+ * Apply the tone curve to the sampled values.
+ * Ascending samples are evaluated in one pass over the knots.
+ */
+static void
+_bake_curve(const spline_t *tcv, double *zs, int num)
+{
+	int i;
 
-	/* cleanup */
-	COLORCORRECT_FREE_TONECURVE(C);
-	COLORCORRECT_FREE_TONECURVE(M);
-	COLORCORRECT_FREE_TONECURVE(Y);
-	COLORCORRECT_FREE_TONECURVE(K);
+	for (i = 1; i < num; i++) {
+		if (zs[i] < zs[i - 1]) {
+			break;
+		}
+	}
 
-	return CORRECT_SUCCESS;
+	if (i == num) {
+		(void)spline_interpolate_many(tcv, zs, zs, (unsigned int)num);
+	} else {
+		for (i = 0; i < num; i++) {
+			zs[i] = spline_interpolate(tcv, zs[i]);
+		}
+	}
 }
 
 /* }}} */
-/* {{{ _color_correct_alpha() */
+/* {{{ _bake_channel() */
 
 /*
- * Correct alpha channel.
+ * Evaluate the parameters for all 8-bit channel values.
  */
-static correct_result
-_color_correct_alpha(COLORCORRECT_PARAMETERS)
+static void
+_bake_channel(const correct_channel_t *ch, unsigned char *lut)
 {
-	COLORCORRECT_DECLARE_COMMON();
-	COLORCORRECT_DECLARE(a, A);
+	double zs[256];
+	int i;
+	float z;
+
+	for (i = 0; i < 256; i++) {
+		z = (float)i / 255.0f;
+		COLORCORRECT_DO_LEVELS(z, ch);
+		zs[i] = (double)z;
+	}
 
-	/* get parameters */
-	COLORCORRECT_GETOPT(a, A);
-	if (has_params == CORRECT_NOTHING) {
-		return CORRECT_NOTHING;
+	if (ch->tcv != NULL) {
+		_bake_curve(ch->tcv, zs, 256);
 	}
 
-	/* convert to true color */
-	COLORCORRECT_TO_TRUECOLOR(im);
+	for (i = 0; i < 256; i++) {
+		z = (float)zs[i];
+		if (ch->ngt) {
+			z = 1.0f - z;
+		}
+		lut[i] = (unsigned char)_float2byte(z);
+	}
+}
 
-	/* correct */
-	COLORCORRECT_ITERATE_BEGIN();
-	a = (float)(gdAlphaMax - getA(ic)) / (float)gdAlphaMax;
+/* }}} */
+/* {{{ _bake_alpha() */
 
-	COLORCORRECT_DO(a, A);
-	COLORCORRECT_ITERATE_END(getR(ic), getG(ic), getB(ic), _float2alpha(a));
+/*
+ * Evaluate the parameters for all 7-bit alpha values.
+ * The samples are taken in order of opacity so that they ascend.
+ */
+static void
+_bake_alpha(const correct_channel_t *ch, unsigned char *lut)
+{
+	double zs[gdAlphaMax + 1];
+	int i;
+	float z;
+
+	for (i = 0; i <= gdAlphaMax; i++) {
+		z = (float)i / (float)gdAlphaMax;
+		COLORCORRECT_DO_LEVELS(z, ch);
+		zs[i] = (double)z;
+	}
 
-	/* cleanup */
-	COLORCORRECT_FREE_TONECURVE(A);
+	if (ch->tcv != NULL) {
+		_bake_curve(ch->tcv, zs, gdAlphaMax + 1);
+	}
 
-	return CORRECT_SUCCESS;
+	for (i = 0; i <= gdAlphaMax; i++) {
+		z = (float)zs[i];
+		if (ch->ngt) {
+			z = 1.0f - z;
+		}
+		lut[gdAlphaMax - i] = (unsigned char)_float2alpha(z);
+	}
 }
 
 /* }}} */
-/* {{{ bool imagecolorcorrect(resource im, array params[, int colorspace]) */
+/* {{{ _init_channel() */
 
 /*
- * Correct color.
+ * Initialize the parameters of the channel.
  */
-GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorcorrect)
+static void
+_init_channel(correct_channel_t *ch)
 {
-	zval *zim = NULL;
-	gdImagePtr im = NULL;
-	zval *zparams = NULL;
-	HashTable *params = NULL;
-	long orig_colorspace = COLORSPACE_RGB;
-	int colorspace;
-	int use_alpha = 0;
-	correct_result result = CORRECT_NOTHING;
+	ch->ibk = 0.0f;
+	ch->iwt = 1.0f;
+	ch->irn = 1.0f;
+	ch->obk = 0.0f;
+	ch->owt = 1.0f;
+	ch->orn = 1.0f;
+	ch->icl = 1.0f;
+	ch->rgm = 1.0f;
+	ch->lvl = 0;
+	ch->ngt = 0;
+	ch->tcv = NULL;
+}
 
-	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ra|l",
-			&zim, &zparams, &orig_colorspace) == FAILURE)
-	{
-		return;
-	}
-	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
-	params = Z_ARRVAL_P(zparams);
+/* }}} */
+/* {{{ gdex_corrector_new() */
+
+/*
+ * Create a color corrector from the parameters.
+ */
+GDEXTRA_LOCAL gdex_corrector_t *
+gdex_corrector_new(HashTable *params, long orig_colorspace TSRMLS_DC)
+{
+	gdex_corrector_t *corrector;
+	correct_channel_t *common;
+	zval **entry = NULL;
+	correct_result has_params = CORRECT_NOTHING;
+	int colorspace, use_alpha = 0, i;
 
 	/* verify the color space */
 	if (orig_colorspace & COLORSPACE_ALPHA) {
@@ -737,50 +732,1157 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorcorrect)
 	} else {
 		colorspace = (int)orig_colorspace;
 	}
+	if (colorspace != COLORSPACE_RGB && colorspace != COLORSPACE_HSV &&
+		colorspace != COLORSPACE_HSL && colorspace != COLORSPACE_CMYK)
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Unsupported color space given (%ld)", orig_colorspace);
+		return NULL;
+	}
+
+	corrector = (gdex_corrector_t *)ecalloc(1, sizeof(gdex_corrector_t));
+	corrector->colorspace = colorspace;
+	_init_channel(&corrector->common);
+	for (i = 0; i < 4; i++) {
+		_init_channel(&corrector->ch[i]);
+	}
+	_init_channel(&corrector->ach);
+	common = &corrector->common;
+	for (i = 0; i < 256; i++) {
+		corrector->lut[0][i] = corrector->lut[1][i] = corrector->lut[2][i] = (unsigned char)i;
+	}
+	for (i = 0; i <= gdAlphaMax; i++) {
+		corrector->alut[i] = (unsigned char)i;
+	}
 
-	/* correct color */
+	/* get parameters */
 	switch (colorspace) {
 		case COLORSPACE_RGB:
-			result = _color_correct_rgb(COLORCORRECT_PARAMS_PASSTHRU);
+			/* get common parameters */
+			has_params = _get_parameters(params, common TSRMLS_CC);
+			if (has_params == CORRECT_ERROR) {
+				goto error_return_null;
+			}
+			for (i = 0; i < 3; i++) {
+				correct_channel_t *ch = &corrector->ch[i];
+				if (common->lvl) {
+					ch->ibk = common->ibk;
+					ch->iwt = common->iwt;
+					ch->irn = common->irn;
+					ch->obk = common->obk;
+					ch->owt = common->owt;
+					ch->orn = common->orn;
+					ch->icl = common->icl;
+					ch->lvl = common->lvl;
+				}
+				ch->rgm = common->rgm;
+				ch->tcv = common->tcv;
+				ch->ngt = common->ngt;
+			}
+
+			/* get channel specific parameters */
+			COLORCORRECT_GETOPT(r, &corrector->ch[0]);
+			COLORCORRECT_GETOPT(g, &corrector->ch[1]);
+			COLORCORRECT_GETOPT(b, &corrector->ch[2]);
 			break;
+
 		case COLORSPACE_HSV:
-			result = _color_correct_hsv(COLORCORRECT_PARAMS_PASSTHRU, 0);
-			break;
 		case COLORSPACE_HSL:
-			result = _color_correct_hsv(COLORCORRECT_PARAMS_PASSTHRU, 1);
+			if (hash_find(params, "h", &entry) == SUCCESS) {
+				corrector->rotH = _get_rotation(*entry);
+				if (corrector->rotH >= 1.0f) {
+					corrector->rotH -= 1.0f;
+				}
+				has_params = CORRECT_SUCCESS;
+			}
+			COLORCORRECT_GETOPT(s, &corrector->ch[0]);
+			if (colorspace == COLORSPACE_HSL) {
+				COLORCORRECT_GETOPT(l, &corrector->ch[1]);
+			} else {
+				COLORCORRECT_GETOPT(v, &corrector->ch[1]);
+			}
 			break;
+
 		case COLORSPACE_CMYK:
-			result = _color_correct_cmyk(COLORCORRECT_PARAMS_PASSTHRU);
+			COLORCORRECT_GETOPT(c, &corrector->ch[0]);
+			COLORCORRECT_GETOPT(m, &corrector->ch[1]);
+			COLORCORRECT_GETOPT(y, &corrector->ch[2]);
+			COLORCORRECT_GETOPT(k, &corrector->ch[3]);
 			break;
-		default:
-			php_error_docref(NULL TSRMLS_CC, E_WARNING,
-					"Unsupported color space given (%ld)", orig_colorspace);
-			result = CORRECT_ERROR;
 	}
-
-	if (result == CORRECT_ERROR) {
-		RETURN_FALSE;
+	corrector->has_color = (has_params == CORRECT_SUCCESS);
+	if (corrector->has_color && colorspace == COLORSPACE_RGB) {
+		for (i = 0; i < 3; i++) {
+			_bake_channel(&corrector->ch[i], corrector->lut[i]);
+		}
 	}
 
-	/* correct alpha channel */
+	/* get alpha channel parameters */
 	if (use_alpha) {
-		switch (_color_correct_alpha(COLORCORRECT_PARAMS_PASSTHRU)) {
-			case CORRECT_SUCCESS:
-				result = CORRECT_SUCCESS;
-				break;
-			case CORRECT_ERROR:
-				RETURN_FALSE;
+		has_params = CORRECT_NOTHING;
+		COLORCORRECT_GETOPT(a, &corrector->ach);
+		corrector->has_alpha = (has_params == CORRECT_SUCCESS);
+		if (corrector->has_alpha) {
+			_bake_alpha(&corrector->ach, corrector->alut);
+		}
+	}
+
+	return corrector;
+
+  error_return_null:
+	gdex_corrector_destroy(corrector);
+	return NULL;
+}
+
+/* }}} */
+/* {{{ gdex_corrector_is_empty() */
+
+/*
+ * Determine whether the color corrector has nothing to do.
+ */
+GDEXTRA_LOCAL int
+gdex_corrector_is_empty(const gdex_corrector_t *corrector)
+{
+	return (!corrector->has_color && !corrector->has_alpha);
+}
+
+/* }}} */
+/* {{{ gdex_corrector_apply() */
+
+/*
+ * Apply the color corrector to the rows [y0..y1) of a true color image.
+ */
+GDEXTRA_LOCAL void
+gdex_corrector_apply(const gdex_corrector_t *corrector, gdImagePtr im, int y0, int y1)
+{
+	/* the baked curves for RGB and alpha are applied in one pass */
+	if (corrector->colorspace == COLORSPACE_RGB) {
+		if (corrector->has_color || corrector->has_alpha) {
+			_apply_luts(im, y0, y1, corrector->lut[0], corrector->lut[1],
+			            corrector->lut[2], corrector->alut);
+		}
+		return;
+	}
+
+	if (corrector->has_color) {
+		switch (corrector->colorspace) {
+			case COLORSPACE_HSV:
+			case COLORSPACE_HSL:
+				_correct_hsv(corrector, im, y0, y1);
 				break;
-			case CORRECT_NOTHING:
+			case COLORSPACE_CMYK:
+				_correct_cmyk(corrector, im, y0, y1);
 				break;
 		}
 	}
 
-	if (result == CORRECT_NOTHING) {
+	if (corrector->has_alpha) {
+		_apply_luts(im, y0, y1, corrector->lut[0], corrector->lut[1],
+		            corrector->lut[2], corrector->alut);
+	}
+}
+
+/* }}} */
+/* {{{ gdex_corrector_destroy() */
+
+/*
+ * Free the color corrector.
+ */
+GDEXTRA_LOCAL void
+gdex_corrector_destroy(gdex_corrector_t *corrector)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		spline_t *tcv = corrector->ch[i].tcv;
+		if (tcv != NULL && tcv != corrector->common.tcv) {
+			spline_destroy(tcv);
+		}
+	}
+	if (corrector->common.tcv != NULL) {
+		spline_destroy(corrector->common.tcv);
+	}
+	if (corrector->ach.tcv != NULL) {
+		spline_destroy(corrector->ach.tcv);
+	}
+
+	efree(corrector);
+}
+
+/* }}} */
+/* {{{ _corrector_free_storage() */
+
+/*
+ * Free a ColorCorrector object.
+ */
+static void
+_corrector_free_storage(void *object TSRMLS_DC)
+{
+	corrector_object *intern = (corrector_object *)object;
+
+	zend_object_std_dtor(&intern->std TSRMLS_CC);
+	if (intern->corrector != NULL) {
+		gdex_corrector_destroy(intern->corrector);
+	}
+	efree(object);
+}
+
+/* }}} */
+/* {{{ gdex_corrector_object_new() */
+
+/*
+ * Create a ColorCorrector object.
+ */
+GDEXTRA_LOCAL zend_object_value
+gdex_corrector_object_new(zend_class_entry *ce TSRMLS_DC)
+{
+	zend_object_value retval;
+	corrector_object *intern;
+#if PHP_VERSION_ID < 50400
+	zval *tmp;
+#endif
+
+	intern = (corrector_object *)ecalloc(1, sizeof(corrector_object));
+	zend_object_std_init(&intern->std, ce TSRMLS_CC);
+#if PHP_VERSION_ID < 50400
+	zend_hash_copy(intern->std.properties, &ce->default_properties,
+			(copy_ctor_func_t)zval_add_ref, (void *)&tmp, sizeof(zval *));
+#else
+	object_properties_init(&intern->std, ce);
+#endif
+
+	retval.handle = zend_objects_store_put(intern,
+			(zend_objects_store_dtor_t)zend_objects_destroy_object,
+			(zend_objects_free_object_storage_t)_corrector_free_storage,
+			NULL TSRMLS_CC);
+	retval.handlers = &_corrector_handlers;
+
+	return retval;
+}
+
+/* }}} */
+/* {{{ gdex_corrector_class_init() */
+
+/*
+ * Initialize the object handlers of ColorCorrector.
+ */
+GDEXTRA_LOCAL void
+gdex_corrector_class_init(zend_class_entry *ce)
+{
+	_ce_corrector = ce;
+	memcpy(&_corrector_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	_corrector_handlers.clone_obj = NULL;
+}
+
+/* }}} */
+/* {{{ gdex_corrector_fetch_object() */
+
+/*
+ * Get the color corrector from a ColorCorrector object.
+ */
+GDEXTRA_LOCAL gdex_corrector_t *
+gdex_corrector_fetch_object(zval *zv TSRMLS_DC)
+{
+	corrector_object *intern;
+
+	if (Z_TYPE_P(zv) != IS_OBJECT ||
+		!instanceof_function(Z_OBJCE_P(zv), _ce_corrector TSRMLS_CC))
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"The object is not an instance of ColorCorrector");
+		return NULL;
+	}
+
+	intern = (corrector_object *)zend_object_store_get_object(zv TSRMLS_CC);
+	if (intern->corrector == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"The ColorCorrector object is not initialized");
+		return NULL;
+	}
+
+	return intern->corrector;
+}
+
+/* }}} */
+/* {{{ void ColorCorrector::__construct(array params[, int colorspace]) */
+
+/*
+ * Compile the color correction parameters.
+ */
+GDEXTRA_LOCAL PHP_METHOD(ColorCorrector, __construct)
+{
+	zval *zparams = NULL;
+	long colorspace = COLORSPACE_RGB;
+	corrector_object *intern;
+	gdex_corrector_t *corrector;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a|l",
+			&zparams, &colorspace) == FAILURE)
+	{
+		return;
+	}
+
+	/* compile the parameters */
+	corrector = gdex_corrector_new(Z_ARRVAL_P(zparams), colorspace TSRMLS_CC);
+	if (corrector == NULL) {
+		return;
+	}
+	if (gdex_corrector_is_empty(corrector)) {
 		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "Nothing to do.");
 	}
 
-	RETURN_BOOL(result == CORRECT_SUCCESS);
+	intern = (corrector_object *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	if (intern->corrector != NULL) {
+		gdex_corrector_destroy(intern->corrector);
+	}
+	intern->corrector = corrector;
+}
+
+/* }}} */
+/* {{{ bool ColorCorrector::apply(resource im) */
+
+/*
+ * Correct color of the image.
+ */
+GDEXTRA_LOCAL PHP_METHOD(ColorCorrector, apply)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	gdex_corrector_t *corrector;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zim) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	corrector = gdex_corrector_fetch_object(getThis() TSRMLS_CC);
+	if (corrector == NULL) {
+		RETURN_FALSE;
+	}
+	if (gdex_corrector_is_empty(corrector)) {
+		RETURN_FALSE;
+	}
+
+	/* convert to true color */
+	if (!gdImageTrueColor(im) && gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	/* correct */
+	gdex_corrector_apply(corrector, im, 0, gdImageSY(im));
+
+	RETURN_TRUE;
+}
+
+/* }}} */
+/* {{{ _clut_new() */
+
+/*
+ * Allocate a color lookup table.
+ */
+static gdex_clut_t *
+_clut_new(int size)
+{
+	gdex_clut_t *clut;
+
+	clut = (gdex_clut_t *)emalloc(sizeof(gdex_clut_t));
+	clut->size = size;
+	clut->lattice = (unsigned short *)safe_emalloc((size_t)size * size * size,
+			3 * sizeof(unsigned short), 0);
+
+	return clut;
+}
+
+/* }}} */
+/* {{{ _clut_set_domain() */
+
+/*
+ * Precompute the lattice position for each 8-bit channel value.
+ */
+static void
+_clut_set_domain(gdex_clut_t *clut, const double *domain_min, const double *domain_max)
+{
+	int c, i, lower, last;
+	double pos, scale;
+
+	last = clut->size - 1;
+	clut->step[0] = 3;
+	clut->step[1] = 3 * clut->size;
+	clut->step[2] = 3 * clut->size * clut->size;
+
+	for (c = 0; c < 3; c++) {
+		scale = (double)last / (domain_max[c] - domain_min[c]);
+		for (i = 0; i < 256; i++) {
+			pos = ((double)i / 255.0 - domain_min[c]) * scale;
+			pos = MINMAX(pos, 0.0, (double)last);
+			lower = (int)pos;
+			if (lower >= last) {
+				lower = last - 1;
+			}
+			clut->index[c][i] = lower * clut->step[c];
+			clut->frac[c][i] = (int)((pos - (double)lower) * (double)CLUT_FRAC_ONE + 0.5);
+		}
+	}
+}
+
+/* }}} */
+/* {{{ _clut_parse_floats() */
+
+/*
+ * Parse whitespace separated numbers.
+ */
+static int
+_clut_parse_floats(const char *str, double *values, int num)
+{
+	const char *end;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		while (*str == ' ' || *str == '\t') {
+			str++;
+		}
+		values[i] = zend_strtod(str, &end);
+		if (end == str || !zend_finite(values[i])) {
+			return FAILURE;
+		}
+		str = end;
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _clut_load_cube() */
+
+/*
+ * Load an Adobe/Resolve .cube 3D LUT.
+ */
+static gdex_clut_t *
+_clut_load_cube(const char *filename TSRMLS_DC)
+{
+	php_stream *stream;
+	gdex_clut_t *clut = NULL;
+	char buf[CLUT_LINE_MAX], *line;
+	double domain_min[3] = { 0.0, 0.0, 0.0 };
+	double domain_max[3] = { 1.0, 1.0, 1.0 };
+	double rgb[3];
+	size_t len, n = 0, total = 0;
+	long size;
+	int c;
+
+	stream = php_stream_open_wrapper((char *)filename, "rb",
+			ENFORCE_SAFE_MODE | REPORT_ERRORS, NULL);
+	if (stream == NULL) {
+		return NULL;
+	}
+
+	while ((line = php_stream_get_line(stream, buf, sizeof(buf), &len)) != NULL) {
+		while (*line == ' ' || *line == '\t') {
+			line++;
+		}
+		if (*line == '\0' || *line == '\r' || *line == '\n' || *line == '#') {
+			continue;
+		}
+
+		if (!strncmp(line, "TITLE", 5)) {
+			continue;
+		} else if (!strncmp(line, "LUT_3D_SIZE", 11)) {
+			size = strtol(line + 11, NULL, 10);
+			if (clut != NULL || size < CLUT_SIZE_MIN || size > CLUT_SIZE_MAX) {
+				goto invalid_cube;
+			}
+			clut = _clut_new((int)size);
+			total = (size_t)size * size * size;
+		} else if (!strncmp(line, "DOMAIN_MIN", 10)) {
+			if (_clut_parse_floats(line + 10, domain_min, 3) == FAILURE) {
+				goto invalid_cube;
+			}
+		} else if (!strncmp(line, "DOMAIN_MAX", 10)) {
+			if (_clut_parse_floats(line + 10, domain_max, 3) == FAILURE) {
+				goto invalid_cube;
+			}
+		} else if (!strncmp(line, "LUT_3D_INPUT_RANGE", 18)) {
+			if (_clut_parse_floats(line + 18, rgb, 2) == FAILURE) {
+				goto invalid_cube;
+			}
+			domain_min[0] = domain_min[1] = domain_min[2] = rgb[0];
+			domain_max[0] = domain_max[1] = domain_max[2] = rgb[1];
+		} else if (!strncmp(line, "LUT_1D_SIZE", 11)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"1D LUT is not supported");
+			goto error_return_null;
+		} else {
+			if (clut == NULL || n >= total ||
+				_clut_parse_floats(line, rgb, 3) == FAILURE)
+			{
+				goto invalid_cube;
+			}
+			for (c = 0; c < 3; c++) {
+				double v = MINMAX(rgb[c], 0.0, 1.0);
+				clut->lattice[n * 3 + c] = (unsigned short)(v * 65535.0 + 0.5);
+			}
+			n++;
+		}
+	}
+
+	if (clut == NULL || n != total) {
+		goto invalid_cube;
+	}
+	for (c = 0; c < 3; c++) {
+		if (!(domain_max[c] > domain_min[c])) {
+			goto invalid_cube;
+		}
+	}
+
+	php_stream_close(stream);
+	_clut_set_domain(clut, domain_min, domain_max);
+
+	return clut;
+
+  invalid_cube:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING,
+			"Invalid .cube file given");
+  error_return_null:
+	php_stream_close(stream);
+	if (clut != NULL) {
+		gdex_clut_destroy(clut);
+	}
+	return NULL;
+}
+
+/* }}} */
+/* {{{ _clut_from_hald() */
+
+/*
+ * Load a HALD CLUT image.
+ */
+static gdex_clut_t *
+_clut_from_hald(const gdImagePtr im TSRMLS_DC)
+{
+	static const double domain_min[3] = { 0.0, 0.0, 0.0 };
+	static const double domain_max[3] = { 1.0, 1.0, 1.0 };
+	gdex_clut_t *clut;
+	unsigned short *p;
+	int level, width, x, y, c;
+
+	/* the image of level L is L^3 pixels square, and the lattice size is L^2 */
+	width = gdImageSX(im);
+	for (level = 2; level <= CLUT_HALD_LEVEL_MAX; level++) {
+		if (level * level * level >= width) {
+			break;
+		}
+	}
+	if (level > CLUT_HALD_LEVEL_MAX || level * level * level != width ||
+		gdImageSY(im) != width)
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Invalid HALD CLUT image dimensions");
+		return NULL;
+	}
+
+	clut = _clut_new(level * level);
+	p = clut->lattice;
+	for (y = 0; y < width; y++) {
+		for (x = 0; x < width; x++) {
+			if (gdImageTrueColor(im)) {
+				c = unsafeGetTrueColorPixel(im, x, y);
+				*p++ = (unsigned short)(getR(c) * 257);
+				*p++ = (unsigned short)(getG(c) * 257);
+				*p++ = (unsigned short)(getB(c) * 257);
+			} else {
+				c = unsafeGetPalettePixel(im, x, y);
+				*p++ = (unsigned short)(paletteR(im, c) * 257);
+				*p++ = (unsigned short)(paletteG(im, c) * 257);
+				*p++ = (unsigned short)(paletteB(im, c) * 257);
+			}
+		}
+	}
+	_clut_set_domain(clut, domain_min, domain_max);
+
+	return clut;
+}
+
+/* }}} */
+/* {{{ gdex_clut_apply() */
+
+/*
+ * Apply the color lookup table to the rows [y0..y1) of a true color image
+ * with tetrahedral interpolation in fixed point arithmetic.
+ */
+GDEXTRA_LOCAL void
+gdex_clut_apply(const gdex_clut_t *clut, gdImagePtr im, int y0, int y1)
+{
+	const unsigned short *lattice = clut->lattice;
+	const int sr = clut->step[0], sg = clut->step[1], sb = clut->step[2];
+	const int s3 = sr + sg + sb;
+	int x, y, width, c, r, g, b;
+	int fr, fg, fb, f1, f2, f3, d1, d2, w0, w1, w2, k;
+	int out[3];
+	const unsigned short *p;
+	int *row;
+
+	width = gdImageSX(im);
+	for (y = y0; y < y1; y++) {
+		row = im->tpixels[y];
+		for (x = 0; x < width; x++) {
+			c = row[x];
+			r = getR(c);
+			g = getG(c);
+			b = getB(c);
+			p = lattice + clut->index[0][r] + clut->index[1][g] + clut->index[2][b];
+			fr = clut->frac[0][r];
+			fg = clut->frac[1][g];
+			fb = clut->frac[2][b];
+
+			/* select the tetrahedron which contains the point */
+			if (fr > fg) {
+				if (fg > fb) {
+					d1 = sr;      d2 = sr + sg; f1 = fr; f2 = fg; f3 = fb;
+				} else if (fr > fb) {
+					d1 = sr;      d2 = sr + sb; f1 = fr; f2 = fb; f3 = fg;
+				} else {
+					d1 = sb;      d2 = sb + sr; f1 = fb; f2 = fr; f3 = fg;
+				}
+			} else {
+				if (fb > fg) {
+					d1 = sb;      d2 = sb + sg; f1 = fb; f2 = fg; f3 = fr;
+				} else if (fb > fr) {
+					d1 = sg;      d2 = sg + sb; f1 = fg; f2 = fb; f3 = fr;
+				} else {
+					d1 = sg;      d2 = sg + sr; f1 = fg; f2 = fr; f3 = fb;
+				}
+			}
+			w0 = CLUT_FRAC_ONE - f1;
+			w1 = f1 - f2;
+			w2 = f2 - f3;
+
+			for (k = 0; k < 3; k++) {
+				int v = (p[k] * w0 + p[d1 + k] * w1 + p[d2 + k] * w2 + p[s3 + k] * f3
+				         + (CLUT_FRAC_ONE >> 1)) >> CLUT_FRAC_BITS;
+				out[k] = (v * 255 + 32895) >> 16;
+			}
+			row[x] = gdTrueColorAlpha(out[0], out[1], out[2], getA(c));
+		}
+	}
+}
+
+/* }}} */
+/* {{{ _clut_band() */
+
+/*
+ * Apply the color lookup table to a band of rows
+ * Runs in worker threads; the kernel only touches the rows of its band.
+ */
+static void *
+_clut_band(void *arg)
+{
+	clut_band_t *band = (clut_band_t *)arg;
+
+	gdex_clut_apply(band->clut, band->im, band->y_start, band->y_end);
+
+	return NULL;
+}
+
+/* }}} */
+/* {{{ _clut_apply_image() */
+
+/*
+ * Apply the color lookup table to the whole image,
+ * splitting the rows into bands of gdextra.threads threads.
+ */
+static void
+_clut_apply_image(const gdex_clut_t *clut, gdImagePtr im TSRMLS_DC)
+{
+	clut_band_t bands[CLUT_MAX_THREADS];
+	int i, rows, threads, height = gdImageSY(im);
+#if PHP_GDEXTRA_WITH_PTHREADS
+	pthread_t tids[CLUT_MAX_THREADS];
+	int started[CLUT_MAX_THREADS];
+#endif
+
+	threads = gdex_get_threads(-1L, CLUT_MAX_THREADS TSRMLS_CC);
+	threads = MIN(threads, (height + CLUT_BAND_ROWS - 1) / CLUT_BAND_ROWS);
+	threads = MAX(threads, 1);
+	rows = (height + threads - 1) / threads;
+
+	for (i = 0; i < threads; i++) {
+		bands[i].clut = clut;
+		bands[i].im = im;
+		bands[i].y_start = MIN(i * rows, height);
+		bands[i].y_end = MIN(bands[i].y_start + rows, height);
+	}
+
+#if PHP_GDEXTRA_WITH_PTHREADS
+	/* the first band runs in the calling thread */
+	for (i = 1; i < threads; i++) {
+		started[i] = (pthread_create(&tids[i], NULL, _clut_band, &bands[i]) == 0);
+	}
+	_clut_band(&bands[0]);
+	for (i = 1; i < threads; i++) {
+		if (started[i]) {
+			pthread_join(tids[i], NULL);
+		} else {
+			_clut_band(&bands[i]);
+		}
+	}
+#else
+	for (i = 0; i < threads; i++) {
+		_clut_band(&bands[i]);
+	}
+#endif
+}
+
+/* }}} */
+/* {{{ gdex_clut_get_size() */
+
+/*
+ * Get the number of lattice points per axis.
+ */
+GDEXTRA_LOCAL int
+gdex_clut_get_size(const gdex_clut_t *clut)
+{
+	return clut->size;
+}
+
+/* }}} */
+/* {{{ gdex_clut_destroy() */
+
+/*
+ * Free the color lookup table.
+ */
+GDEXTRA_LOCAL void
+gdex_clut_destroy(gdex_clut_t *clut)
+{
+	efree(clut->lattice);
+	efree(clut);
+}
+
+/* }}} */
+/* {{{ _clut_free_storage() */
+
+/*
+ * Free a ColorLookupTable object.
+ */
+static void
+_clut_free_storage(void *object TSRMLS_DC)
+{
+	clut_object *intern = (clut_object *)object;
+
+	zend_object_std_dtor(&intern->std TSRMLS_CC);
+	if (intern->clut != NULL) {
+		gdex_clut_destroy(intern->clut);
+	}
+	efree(object);
+}
+
+/* }}} */
+/* {{{ gdex_clut_object_new() */
+
+/*
+ * Create a ColorLookupTable object.
+ */
+GDEXTRA_LOCAL zend_object_value
+gdex_clut_object_new(zend_class_entry *ce TSRMLS_DC)
+{
+	zend_object_value retval;
+	clut_object *intern;
+#if PHP_VERSION_ID < 50400
+	zval *tmp;
+#endif
+
+	intern = (clut_object *)ecalloc(1, sizeof(clut_object));
+	zend_object_std_init(&intern->std, ce TSRMLS_CC);
+#if PHP_VERSION_ID < 50400
+	zend_hash_copy(intern->std.properties, &ce->default_properties,
+			(copy_ctor_func_t)zval_add_ref, (void *)&tmp, sizeof(zval *));
+#else
+	object_properties_init(&intern->std, ce);
+#endif
+
+	retval.handle = zend_objects_store_put(intern,
+			(zend_objects_store_dtor_t)zend_objects_destroy_object,
+			(zend_objects_free_object_storage_t)_clut_free_storage,
+			NULL TSRMLS_CC);
+	retval.handlers = &_clut_handlers;
+
+	return retval;
+}
+
+/* }}} */
+/* {{{ gdex_clut_class_init() */
+
+/*
+ * Initialize the object handlers of ColorLookupTable.
+ */
+GDEXTRA_LOCAL void
+gdex_clut_class_init(zend_class_entry *ce)
+{
+	_ce_clut = ce;
+	memcpy(&_clut_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	_clut_handlers.clone_obj = NULL;
+}
+
+/* }}} */
+/* {{{ gdex_clut_fetch() */
+
+/*
+ * Get the color lookup table from a ColorLookupTable object,
+ * a .cube filename or a HALD CLUT image resource.
+ * If *shared is set to 0, the caller should free the returned table.
+ */
+GDEXTRA_LOCAL gdex_clut_t *
+gdex_clut_fetch(zval *zv, int *shared TSRMLS_DC)
+{
+	*shared = 0;
+
+	if (Z_TYPE_P(zv) == IS_OBJECT) {
+		clut_object *intern;
+
+		if (!instanceof_function(Z_OBJCE_P(zv), _ce_clut TSRMLS_CC)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"The object is not an instance of ColorLookupTable");
+			return NULL;
+		}
+		intern = (clut_object *)zend_object_store_get_object(zv TSRMLS_CC);
+		if (intern->clut == NULL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"The ColorLookupTable object is not initialized");
+			return NULL;
+		}
+		*shared = 1;
+		return intern->clut;
+	} else if (Z_TYPE_P(zv) == IS_RESOURCE) {
+		gdImagePtr hald;
+
+		hald = (gdImagePtr)zend_fetch_resource(&zv TSRMLS_CC, -1, "Image",
+				NULL, 1, GDEXG(le_gd));
+		if (hald == NULL) {
+			return NULL;
+		}
+		return _clut_from_hald(hald TSRMLS_CC);
+	} else if (Z_TYPE_P(zv) == IS_STRING) {
+		return _clut_load_cube(Z_STRVAL_P(zv) TSRMLS_CC);
+	}
+
+	php_error_docref(NULL TSRMLS_CC, E_WARNING,
+			"The color lookup table should be a ColorLookupTable object,"
+			" a filename or an image resource");
+	return NULL;
+}
+
+/* }}} */
+/* {{{ void ColorLookupTable::__construct(string filename) */
+
+/*
+ * Load a .cube file.
+ */
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, __construct)
+{
+	char *filename = NULL;
+	int filename_len = 0;
+	clut_object *intern;
+	gdex_clut_t *clut;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s",
+			&filename, &filename_len) == FAILURE)
+	{
+		return;
+	}
+
+	clut = _clut_load_cube(filename TSRMLS_CC);
+	if (clut == NULL) {
+		return;
+	}
+
+	intern = (clut_object *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	if (intern->clut != NULL) {
+		gdex_clut_destroy(intern->clut);
+	}
+	intern->clut = clut;
+}
+
+/* }}} */
+/* {{{ ColorLookupTable ColorLookupTable::fromHaldImage(resource im) */
+
+/*
+ * Create a color lookup table from a HALD CLUT image.
+ */
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, fromHaldImage)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	clut_object *intern;
+	gdex_clut_t *clut;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zim) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	clut = _clut_from_hald(im TSRMLS_CC);
+	if (clut == NULL) {
+		RETURN_FALSE;
+	}
+
+	object_init_ex(return_value, _ce_clut);
+	intern = (clut_object *)zend_object_store_get_object(return_value TSRMLS_CC);
+	intern->clut = clut;
+}
+
+/* }}} */
+/* {{{ int ColorLookupTable::getSize(void) */
+
+/*
+ * Get the number of lattice points per axis.
+ */
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, getSize)
+{
+	clut_object *intern;
+
+	if (ZEND_NUM_ARGS() != 0) {
+		WRONG_PARAM_COUNT;
+	}
+
+	intern = (clut_object *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	if (intern->clut == NULL) {
+		RETURN_FALSE;
+	}
+
+	RETURN_LONG(gdex_clut_get_size(intern->clut));
+}
+
+/* }}} */
+/* {{{ bool ColorLookupTable::apply(resource im) */
+
+/*
+ * Apply the color lookup table to the image.
+ */
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, apply)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	gdex_clut_t *clut;
+	int shared;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zim) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	clut = gdex_clut_fetch(getThis(), &shared TSRMLS_CC);
+	if (clut == NULL) {
+		RETURN_FALSE;
+	}
+
+	/* convert to true color */
+	if (!gdImageTrueColor(im) && gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	_clut_apply_image(clut, im TSRMLS_CC);
+
+	RETURN_TRUE;
+}
+
+/* }}} */
+/* {{{ bool imageapplyclut(resource im, mixed lut) */
+
+/*
+ * Apply a 3D color lookup table.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imageapplyclut)
+{
+	zval *zim = NULL, *zlut = NULL;
+	gdImagePtr im = NULL;
+	gdex_clut_t *clut;
+	int shared = 0;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rz",
+			&zim, &zlut) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	clut = gdex_clut_fetch(zlut, &shared TSRMLS_CC);
+	if (clut == NULL) {
+		RETURN_FALSE;
+	}
+
+	/* convert to true color */
+	if (!gdImageTrueColor(im) && gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+		if (!shared) {
+			gdex_clut_destroy(clut);
+		}
+		RETURN_FALSE;
+	}
+
+	_clut_apply_image(clut, im TSRMLS_CC);
+	if (!shared) {
+		gdex_clut_destroy(clut);
+	}
+
+	RETURN_TRUE;
+}
+
+/* }}} */
+/* {{{ _get_lut() */
+
+/*
+ * Get a lookup table from a 256-byte string or a 256-entry array.
+ * Returns 0 if NULL is given, 1 if the table is filled.
+ */
+static int
+_get_lut(zval *zv, const char *name, unsigned char *lut TSRMLS_DC)
+{
+	zval **entry;
+	long v;
+	int i;
+
+	if (zv == NULL || Z_TYPE_P(zv) == IS_NULL) {
+		return 0;
+	}
+
+	if (Z_TYPE_P(zv) == IS_STRING) {
+		if (Z_STRLEN_P(zv) != 256) {
+			goto invalid_lut;
+		}
+		memcpy(lut, Z_STRVAL_P(zv), 256);
+		return 1;
+	}
+
+	if (Z_TYPE_P(zv) == IS_ARRAY) {
+		if (zend_hash_num_elements(Z_ARRVAL_P(zv)) != 256) {
+			goto invalid_lut;
+		}
+		for (i = 0; i < 256; i++) {
+			if (zend_hash_index_find(Z_ARRVAL_P(zv), i, (void **)&entry) == FAILURE) {
+				goto invalid_lut;
+			}
+			v = gdex_get_lval(*entry);
+			lut[i] = (unsigned char)MINMAX(v, 0L, 255L);
+		}
+		return 1;
+	}
+
+  invalid_lut:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING,
+			"Invalid lookup table given for %s channel", name);
+	return -1;
+}
+
+/* }}} */
+/* {{{ bool imageapplylut(resource im, mixed red, mixed green, mixed blue
+                          [, mixed alpha]) */
+
+/*
+ * Apply the lookup tables for each channel.
+ * The alpha table maps 8-bit opacity (0: transparent, 255: opaque).
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imageapplylut)
+{
+	zval *zim = NULL, *zr = NULL, *zg = NULL, *zb = NULL, *za = NULL;
+	gdImagePtr im = NULL;
+	unsigned char lutR[256], lutG[256], lutB[256], lutA[256];
+	unsigned char alut[gdAlphaMax + 1];
+	int has_r, has_g, has_b, has_a, i;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rz!z!z!|z!",
+			&zim, &zr, &zg, &zb, &za) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	/* get the lookup tables */
+	if ((has_r = _get_lut(zr, "red",   lutR TSRMLS_CC)) < 0 ||
+		(has_g = _get_lut(zg, "green", lutG TSRMLS_CC)) < 0 ||
+		(has_b = _get_lut(zb, "blue",  lutB TSRMLS_CC)) < 0 ||
+		(has_a = _get_lut(za, "alpha", lutA TSRMLS_CC)) < 0)
+	{
+		RETURN_FALSE;
+	}
+	for (i = 0; i < 256; i++) {
+		if (!has_r) {
+			lutR[i] = (unsigned char)i;
+		}
+		if (!has_g) {
+			lutG[i] = (unsigned char)i;
+		}
+		if (!has_b) {
+			lutB[i] = (unsigned char)i;
+		}
+	}
+	for (i = 0; i <= gdAlphaMax; i++) {
+		alut[i] = (has_a) ? (unsigned char)_gray2alpha(lutA[_alpha2gray(i)]) : (unsigned char)i;
+	}
+
+	if (gdImageTrueColor(im)) {
+		_apply_luts(im, 0, gdImageSY(im), lutR, lutG, lutB, alut);
+	} else {
+		/* map the palette entries instead of the pixels */
+		for (i = 0; i < gdImageColorsTotal(im); i++) {
+			paletteR(im, i) = lutR[paletteR(im, i)];
+			paletteG(im, i) = lutG[paletteG(im, i)];
+			paletteB(im, i) = lutB[paletteB(im, i)];
+			paletteA(im, i) = alut[paletteA(im, i)];
+		}
+	}
+
+	RETURN_TRUE;
+}
+
+/* }}} */
+/* {{{ bool imagecolorcorrect(resource im, array params[, int colorspace]) */
+
+/*
+ * Correct color.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorcorrect)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	zval *zparams = NULL;
+	long colorspace = COLORSPACE_RGB;
+	gdex_corrector_t *corrector;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ra|l",
+			&zim, &zparams, &colorspace) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	/* compile the parameters */
+	corrector = gdex_corrector_new(Z_ARRVAL_P(zparams), colorspace TSRMLS_CC);
+	if (corrector == NULL) {
+		RETURN_FALSE;
+	}
+	if (gdex_corrector_is_empty(corrector)) {
+		gdex_corrector_destroy(corrector);
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "Nothing to do.");
+		RETURN_FALSE;
+	}
+
+	/* convert to true color */
+	if (!gdImageTrueColor(im) && gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+		gdex_corrector_destroy(corrector);
+		RETURN_FALSE;
+	}
+
+	/* correct */
+	gdex_corrector_apply(corrector, im, 0, gdImageSY(im));
+	gdex_corrector_destroy(corrector);
+
+	RETURN_TRUE;
 }
 
 /* }}} */
@@ -37,21 +37,16 @@ static void
 _tile_copy(gdImagePtr dst, gdImagePtr src, int position);
 
 /* }}} */
-/* {{{ void imageflip(resource im, int mode) */
+/* {{{ gdex_image_flip() */
 
-GDEXTRA_LOCAL GDEX_FUNCTION(imageflip)
+/*
+ * Flip the image.
+ */
+GDEXTRA_LOCAL void
+gdex_image_flip(gdImagePtr im, int mode)
 {
-	zval *zim = NULL;
-	gdImagePtr im = NULL;
-	long mode = 0L;
 	int x, y, z, width, height, to;
 
-	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rl", &zim, &mode) == FAILURE) {
-		return;
-	}
-	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
-
 	width = gdImageSX(im);
 	height = gdImageSY(im);
 
@@ -115,18 +110,34 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imageflip)
 }
 
 /* }}} */
-/* {{{ resource imagescale(resource im, int width, int height
-                           [, int mode[, array options]]) */
+/* {{{ void imageflip(resource im, int mode) */
 
-GDEXTRA_LOCAL GDEX_FUNCTION(imagescale)
+GDEXTRA_LOCAL GDEX_FUNCTION(imageflip)
 {
 	zval *zim = NULL;
-	gdImagePtr src = NULL;
+	gdImagePtr im = NULL;
+	long mode = 0L;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rl", &zim, &mode) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	gdex_image_flip(im, (int)mode);
+}
+
+/* }}} */
+/* {{{ gdex_image_scale() */
+
+/*
+ * Create a scaled copy of the image.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_image_scale(const gdImagePtr src, long width, long height, long mode,
+                 HashTable *options TSRMLS_DC)
+{
 	gdImagePtr dst = NULL;
-	long width = 0L, height = 0L;
-	long mode = SCALE_FIT;
-	zval *zoptions = NULL;
-	HashTable *options = NULL;
 	zval **entry;
 	int position = POSITION_DEFAULT;
 	int resample = 1;
@@ -136,27 +147,15 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagescale)
 	double dst_r, src_r;
 	int restoreAlphaBlending;
 
-	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rll|la!",
-			&zim, &width, &height, &mode, &zoptions) == FAILURE)
-	{
-		return;
-	}
-	ZEND_FETCH_RESOURCE(src, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
-
-	if (zoptions != NULL && Z_TYPE_P(zoptions) == IS_ARRAY) {
-		options = Z_ARRVAL_P(zoptions);
-
-		/* get the scaling position */
-		if (hash_find(options, "position", &entry) == SUCCESS) {
-			position = (int)(gdex_get_lval(*entry) & POSITION_MASK);
-		}
+	/* get the scaling position */
+	if (options != NULL && hash_find(options, "position", &entry) == SUCCESS) {
+		position = (int)(gdex_get_lval(*entry) & POSITION_MASK);
 	}
 
 	/* get the image sizes */
 	if (width < 1L || height < 1L || width > INT_MAX || height > INT_MAX) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid image dimensions");
-		RETURN_FALSE;
+		return NULL;
 	}
 	dst_w = new_w = (int)width;
 	dst_h = new_h = (int)height;
@@ -234,29 +233,23 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagescale)
 			break;
 
 		case SCALE_CARVE:
-#if PHP_GDEXTRA_WITH_LQR
 			if (src_r > dst_r) {
 				dst_w = fit_w;
 			} else if (src_r < dst_r) {
 				dst_h = fit_h;
 			}
 			break;
-#else
-			php_error_docref(NULL TSRMLS_CC, E_WARNING,
-					"'IMAGE_EX_SCALE_CARVE' mode is not available");
-			RETURN_FALSE;
-#endif
 
 		default:
 			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Unsupported mode given (%ld)", mode);
-			RETURN_FALSE;
+			return NULL;
 	}
 
 	/* create a new image */
 	dst = gdImageCreateTrueColor(dst_w, dst_h);
 	if (dst == NULL) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create a new image");
-		RETURN_FALSE;
+		return NULL;
 	}
 	restoreAlphaBlending = dst->alphaBlendingFlag;
 	dst->alphaBlendingFlag = gdEffectReplace;
@@ -296,7 +289,6 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagescale)
 	dst->alphaBlendingFlag = restoreAlphaBlending;
 
 	/* carve the overflown area */
-#if PHP_GDEXTRA_WITH_LQR
 	if (mode == SCALE_CARVE) {
 		gdImagePtr tmp;
 		HashTable *carve_options = NULL;
@@ -305,15 +297,45 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagescale)
 			carve_options = HASH_OF(*entry);
 		}
 
-		tmp = gdex_liquid_rescale(dst, new_w, new_h, carve_options TSRMLS_CC);
+		tmp = gdex_carve(dst, new_w, new_h, carve_options TSRMLS_CC);
 		gdImageDestroy(dst);
-		if (tmp) {
-			dst = tmp;
-		} else {
-			RETURN_FALSE;
-		}
+		dst = tmp;
+	}
+
+	return dst;
+}
+
+/* }}} */
+/* {{{ resource imagescale(resource im, int width, int height
+                           [, int mode[, array options]]) */
+
+GDEXTRA_LOCAL GDEX_FUNCTION(imagescale)
+{
+	zval *zim = NULL;
+	gdImagePtr src = NULL;
+	gdImagePtr dst = NULL;
+	long width = 0L, height = 0L;
+	long mode = SCALE_FIT;
+	zval *zoptions = NULL;
+	HashTable *options = NULL;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rll|la!",
+			&zim, &width, &height, &mode, &zoptions) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(src, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	if (zoptions != NULL && Z_TYPE_P(zoptions) == IS_ARRAY) {
+		options = Z_ARRVAL_P(zoptions);
+	}
+
+	/* scale the image */
+	dst = gdex_image_scale(src, width, height, mode, options TSRMLS_CC);
+	if (dst == NULL) {
+		RETURN_FALSE;
 	}
-#endif
 
 	/* return a new image resource */
 	ZEND_REGISTER_RESOURCE(return_value, dst, GDEXG(le_gd));
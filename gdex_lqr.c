@@ -29,17 +29,74 @@
 
 #include "php_gdextra.h"
 #include <lqr.h>
+#include <stdint.h>
 
 ZEND_EXTERN_MODULE_GLOBALS(gdextra);
 
+/* {{{ type definitions */
+
+/*
+ * State shared with the progress hooks, which take no user data
+ */
+typedef struct {
+	LqrCarver *carver;
+	gint64 deadline;   /* monotonic time in microseconds, 0 for no limit */
+	long timeout_ms;
+	zval *callback;
+	int step;          /* report the progress every 'step' percent */
+	int next;
+	int fallback;
+	int timed_out;
+} lqr_context_t;
+
+/* }}} */
 /* {{{ private function prototypes */
 
 static const char *
 _lqrerrstr(LqrRetVal ret);
 
 static int
-_get_lqr_options(HashTable *options, gint *max_step, gfloat *rigidity,
-                 int *vertical_seam, int *save_alpha TSRMLS_DC);
+_get_lqr_progress_options(HashTable *options, const gdex_carve_options_t *opts,
+                          lqr_context_t *context TSRMLS_DC);
+
+static int
+_attach_lqr_progress(LqrCarver *carver, lqr_context_t *context TSRMLS_DC);
+
+static LqrRetVal
+_lqr_progress_init(const gchar *message);
+
+static LqrRetVal
+_lqr_progress_update(gdouble percentage);
+
+static gdImagePtr
+_lqr_cancelled(const gdImagePtr src, int width, int height,
+               const lqr_context_t *context TSRMLS_DC);
+
+static gdImagePtr
+_truecolor_copy(const gdImagePtr src, int transpose);
+
+static gdImagePtr
+_proxy_carve_width(const gdImagePtr src, int width, double scale,
+                   gint max_step, gfloat rigidity, int save_alpha,
+                   lqr_context_t *context, LqrRetVal *ret TSRMLS_DC);
+
+static LqrRetVal
+_proxy_liquid_rescale(const gdImagePtr src, int width, int height, double scale,
+                      gint max_step, gfloat rigidity, int vertical_seam, int save_alpha,
+                      lqr_context_t *context, gdImagePtr *dst TSRMLS_DC);
+
+static gdImagePtr
+_liquid_rescale(const gdImagePtr src, int width, int height, HashTable *options,
+                const gdex_carve_options_t *opts, lqr_context_t *context TSRMLS_DC);
+
+static int
+_get_carve_size(zval *zsize, int *width, int *height TSRMLS_DC);
+
+static LqrVMap *
+_array_to_lqrvmap(HashTable *vmap, int width, int height, int orientation TSRMLS_DC);
+
+static void
+_lqrvmap_to_array(LqrVMap *vmap, zval *zv);
 
 static LqrCarver *
 _gdimage_to_lqrcaver(const gdImagePtr im, int save_alpha);
@@ -71,56 +128,506 @@ _lqrerrstr(LqrRetVal ret)
 }
 
 /* }}} */
-/* {{{ _get_lqr_options */
+/* {{{ _get_lqr_progress_options */
 
 /*
- * Get liquid rescale options
+ * Get 'progress' and 'progress_step' options, and start the time budget
  */
 static int
-_get_lqr_options(HashTable *options, gint *max_step, gfloat *rigidity,
-                 int *vertical_seam, int *save_alpha TSRMLS_DC)
+_get_lqr_progress_options(HashTable *options, const gdex_carve_options_t *opts,
+                          lqr_context_t *context TSRMLS_DC)
 {
 	zval **entry = NULL;
 
+	memset(context, 0, sizeof(lqr_context_t));
+	context->step = 10;
+	context->fallback = opts->fallback;
+	if (opts->timeout_ms > 0L) {
+		context->timeout_ms = opts->timeout_ms;
+		context->deadline = g_get_monotonic_time() + (gint64)opts->timeout_ms * 1000;
+	}
 	if (options == NULL) {
 		return SUCCESS;
 	}
 
-	if (hash_find(options, "max_step", &entry) == SUCCESS) {
-		long l = gdex_get_lval(*entry);
-		if (l < 0L) {
+	if (hash_find(options, "progress", &entry) == SUCCESS
+		&& Z_TYPE_PP(entry) != IS_NULL)
+	{
+		if (!zend_is_callable(*entry, 0, NULL TSRMLS_CC)) {
 			php_error_docref(NULL TSRMLS_CC, E_WARNING,
-					"'max_step' must not be a negative number");
+					"'progress' must be a valid callback");
 			return FAILURE;
 		}
-		*max_step = (gint)l;
+		context->callback = *entry;
 	}
 
-	if (hash_find(options, "rigidity", &entry) == SUCCESS) {
-		double d = gdex_get_dval(*entry);
-		if (!zend_finite(d)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING,
-					"'rigidity' must be a finite number");
-			return FAILURE;
-		} else if (d < 0.0) {
+	if (hash_find(options, "progress_step", &entry) == SUCCESS) {
+		long l = gdex_get_lval(*entry);
+		if (l < 1L || l > 100L) {
 			php_error_docref(NULL TSRMLS_CC, E_WARNING,
-					"'rigidity' must not be a negative number");
+					"'progress_step' must be between 1 and 100");
 			return FAILURE;
 		}
-		*rigidity = (gfloat)d;
+		context->step = (int)l;
 	}
 
-	if (hash_find(options, "vertical_seam", &entry) == SUCCESS) {
-		*vertical_seam = zval_is_true(*entry);
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _attach_lqr_progress() */
+
+/*
+ * Set the progress hooks if the time budget or the callback is given
+ * The carver takes the ownership of the progress.
+ */
+static int
+_attach_lqr_progress(LqrCarver *carver, lqr_context_t *context TSRMLS_DC)
+{
+	LqrProgress *progress;
+
+	if (context->deadline == 0 && context->callback == NULL) {
+		return SUCCESS;
 	}
 
-	if (hash_find(options, "save_alpha", &entry) == SUCCESS) {
-		*save_alpha = zval_is_true(*entry);
+	progress = lqr_progress_new();
+	if (progress == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Cannot create the progress");
+		return FAILURE;
 	}
+	lqr_progress_set_init(progress, _lqr_progress_init);
+	lqr_progress_set_update(progress, _lqr_progress_update);
+	lqr_progress_set_update_step(progress, 0.01f);
+	lqr_carver_set_progress(carver, progress);
+	context->carver = carver;
 
 	return SUCCESS;
 }
 
+/* }}} */
+/* {{{ _lqr_progress_init() */
+
+/*
+ * Called at the beginning of each resizing pass
+ */
+static LqrRetVal
+_lqr_progress_init(const gchar *message)
+{
+	TSRMLS_FETCH();
+	lqr_context_t *context = (lqr_context_t *)GDEXG(lqr_context);
+
+	if (context != NULL) {
+		context->next = 0;
+	}
+	return LQR_OK;
+}
+
+/* }}} */
+/* {{{ _lqr_progress_update() */
+
+/*
+ * Check the time budget and report the progress to the callback
+ * Returning LQR_USRCANCEL after lqr_carver_cancel() stops the carver.
+ */
+static LqrRetVal
+_lqr_progress_update(gdouble percentage)
+{
+	TSRMLS_FETCH();
+	lqr_context_t *context = (lqr_context_t *)GDEXG(lqr_context);
+	int percent;
+
+	if (context == NULL) {
+		return LQR_OK;
+	}
+
+	if (context->deadline > 0 && g_get_monotonic_time() > context->deadline) {
+		context->timed_out = 1;
+		lqr_carver_cancel(context->carver);
+		return LQR_USRCANCEL;
+	}
+
+	percent = (int)(percentage * 100.0);
+	if (context->callback != NULL && percent >= context->next) {
+		zval *zpercent, **args[1], *retval = NULL;
+		int cancel = 0;
+
+		context->next = percent - percent % context->step + context->step;
+
+		MAKE_STD_ZVAL(zpercent);
+		ZVAL_LONG(zpercent, (long)percent);
+		args[0] = &zpercent;
+		if (call_user_function_ex(EG(function_table), NULL, context->callback,
+				&retval, 1, args, 0, NULL TSRMLS_CC) == FAILURE || EG(exception))
+		{
+			cancel = 1;
+		}
+		if (retval != NULL) {
+			if (Z_TYPE_P(retval) == IS_BOOL && !Z_BVAL_P(retval)) {
+				cancel = 1;
+			}
+			zval_ptr_dtor(&retval);
+		}
+		zval_ptr_dtor(&zpercent);
+
+		if (cancel) {
+			lqr_carver_cancel(context->carver);
+			return LQR_USRCANCEL;
+		}
+	}
+
+	return LQR_OK;
+}
+
+/* }}} */
+/* {{{ _lqr_cancelled() */
+
+/*
+ * Return the fallback image, or NULL, after the carver was cancelled
+ */
+static gdImagePtr
+_lqr_cancelled(const gdImagePtr src, int width, int height,
+               const lqr_context_t *context TSRMLS_DC)
+{
+	gdImagePtr dst;
+
+	if (!context->timed_out) {
+		/* cancelled by the progress callback */
+		return NULL;
+	}
+	if (!context->fallback) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Liquid rescaling timed out (%ld ms)", context->timeout_ms);
+		return NULL;
+	}
+
+	dst = gdex_carve_fallback(src, width, height);
+	if (dst == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Cannot create the resampled image");
+	}
+	return dst;
+}
+
+/* }}} */
+/* {{{ _truecolor_copy() */
+
+/*
+ * Create a true color copy of the image, optionally transposed
+ */
+static gdImagePtr
+_truecolor_copy(const gdImagePtr src, int transpose)
+{
+	gdImagePtr dst;
+	int x, y, width, height;
+
+	width = gdImageSX(src);
+	height = gdImageSY(src);
+	if (transpose) {
+		dst = gdImageCreateTrueColor(height, width);
+	} else {
+		dst = gdImageCreateTrueColor(width, height);
+	}
+	if (dst == NULL) {
+		return NULL;
+	}
+
+	if (gdImageTrueColor(src)) {
+		for (y = 0; y < height; y++) {
+			const int *row = src->tpixels[y];
+			if (transpose) {
+				for (x = 0; x < width; x++) {
+					dst->tpixels[x][y] = row[x];
+				}
+			} else {
+				memcpy(dst->tpixels[y], row, (size_t)width * sizeof(int));
+			}
+		}
+	} else {
+		int c, i;
+
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < width; x++) {
+				i = unsafeGetPalettePixel(src, x, y);
+				c = gdTrueColorAlpha(paletteR(src, i), paletteG(src, i),
+						paletteB(src, i), paletteA(src, i));
+				if (transpose) {
+					dst->tpixels[x][y] = c;
+				} else {
+					dst->tpixels[y][x] = c;
+				}
+			}
+		}
+	}
+
+	return dst;
+}
+
+/* }}} */
+/* {{{ _proxy_carve_width() */
+
+/*
+ * Reduce the width of a true color image using the seams of a proxy
+ * The visibility map is computed on a downsampled copy, and each pixel
+ * of the source inherits the removal level of the proxy pixel above it.
+ * On each row, the pixels with the lowest levels are removed, and the
+ * ties at the last level are broken by the local gradient energy. Each
+ * pick stays within max_step of the same pick on the row above, so that
+ * the refined seams remain connected.
+ */
+static gdImagePtr
+_proxy_carve_width(const gdImagePtr src, int width, double scale,
+                   gint max_step, gfloat rigidity, int save_alpha,
+                   lqr_context_t *context, LqrRetVal *ret TSRMLS_DC)
+{
+	gdImagePtr proxy, dst;
+	LqrCarver *carver;
+	LqrVMap *vmap;
+	gint *levels;
+	int src_w, src_h, proxy_w, proxy_h, proxy_target, map_w, depth;
+	int x, y, need, cum, last, rest, n, k, prev_n = 0;
+	int *level, *hist, *picks;
+	uint64_t *keys;
+	unsigned char *removed;
+
+	src_w = gdImageSX(src);
+	src_h = gdImageSY(src);
+	proxy_w = MAX((int)((double)src_w * scale + 0.5), 2);
+	proxy_h = MAX((int)((double)src_h * scale + 0.5), 1);
+	proxy_target = (int)((double)width * (double)proxy_w / (double)src_w + 0.5);
+	proxy_target = MIN(MAX(proxy_target, 1), proxy_w - 1);
+
+	/* compute the visibility map on the proxy */
+	proxy = gdImageCreateTrueColor(proxy_w, proxy_h);
+	if (proxy == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create the proxy image");
+		*ret = LQR_NOMEM;
+		return NULL;
+	}
+	proxy->alphaBlendingFlag = gdEffectReplace;
+	gdImageCopyResampled(proxy, src, 0, 0, 0, 0, proxy_w, proxy_h, src_w, src_h);
+	carver = _gdimage_to_lqrcaver(proxy, save_alpha);
+	gdImageDestroy(proxy);
+	if (carver == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create the caver");
+		*ret = LQR_NOMEM;
+		return NULL;
+	}
+	if (_attach_lqr_progress(carver, context TSRMLS_CC) == FAILURE) {
+		lqr_carver_destroy(carver);
+		*ret = LQR_NOMEM;
+		return NULL;
+	}
+	*ret = lqr_carver_init(carver, max_step, rigidity);
+	if (*ret == LQR_OK) {
+		*ret = lqr_carver_resize(carver, proxy_target, proxy_h);
+	}
+	if (*ret != LQR_OK) {
+		if (*ret != LQR_USRCANCEL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Failed to resize (%s)", _lqrerrstr(*ret));
+		}
+		lqr_carver_destroy(carver);
+		return NULL;
+	}
+	vmap = lqr_vmap_dump(carver);
+	lqr_carver_destroy(carver);
+	if (vmap == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot dump the visibility map");
+		*ret = LQR_NOMEM;
+		return NULL;
+	}
+	levels = lqr_vmap_get_data(vmap);
+	map_w = lqr_vmap_get_width(vmap);
+	depth = lqr_vmap_get_depth(vmap);
+
+	dst = gdImageCreateTrueColor(width, src_h);
+	if (dst == NULL) {
+		lqr_vmap_destroy(vmap);
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Cannot create the post-carving image");
+		*ret = LQR_NOMEM;
+		return NULL;
+	}
+
+	level = (int *)safe_emalloc((size_t)src_w, sizeof(int), 0);
+	hist = (int *)safe_emalloc((size_t)depth + 2, sizeof(int), 0);
+	keys = (uint64_t *)safe_emalloc((size_t)src_w, sizeof(uint64_t), 0);
+	removed = (unsigned char *)emalloc((size_t)src_w);
+	picks = (int *)safe_emalloc((size_t)src_w, sizeof(int), 0);
+	need = src_w - width;
+
+	for (y = 0; y < src_h; y++) {
+		const int *row = src->tpixels[y];
+		const int *above = src->tpixels[(y > 0) ? y - 1 : y];
+		const int *below = src->tpixels[(y < src_h - 1) ? y + 1 : y];
+		const gint *map_row = levels
+				+ ((size_t)y * (size_t)proxy_h / (size_t)src_h) * (size_t)map_w;
+		int *out = dst->tpixels[y];
+
+		/* inherit the levels, pixels never removed from the proxy go last */
+		memset(hist, 0, ((size_t)depth + 2) * sizeof(int));
+		for (x = 0; x < src_w; x++) {
+			int l = map_row[(size_t)x * (size_t)proxy_w / (size_t)src_w];
+			if (l < 1 || l > depth) {
+				l = depth + 1;
+			}
+			level[x] = l;
+			hist[l]++;
+		}
+
+		/* find the last level to remove */
+		cum = 0;
+		for (last = 1; last <= depth; last++) {
+			if (cum + hist[last] >= need) {
+				break;
+			}
+			cum += hist[last];
+		}
+		rest = need - cum;
+
+		/* refine the ties at the last level by the gradient energy */
+		n = 0;
+		for (x = 0; x < src_w; x++) {
+			removed[x] = (level[x] < last);
+			if (level[x] == last) {
+				int l = (x > 0) ? x - 1 : x;
+				int r = (x < src_w - 1) ? x + 1 : x;
+				int e = abs(_rgb2gray(getR(row[r]), getG(row[r]), getB(row[r]))
+				          - _rgb2gray(getR(row[l]), getG(row[l]), getB(row[l])))
+				      + abs(_rgb2gray(getR(below[x]), getG(below[x]), getB(below[x]))
+				          - _rgb2gray(getR(above[x]), getG(above[x]), getB(above[x])));
+				keys[n++] = ((uint64_t)e << 32) | (uint64_t)x;
+			}
+		}
+		if (rest >= n) {
+			for (k = 0; k < n; k++) {
+				removed[keys[k] & 0xffffffffU] = 1;
+			}
+		} else if (prev_n == 0) {
+			qsort(keys, (size_t)n, sizeof(uint64_t), gdex_compare_keys);
+			for (k = 0; k < rest; k++) {
+				removed[keys[k] & 0xffffffffU] = 1;
+			}
+		} else {
+			/* the keys are in the order of x, pick the k-th tie near the
+			 * k-th pick above, leaving enough ties for the rest */
+			int lo = 0, prev_j = -1;
+			for (k = 0; k < rest; k++) {
+				int ref = picks[(size_t)k * (size_t)prev_n / (size_t)rest];
+				int limit = n - rest + k;
+				int j, best = -1;
+				while (lo < n && (int)(keys[lo] & 0xffffffffU) < ref - max_step) {
+					lo++;
+				}
+				j = MIN(MAX(prev_j + 1, lo), limit);
+				for (; j <= limit && (int)(keys[j] & 0xffffffffU) <= ref + max_step; j++) {
+					if ((int)(keys[j] & 0xffffffffU) >= ref - max_step
+						&& (best < 0 || (keys[j] >> 32) < (keys[best] >> 32)))
+					{
+						best = j;
+					}
+				}
+				if (best < 0) {
+					/* no tie in reach, take the nearest one */
+					best = MIN(MAX(prev_j + 1, lo), limit);
+					if (best > prev_j + 1 && abs((int)(keys[best - 1] & 0xffffffffU) - ref)
+							< abs((int)(keys[best] & 0xffffffffU) - ref))
+					{
+						best--;
+					}
+				}
+				removed[keys[best] & 0xffffffffU] = 1;
+				prev_j = best;
+			}
+		}
+
+		/* remember the picks at the last level for the next row */
+		prev_n = 0;
+		for (x = 0; x < src_w; x++) {
+			if (level[x] == last && removed[x]) {
+				picks[prev_n++] = x;
+			}
+		}
+
+		/* copy the remaining pixels */
+		n = 0;
+		for (x = 0; x < src_w && n < width; x++) {
+			if (!removed[x]) {
+				out[n++] = save_alpha ? row[x] : (row[x] & 0xffffff);
+			}
+		}
+	}
+
+	efree(level);
+	efree(hist);
+	efree(keys);
+	efree(removed);
+	efree(picks);
+	lqr_vmap_destroy(vmap);
+
+	return dst;
+}
+
+/* }}} */
+/* {{{ _proxy_liquid_rescale() */
+
+/*
+ * Do liquid rescaling with the seams computed on a downsampled proxy
+ * Each dimension is reduced in turn; the height is reduced by carving
+ * the width of the transposed image.
+ */
+static LqrRetVal
+_proxy_liquid_rescale(const gdImagePtr src, int width, int height, double scale,
+                      gint max_step, gfloat rigidity, int vertical_seam, int save_alpha,
+                      lqr_context_t *context, gdImagePtr *dst TSRMLS_DC)
+{
+	gdImagePtr cur, tmp;
+	LqrRetVal ret = LQR_OK;
+	int pass;
+
+	*dst = NULL;
+	cur = _truecolor_copy(src, 0);
+	if (cur == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create a new image");
+		return LQR_NOMEM;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		int vertical = (pass == 0) ? vertical_seam : !vertical_seam;
+
+		if (!vertical && width < gdImageSX(cur)) {
+			tmp = _proxy_carve_width(cur, width, scale, max_step, rigidity,
+					save_alpha, context, &ret TSRMLS_CC);
+		} else if (vertical && height < gdImageSY(cur)) {
+			gdImagePtr transposed = _truecolor_copy(cur, 1);
+			if (transposed == NULL) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create a new image");
+				gdImageDestroy(cur);
+				return LQR_NOMEM;
+			}
+			tmp = _proxy_carve_width(transposed, height, scale, max_step, rigidity,
+					save_alpha, context, &ret TSRMLS_CC);
+			gdImageDestroy(transposed);
+			if (tmp != NULL) {
+				transposed = tmp;
+				tmp = _truecolor_copy(transposed, 1);
+				gdImageDestroy(transposed);
+			}
+		} else {
+			continue;
+		}
+		gdImageDestroy(cur);
+		if (tmp == NULL) {
+			return (ret == LQR_OK) ? LQR_NOMEM : ret;
+		}
+		cur = tmp;
+	}
+
+	*dst = cur;
+	return LQR_OK;
+}
+
 /* }}} */
 /* {{{ _gdimage_to_lqrcaver() */
 
@@ -242,54 +749,220 @@ _lqrcarver_to_gdimage(LqrCarver *carver)
 }
 
 /* }}} */
-/* {{{ gdex_liquid_rescale() */
+/* {{{ _get_carve_size() */
 
 /*
- *  Do liquid rescaling.
+ * Get a target size given as array(width, height)
+ * or array('width' => width, 'height' => height)
  */
-GDEXTRA_LOCAL gdImagePtr
-gdex_liquid_rescale(const gdImagePtr src, int width, int height,
-                    HashTable *options TSRMLS_DC)
+static int
+_get_carve_size(zval *zsize, int *width, int *height TSRMLS_DC)
+{
+	zval **zw, **zh;
+	long w, h;
+
+	if (Z_TYPE_P(zsize) != IS_ARRAY
+		|| ((zend_hash_index_find(Z_ARRVAL_P(zsize), 0, (void **)&zw) == FAILURE
+				|| zend_hash_index_find(Z_ARRVAL_P(zsize), 1, (void **)&zh) == FAILURE)
+			&& (hash_find(Z_ARRVAL_P(zsize), "width", &zw) == FAILURE
+				|| hash_find(Z_ARRVAL_P(zsize), "height", &zh) == FAILURE)))
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Each size must be an array of the width and the height");
+		return FAILURE;
+	}
+
+	w = gdex_get_lval(*zw);
+	h = gdex_get_lval(*zh);
+	if (w < 1L || h < 1L || w > INT_MAX || h > INT_MAX) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid image dimensions");
+		return FAILURE;
+	}
+	*width = (int)w;
+	*height = (int)h;
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _array_to_lqrvmap() */
+
+/*
+ * Create a visibility map from the array exported by imagecarvemulti()
+ * The map must match the size of the image, and each level must be
+ * between 0 (never removed) and the depth.
+ */
+static LqrVMap *
+_array_to_lqrvmap(HashTable *vmap, int width, int height, int orientation TSRMLS_DC)
+{
+	zval **zw, **zh, **zdepth, **zorientation, **zdata;
+	long w, h, depth, i;
+	gint *buffer;
+	LqrVMap *map;
+
+	if (hash_find(vmap, "width", &zw) == FAILURE
+		|| hash_find(vmap, "height", &zh) == FAILURE
+		|| hash_find(vmap, "depth", &zdepth) == FAILURE
+		|| hash_find(vmap, "orientation", &zorientation) == FAILURE
+		|| hash_find(vmap, "data", &zdata) == FAILURE
+		|| Z_TYPE_PP(zdata) != IS_STRING)
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid visibility map");
+		return NULL;
+	}
+
+	w = gdex_get_lval(*zw);
+	h = gdex_get_lval(*zh);
+	depth = gdex_get_lval(*zdepth);
+	if (w < 1L || h < 1L || w > INT_MAX / h || depth < 1L
+		|| (size_t)Z_STRLEN_PP(zdata) != (size_t)(w * h) * sizeof(gint))
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid visibility map");
+		return NULL;
+	}
+	if (gdex_get_lval(*zorientation) != (long)orientation) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"The visibility map was computed for the other dimension");
+		return NULL;
+	}
+	if (w != (long)width || h != (long)height) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"The visibility map is %ldx%ld, but the image is %dx%d",
+				w, h, width, height);
+		return NULL;
+	}
+	if (depth >= ((orientation == 0) ? w : h)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"The depth of the visibility map (%ld) is too large for the image", depth);
+		return NULL;
+	}
+
+	buffer = g_try_new(gint, w * h);
+	if (buffer == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot load the visibility map");
+		return NULL;
+	}
+	memcpy(buffer, Z_STRVAL_PP(zdata), Z_STRLEN_PP(zdata));
+	for (i = 0; i < w * h; i++) {
+		if (buffer[i] < 0 || buffer[i] > (gint)depth) {
+			g_free(buffer);
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"The visibility map has an invalid level (%d)", (int)buffer[i]);
+			return NULL;
+		}
+	}
+
+	/* the map takes the ownership of the buffer */
+	map = lqr_vmap_new(buffer, (gint)w, (gint)h, (gint)depth, (gint)orientation);
+	if (map == NULL) {
+		g_free(buffer);
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot load the visibility map");
+	}
+
+	return map;
+}
+
+/* }}} */
+/* {{{ _lqrvmap_to_array() */
+
+/*
+ * Export a visibility map, the data is an array of native integers
+ */
+static void
+_lqrvmap_to_array(LqrVMap *vmap, zval *zv)
+{
+	gint w = lqr_vmap_get_width(vmap);
+	gint h = lqr_vmap_get_height(vmap);
+
+	array_init_size(zv, 5);
+	gdex_add_assoc_long(zv, "width", (long)w);
+	gdex_add_assoc_long(zv, "height", (long)h);
+	gdex_add_assoc_long(zv, "depth", (long)lqr_vmap_get_depth(vmap));
+	gdex_add_assoc_long(zv, "orientation", (long)lqr_vmap_get_orientation(vmap));
+	add_assoc_stringl_ex(zv, "data", sizeof("data"), (char *)lqr_vmap_get_data(vmap),
+			(uint)((size_t)w * (size_t)h * sizeof(gint)), 1);
+}
+
+/* }}} */
+/* {{{ _liquid_rescale() */
+
+/*
+ * Do liquid rescaling within the time budget of the given context
+ */
+static gdImagePtr
+_liquid_rescale(const gdImagePtr src, int width, int height, HashTable *options,
+                const gdex_carve_options_t *opts, lqr_context_t *context TSRMLS_DC)
 {
 	LqrCarver *carver;
 	LqrRetVal ret;
 	gdImagePtr dst;
-	gint max_step = 1;
-	gfloat rigidity = 0.0;
-	int vertical_seam = 0;
-	int save_alpha = 0;
+	double proxy_scale = 1.0;
+	void *saved_context;
+	zval **entry;
+
+	if (options != NULL && hash_find(options, "proxy_scale", &entry) == SUCCESS) {
+		proxy_scale = gdex_get_dval(*entry);
+		if (!zend_finite(proxy_scale) || proxy_scale <= 0.0 || proxy_scale > 1.0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'proxy_scale' must be greater than 0 and not greater than 1");
+			return NULL;
+		}
+	}
 
-	if (_get_lqr_options(options, &max_step, &rigidity,
-			&vertical_seam, &save_alpha TSRMLS_CC) == FAILURE)
+	/* compute the seams on a proxy when only shrinking */
+	if (proxy_scale < 1.0 && width <= gdImageSX(src) && height <= gdImageSY(src)
+		&& (width < gdImageSX(src) || height < gdImageSY(src)))
 	{
-		return NULL;
+		saved_context = GDEXG(lqr_context);
+		GDEXG(lqr_context) = context;
+		ret = _proxy_liquid_rescale(src, width, height, proxy_scale,
+				opts->max_step, opts->rigidity, opts->vertical_seam, opts->save_alpha,
+				context, &dst TSRMLS_CC);
+		GDEXG(lqr_context) = saved_context;
+		if (ret == LQR_USRCANCEL) {
+			return _lqr_cancelled(src, width, height, context TSRMLS_CC);
+		}
+		return dst;
 	}
 
-	carver = _gdimage_to_lqrcaver(src, save_alpha);
+	carver = _gdimage_to_lqrcaver(src, opts->save_alpha);
 	if (carver == NULL) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING,
 				"Cannot create the caver");
 		return NULL;
 	}
 
-	ret = lqr_carver_init(carver, max_step, rigidity);
+	/* hook the progress to check the time budget and call back */
+	if (_attach_lqr_progress(carver, context TSRMLS_CC) == FAILURE) {
+		lqr_carver_destroy(carver);
+		return NULL;
+	}
+	saved_context = GDEXG(lqr_context);
+	GDEXG(lqr_context) = context;
+
+	ret = lqr_carver_init(carver, opts->max_step, opts->rigidity);
 	if (ret != LQR_OK) {
+		GDEXG(lqr_context) = saved_context;
 		lqr_carver_destroy(carver);
 		php_error_docref(NULL TSRMLS_CC, E_WARNING,
 				"Failed to initialize the caver (%s)", _lqrerrstr(ret));
 		return NULL;
 	}
 
-	if (vertical_seam) {
+	if (opts->vertical_seam) {
 		lqr_carver_set_resize_order(carver, LQR_RES_ORDER_VERT);
 	}
 
 	ret = lqr_carver_resize(carver, width, height);
+	GDEXG(lqr_context) = saved_context;
 	if (ret != LQR_OK) {
 		lqr_carver_destroy(carver);
-		php_error_docref(NULL TSRMLS_CC, E_WARNING,
-				"Failed to resize (%s)", _lqrerrstr(ret));
-		return NULL;
+		if (ret != LQR_USRCANCEL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Failed to resize (%s)", _lqrerrstr(ret));
+			return NULL;
+		}
+		return _lqr_cancelled(src, width, height, context TSRMLS_CC);
 	}
 
 	dst = _lqrcarver_to_gdimage(carver);
@@ -304,39 +977,275 @@ gdex_liquid_rescale(const gdImagePtr src, int width, int height,
 }
 
 /* }}} */
-/* {{{ resource imagecarve(resource src, int width, int height[, array options]) */
+/* {{{ gdex_liquid_rescale() */
 
-GDEXTRA_LOCAL GDEX_FUNCTION(imagecarve)
+/*
+ *  Do liquid rescaling.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_liquid_rescale(const gdImagePtr src, int width, int height,
+                    HashTable *options TSRMLS_DC)
 {
-	zval *zsrc;
-	gdImagePtr src, dst;
-	long width, height;
-	zval *zoptions = NULL;
-	HashTable *options = NULL;
+	gdex_carve_options_t opts;
+	lqr_context_t context;
+
+	if (gdex_get_carve_options(options, &opts TSRMLS_CC) == FAILURE
+		|| _get_lqr_progress_options(options, &opts, &context TSRMLS_CC) == FAILURE)
+	{
+		return NULL;
+	}
+
+	return _liquid_rescale(src, width, height, options, &opts, &context TSRMLS_CC);
+}
+
+/* }}} */
+/* {{{ array imagecarvemulti(resource src, array sizes[, array options[, array &vmap]]) */
+
+/*
+ * Create carved copies of the image in several sizes
+ * The sizes that change the same dimension share one carver, so the
+ * seams are computed once, down to the smallest of them, and the other
+ * sizes are read out of the visibility map. The map can be exported to
+ * vmap and given back as 'vmap' option to skip the computation.
+ * 'timeout_ms' is the time budget for all the sizes. Once it has run out,
+ * each size which still needs carving times out on its own, while the
+ * sizes equal to the image are copied as they are.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecarvemulti)
+{
+	zval *zsrc, *zsizes, *zoptions = NULL, *zvmap = NULL;
+	zval **entry;
+	HashTable *sizes, *options = NULL;
+	HashPosition pos;
+	gdImagePtr src;
+	gdImagePtr *images = NULL;
+	int *widths = NULL, *heights = NULL;
+	zend_bool *shared = NULL;
+	size_t num, num_width = 0, num_height = 0, i;
+	int src_w, src_h, orientation, target = 0;
+	LqrCarver *carver = NULL;
+	LqrVMap *vmap = NULL;
+	LqrRetVal ret = LQR_OK;
+	gdex_carve_options_t opts;
+	lqr_context_t context;
+	void *saved_context;
 
 	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rll|a!",
-			&zsrc, &width, &height, &zoptions) == FAILURE)
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ra|a!z",
+			&zsrc, &zsizes, &zoptions, &zvmap) == FAILURE)
 	{
 		return;
 	}
 	ZEND_FETCH_RESOURCE(src, gdImagePtr, &zsrc, -1, "Image", GDEXG(le_gd));
-
-	if (width < 1L || height < 1L || width > INT_MAX || height > INT_MAX) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid image dimensions");
-		RETURN_FALSE;
+	if (zvmap != NULL) {
+		zval_dtor(zvmap);
+		ZVAL_NULL(zvmap);
 	}
 
-	if (zoptions != NULL && Z_TYPE_P(zoptions) == IS_ARRAY) {
+	if (zoptions != NULL) {
 		options = Z_ARRVAL_P(zoptions);
 	}
+	if (gdex_get_carve_options(options, &opts TSRMLS_CC) == FAILURE
+		|| _get_lqr_progress_options(options, &opts, &context TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
 
-	/* resize the image */
-	dst = gdex_liquid_rescale(src, (int)width, (int)height, options TSRMLS_CC);
-	if (dst == NULL) {
+	sizes = Z_ARRVAL_P(zsizes);
+	num = (size_t)zend_hash_num_elements(sizes);
+	if (num == 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "No sizes given");
 		RETURN_FALSE;
 	}
-	ZEND_REGISTER_RESOURCE(return_value, dst, GDEXG(le_gd));
+
+	/* get the sizes */
+	src_w = gdImageSX(src);
+	src_h = gdImageSY(src);
+	widths = (int *)safe_emalloc(num, sizeof(int), 0);
+	heights = (int *)safe_emalloc(num, sizeof(int), 0);
+	shared = (zend_bool *)ecalloc(num, sizeof(zend_bool));
+	images = (gdImagePtr *)ecalloc(num, sizeof(gdImagePtr));
+	i = 0;
+	zend_hash_internal_pointer_reset_ex(sizes, &pos);
+	while (zend_hash_get_current_data_ex(sizes, (void **)&entry, &pos) == SUCCESS) {
+		if (_get_carve_size(*entry, &widths[i], &heights[i] TSRMLS_CC) == FAILURE) {
+			goto error_return_false;
+		}
+		if (heights[i] == src_h && widths[i] <= src_w) {
+			num_width++;
+		}
+		if (widths[i] == src_w && heights[i] <= src_h) {
+			num_height++;
+		}
+		zend_hash_move_forward_ex(sizes, &pos);
+		i++;
+	}
+
+	/* share a carver among the sizes that shrink the major dimension */
+	orientation = (num_height > num_width
+			|| (num_height == num_width && opts.vertical_seam)) ? 1 : 0;
+	for (i = 0; i < num; i++) {
+		if (orientation == 0 && heights[i] == src_h && widths[i] <= src_w) {
+			shared[i] = 1;
+			if (target == 0 || widths[i] < target) {
+				target = widths[i];
+			}
+		} else if (orientation == 1 && widths[i] == src_w && heights[i] <= src_h) {
+			shared[i] = 1;
+			if (target == 0 || heights[i] < target) {
+				target = heights[i];
+			}
+		}
+	}
+
+	if (target > 0) {
+		carver = _gdimage_to_lqrcaver(src, opts.save_alpha);
+		if (carver == NULL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Cannot create the caver");
+			goto error_return_false;
+		}
+		if (_attach_lqr_progress(carver, &context TSRMLS_CC) == FAILURE) {
+			goto error_return_false;
+		}
+
+		/* load the visibility map, or initialize the carver */
+		if (options != NULL && hash_find(options, "vmap", &entry) == SUCCESS
+			&& Z_TYPE_PP(entry) == IS_ARRAY)
+		{
+			vmap = _array_to_lqrvmap(Z_ARRVAL_PP(entry), src_w, src_h, orientation TSRMLS_CC);
+			if (vmap == NULL) {
+				goto error_return_false;
+			}
+			ret = lqr_vmap_load(carver, vmap);
+			lqr_vmap_destroy(vmap);
+			vmap = NULL;
+		} else {
+			ret = lqr_carver_init(carver, opts.max_step, opts.rigidity);
+		}
+		if (ret != LQR_OK) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Failed to initialize the caver (%s)", _lqrerrstr(ret));
+			goto error_return_false;
+		}
+
+		/* change the shared dimension last, so that the map is not flattened */
+		lqr_carver_set_resize_order(carver,
+				(orientation == 0) ? LQR_RES_ORDER_VERT : LQR_RES_ORDER_HOR);
+
+		/* compute the seams down to the smallest size */
+		saved_context = GDEXG(lqr_context);
+		GDEXG(lqr_context) = &context;
+		if (orientation == 0) {
+			ret = lqr_carver_resize(carver, target, src_h);
+		} else {
+			ret = lqr_carver_resize(carver, src_w, target);
+		}
+		GDEXG(lqr_context) = saved_context;
+
+		if (ret == LQR_OK) {
+			if (zvmap != NULL) {
+				vmap = lqr_vmap_dump(carver);
+				if (vmap != NULL) {
+					_lqrvmap_to_array(vmap, zvmap);
+					lqr_vmap_destroy(vmap);
+					vmap = NULL;
+				}
+			}
+		} else if (ret == LQR_USRCANCEL && context.timed_out && context.fallback) {
+			lqr_carver_destroy(carver);
+			carver = NULL;
+		} else {
+			if (ret != LQR_USRCANCEL) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"Failed to resize (%s)", _lqrerrstr(ret));
+			} else if (context.timed_out) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"Liquid rescaling timed out (%ld ms)", context.timeout_ms);
+			}
+			goto error_return_false;
+		}
+	}
+
+	/* read out each size */
+	for (i = 0; i < num; i++) {
+		if (widths[i] == src_w && heights[i] == src_h) {
+			images[i] = _truecolor_copy(src, 0);
+			if (images[i] != NULL && !opts.save_alpha) {
+				int x, y;
+				for (y = 0; y < src_h; y++) {
+					for (x = 0; x < src_w; x++) {
+						images[i]->tpixels[y][x] &= 0xffffff;
+					}
+				}
+			}
+		} else if (!shared[i]) {
+			context.timed_out = 0;
+			images[i] = _liquid_rescale(src, widths[i], heights[i],
+					options, &opts, &context TSRMLS_CC);
+		} else if (carver == NULL) {
+			images[i] = gdex_carve_fallback(src, widths[i], heights[i]);
+		} else {
+			ret = lqr_carver_resize(carver, widths[i], heights[i]);
+			if (ret != LQR_OK) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"Failed to resize (%s)", _lqrerrstr(ret));
+				goto error_return_false;
+			}
+			images[i] = _lqrcarver_to_gdimage(carver);
+		}
+		if (images[i] == NULL) {
+			goto error_return_false;
+		}
+	}
+
+	/* return the images with the same keys as the sizes */
+	array_init_size(return_value, (uint)num);
+	i = 0;
+	zend_hash_internal_pointer_reset_ex(sizes, &pos);
+	while (i < num) {
+		zval *zim;
+		char *key = NULL;
+		uint key_len = 0;
+		ulong index = 0;
+
+		MAKE_STD_ZVAL(zim);
+		ZEND_REGISTER_RESOURCE(zim, images[i], GDEXG(le_gd));
+		if (zend_hash_get_current_key_ex(sizes, &key, &key_len, &index, 0, &pos)
+				== HASH_KEY_IS_STRING)
+		{
+			add_assoc_zval_ex(return_value, key, key_len, zim);
+		} else {
+			add_index_zval(return_value, index, zim);
+		}
+		zend_hash_move_forward_ex(sizes, &pos);
+		i++;
+	}
+
+	if (carver != NULL) {
+		lqr_carver_destroy(carver);
+	}
+	efree(widths);
+	efree(heights);
+	efree(shared);
+	efree(images);
+	return;
+
+	/* on failure... */
+  error_return_false:
+	if (carver != NULL) {
+		lqr_carver_destroy(carver);
+	}
+	for (i = 0; i < num; i++) {
+		if (images[i] != NULL) {
+			gdImageDestroy(images[i]);
+		}
+	}
+	efree(widths);
+	efree(heights);
+	efree(shared);
+	efree(images);
+	RETURN_FALSE;
 }
 
 /* }}} */
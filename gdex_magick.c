@@ -1,5 +1,5 @@
 /*
- * Extra image functions: ImageMagick image loader functions
+ * Extra image functions: ImageMagick image loader and writer functions
  *
  * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
  *
@@ -32,14 +32,93 @@
 
 ZEND_EXTERN_MODULE_GLOBALS(gdextra);
 
+static int _magick_instantiated = 0;
+
+/* {{{ formats detected by the magic bytes */
+
+enum {
+	FORMAT_UNKNOWN = 0,
+	FORMAT_JPEG,
+	FORMAT_PNG,
+	FORMAT_GIF,
+	FORMAT_WEBP,
+	FORMAT_BMP,
+	FORMAT_ICO,
+	FORMAT_QOI
+};
+
+/*
+ * PHP 5's imagecreatefromstring() does not know WebP,
+ * so only libgd 2.1 or later can decode it natively.
+ */
+#if !GDEXTRA_USE_WRAPPERS && defined(GD_MAJOR_VERSION) && defined(GD_MINOR_VERSION) \
+	&& (GD_MAJOR_VERSION > 2 || (GD_MAJOR_VERSION == 2 && GD_MINOR_VERSION >= 1))
+#define GDEX_HAVE_WEBP_DECODER 1
+#else
+#define GDEX_HAVE_WEBP_DECODER 0
+#endif
+
+/* }}} */
+/* {{{ type definitions */
+
+/*
+ * A range of the frames to return, from 'first' to 'last' in this order
+ */
+typedef struct {
+	long first;
+	long last;
+} magick_frames_t;
+
+/* }}} */
+/* {{{ compression types for the writer */
+
+static const struct {
+	const char *name;
+	CompressionType type;
+} _compression_types[] = {
+	{ "none",     NoCompression },
+	{ "rle",      RLECompression },
+	{ "lzw",      LZWCompression },
+	{ "zip",      ZipCompression },
+	{ "jpeg",     JPEGCompression },
+	{ "jpeg2000", JPEG2000Compression },
+	{ "lossless", LosslessJPEGCompression },
+	{ "group4",   Group4Compression },
+	{ NULL,       UndefinedCompression }
+};
+
+/* }}} */
 /* {{{ private function prototypes */
 
 static int
-_pixelwand_to_gdtruecolor(const PixelWand *pixel);
+_get_magick_size_limits(HashTable *options, unsigned long *max_width,
+                        unsigned long *max_height TSRMLS_DC);
+
+static magick_frames_t *
+_get_magick_frames(zval *zframes, int *num_ranges, long *max_index TSRMLS_DC);
+
+static MagickWand *
+_magickwand_coalesce(MagickWand *wand);
+
+static MagickBooleanType
+_magickwand_fit(MagickWand *wand, unsigned long max_width, unsigned long max_height);
+
+static gdImagePtr
+_magickwand_to_gdimage(MagickWand *wand, const char **errmsg);
 
 static void
 _magickwand_error(MagickWand *wand, int errcode, const char *errmsg TSRMLS_DC);
 
+static int
+_sniff_format(const unsigned char *data, size_t size);
+
+static int
+_get_magick_write_options(HashTable *options, long *quality,
+                          CompressionType *compression TSRMLS_DC);
+
+static unsigned char *
+_gdimage_to_pixels(const gdImagePtr im, zend_bool has_alpha);
+
 /* }}} */
 /* {{{ gdex_get_magick_version() */
 
@@ -54,31 +133,352 @@ gdex_get_magick_version(void)
 }
 
 /* }}} */
-/* {{{ _pixelwand_to_gdtruecolor() */
+/* {{{ gdex_magick_startup() */
 
 /*
- * Convert from PixelWand to gdTrueColorAlpha value
+ * Initialize ImageMagick and apply the resource limits, 0 means the default
+ */
+GDEXTRA_LOCAL void
+gdex_magick_startup(TSRMLS_D)
+{
+	if (IsMagickWandInstantiated() == MagickFalse) {
+		MagickWandGenesis();
+		_magick_instantiated = 1;
+	}
+
+	if (GDEXG(magick_threads) > 0L) {
+		(void)MagickSetResourceLimit(ThreadResource, (MagickSizeType)GDEXG(magick_threads));
+	}
+	if (GDEXG(magick_memory_limit) > 0L) {
+		(void)MagickSetResourceLimit(MemoryResource, (MagickSizeType)GDEXG(magick_memory_limit));
+	}
+	if (GDEXG(magick_map_limit) > 0L) {
+		(void)MagickSetResourceLimit(MapResource, (MagickSizeType)GDEXG(magick_map_limit));
+	}
+	if (GDEXG(magick_disk_limit) > 0L) {
+		(void)MagickSetResourceLimit(DiskResource, (MagickSizeType)GDEXG(magick_disk_limit));
+	}
+}
+
+/* }}} */
+/* {{{ gdex_magick_shutdown() */
+
+/*
+ * Terminate ImageMagick if it was initialized by this extension
+ */
+GDEXTRA_LOCAL void
+gdex_magick_shutdown(void)
+{
+	if (_magick_instantiated) {
+		MagickWandTerminus();
+		_magick_instantiated = 0;
+	}
+}
+
+/* }}} */
+/* {{{ gdex_magick_info() */
+
+/*
+ * Print the resource limits in effect
+ */
+GDEXTRA_LOCAL void
+gdex_magick_info(void)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%" MagickSizeFormat, MagickGetResourceLimit(ThreadResource));
+	php_info_print_table_row(2, "ImageMagick Threads", buf);
+	snprintf(buf, sizeof(buf), "%" MagickSizeFormat, MagickGetResourceLimit(MemoryResource));
+	php_info_print_table_row(2, "ImageMagick Memory Limit", buf);
+	snprintf(buf, sizeof(buf), "%" MagickSizeFormat, MagickGetResourceLimit(MapResource));
+	php_info_print_table_row(2, "ImageMagick Map Limit", buf);
+	snprintf(buf, sizeof(buf), "%" MagickSizeFormat, MagickGetResourceLimit(DiskResource));
+	php_info_print_table_row(2, "ImageMagick Disk Limit", buf);
+}
+
+/* }}} */
+/* {{{ _get_magick_size_limits() */
+
+/*
+ * Get 'max_width' and 'max_height' options, 0 means no limit
  */
 static int
-_pixelwand_to_gdtruecolor(const PixelWand *pixel)
+_get_magick_size_limits(HashTable *options, unsigned long *max_width,
+                        unsigned long *max_height TSRMLS_DC)
+{
+	zval **entry;
+	long value;
+
+	*max_width = *max_height = 0UL;
+	if (options == NULL) {
+		return SUCCESS;
+	}
+
+	if (hash_find(options, "max_width", &entry) == SUCCESS) {
+		value = gdex_get_lval(*entry);
+		if (value < 0L || value >= (long)INT_MAX) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid max_width (%ld)", value);
+			return FAILURE;
+		}
+		*max_width = (unsigned long)value;
+	}
+	if (hash_find(options, "max_height", &entry) == SUCCESS) {
+		value = gdex_get_lval(*entry);
+		if (value < 0L || value >= (long)INT_MAX) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid max_height (%ld)", value);
+			return FAILURE;
+		}
+		*max_height = (unsigned long)value;
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _get_magick_frames() */
+
+/*
+ * Convert 'frames' option to the ranges of the frames to return
+ * A string is a comma separated list of indices and ranges (e.g. "0,3-5"),
+ * and "all" selects every frame. Returns NULL with num_ranges 0 for all
+ * the frames, and NULL with num_ranges -1 on failure.
+ */
+static magick_frames_t *
+_get_magick_frames(zval *zframes, int *num_ranges, long *max_index TSRMLS_DC)
 {
-	int r, g, b, a;
+	magick_frames_t *ranges;
+	int n = 0;
 
-	/*if (pixel == NULL || IsPixelWand(pixel) == MagickFalse) {
-		return gdTrueColorAlpha(gdRedMax, gdGreenMax, gdBlueMax, gdAlphaOpaque);
-	}*/
+	*num_ranges = -1;
+	*max_index = 0L;
 
-	r = (int)(255.5 * PixelGetRed(pixel));
-	g = (int)(255.5 * PixelGetGreen(pixel));
-	b = (int)(255.5 * PixelGetBlue(pixel));
-	a = (int)(127.5 * (1.0 - PixelGetAlpha(pixel)));
+	switch (Z_TYPE_P(zframes)) {
+		case IS_STRING: {
+			const char *p = Z_STRVAL_P(zframes);
+			size_t len = (size_t)Z_STRLEN_P(zframes);
 
-	r = MINMAX(r, 0, gdRedMax);
-	g = MINMAX(g, 0, gdGreenMax);
-	b = MINMAX(b, 0, gdBlueMax);
-	a = MINMAX(a, 0, gdAlphaMax);
+			if (strcmp(p, "all") == 0) {
+				*num_ranges = 0;
+				return NULL;
+			}
+			if (len == 0 || strspn(p, "0123456789,-") != len) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid frames '%s'", p);
+				return NULL;
+			}
+			ranges = (magick_frames_t *)safe_emalloc(len / 2 + 1, sizeof(magick_frames_t), 0);
+			while (1) {
+				char *end;
 
-	return gdTrueColorAlpha(r, g, b, a);
+				if (*p < '0' || *p > '9') {
+					break;
+				}
+				ranges[n].first = strtol(p, &end, 10);
+				ranges[n].last = ranges[n].first;
+				p = end;
+				if (*p == '-') {
+					p++;
+					if (*p < '0' || *p > '9') {
+						break;
+					}
+					ranges[n].last = strtol(p, &end, 10);
+					p = end;
+				}
+				if (ranges[n].first < 0L || ranges[n].first >= (long)INT_MAX
+					|| ranges[n].last < 0L || ranges[n].last >= (long)INT_MAX)
+				{
+					break;
+				}
+				*max_index = MAX(*max_index, MAX(ranges[n].first, ranges[n].last));
+				n++;
+				if (*p == '\0') {
+					*num_ranges = n;
+					return ranges;
+				}
+				if (*p++ != ',') {
+					break;
+				}
+			}
+			efree(ranges);
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Invalid frames '%s'", Z_STRVAL_P(zframes));
+			return NULL;
+		}
+
+		case IS_ARRAY: {
+			HashTable *frames = Z_ARRVAL_P(zframes);
+			HashPosition pos;
+			zval **entry;
+			long index;
+
+			if (zend_hash_num_elements(frames) == 0) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "No frames given");
+				return NULL;
+			}
+			ranges = (magick_frames_t *)safe_emalloc(zend_hash_num_elements(frames),
+					sizeof(magick_frames_t), 0);
+			zend_hash_internal_pointer_reset_ex(frames, &pos);
+			while (zend_hash_get_current_data_ex(frames, (void **)&entry, &pos) == SUCCESS) {
+				index = gdex_get_lval(*entry);
+				if (index < 0L || index >= (long)INT_MAX) {
+					php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid frame index (%ld)", index);
+					efree(ranges);
+					return NULL;
+				}
+				ranges[n].first = ranges[n].last = index;
+				*max_index = MAX(*max_index, index);
+				n++;
+				zend_hash_move_forward_ex(frames, &pos);
+			}
+			*num_ranges = n;
+			return ranges;
+		}
+
+		default: {
+			long index = gdex_get_lval(zframes);
+
+			if (index < 0L || index >= (long)INT_MAX) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid frame index (%ld)", index);
+				return NULL;
+			}
+			ranges = (magick_frames_t *)emalloc(sizeof(magick_frames_t));
+			ranges[0].first = ranges[0].last = index;
+			*max_index = index;
+			*num_ranges = 1;
+			return ranges;
+		}
+	}
+}
+
+/* }}} */
+/* {{{ _magickwand_coalesce() */
+
+/*
+ * Compose the frames which cover only a part of the page onto the canvas
+ * Optimized animations store most frames as sub-rectangles with offsets.
+ * Returns the given wand when no frame needs it, the coalesced wand in
+ * place of the given one, or NULL on failure.
+ */
+static MagickWand *
+_magickwand_coalesce(MagickWand *wand)
+{
+	MagickWand *coalesced;
+	size_t num_frames, i, width, height;
+	ssize_t x, y;
+	int needed = 0;
+
+	num_frames = MagickGetNumberImages(wand);
+	for (i = 0; i < num_frames && !needed; i++) {
+		(void)MagickSetIteratorIndex(wand, (long)i);
+		if (MagickGetImagePage(wand, &width, &height, &x, &y) == MagickFalse) {
+			continue;
+		}
+		if (x != 0 || y != 0
+			|| (width != 0 && width != MagickGetImageWidth(wand))
+			|| (height != 0 && height != MagickGetImageHeight(wand)))
+		{
+			needed = 1;
+		}
+	}
+	if (!needed) {
+		return wand;
+	}
+
+	coalesced = MagickCoalesceImages(wand);
+	if (coalesced == NULL) {
+		return NULL;
+	}
+	(void)DestroyMagickWand(wand);
+
+	return coalesced;
+}
+
+/* }}} */
+/* {{{ _magickwand_fit() */
+
+/*
+ * Shrink the current image to fit within the limits, keeping the aspect ratio
+ */
+static MagickBooleanType
+_magickwand_fit(MagickWand *wand, unsigned long max_width, unsigned long max_height)
+{
+	unsigned long width, height, new_width, new_height;
+	double ratio = 1.0;
+
+	width = MagickGetImageWidth(wand);
+	height = MagickGetImageHeight(wand);
+	if (width == 0UL || height == 0UL) {
+		return MagickTrue;
+	}
+
+	if (max_width > 0UL && width > max_width) {
+		ratio = (double)max_width / (double)width;
+	}
+	if (max_height > 0UL && (double)height * ratio > (double)max_height) {
+		ratio = (double)max_height / (double)height;
+	}
+	if (ratio >= 1.0) {
+		return MagickTrue;
+	}
+
+	new_width = (unsigned long)((double)width * ratio + 0.5);
+	new_height = (unsigned long)((double)height * ratio + 0.5);
+
+	return MagickResizeImage(wand, MAX(new_width, 1UL), MAX(new_height, 1UL),
+			LanczosFilter, 1.0);
+}
+
+/* }}} */
+/* {{{ _magickwand_to_gdimage() */
+
+/*
+ * Create a true color image from the current image
+ * The pixels are exported a row at a time as 8-bit RGBA.
+ */
+static gdImagePtr
+_magickwand_to_gdimage(MagickWand *wand, const char **errmsg)
+{
+	gdImagePtr im;
+	unsigned char *row, *p;
+	unsigned long width, height, y;
+	int x;
+
+	/* get the image size */
+	width = MagickGetImageWidth(wand);
+	height = MagickGetImageHeight(wand);
+	if (width == 0UL || width >= (unsigned long)INT_MAX ||
+		height == 0UL || height >= (unsigned long)INT_MAX)
+	{
+		*errmsg = "Invalid image dimensions";
+		return NULL;
+	}
+
+	/* initialize gdImage */
+	im = gdImageCreateTrueColor((int)width, (int)height);
+	if (im == NULL) {
+		*errmsg = "Cannot create a new image";
+		return NULL;
+	}
+
+	/* set each pixels */
+	row = (unsigned char *)safe_emalloc((size_t)width, 4, 0);
+	for (y = 0; y < height; y++) {
+		int *dst = im->tpixels[y];
+
+		if (MagickExportImagePixels(wand, 0, (long)y, width, 1UL,
+				"RGBA", CharPixel, row) == MagickFalse)
+		{
+			efree(row);
+			gdImageDestroy(im);
+			*errmsg = "Failed to export the pixels";
+			return NULL;
+		}
+		for (x = 0, p = row; x < (int)width; x++, p += 4) {
+			dst[x] = gdTrueColorAlpha(p[0], p[1], p[2], _gray2alpha(p[3]));
+		}
+	}
+	efree(row);
+
+	return im;
 }
 
 /* }}} */
@@ -111,91 +511,310 @@ _magickwand_error(MagickWand *wand, int errcode, const char *errmsg TSRMLS_DC)
 }
 
 /* }}} */
-/* {{{ resource imagecreatebymagick(string filename[, is_blob]) */
+/* {{{ _sniff_format() */
+
+/*
+ * Detect the image format from the magic bytes
+ */
+static int
+_sniff_format(const unsigned char *data, size_t size)
+{
+	if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) {
+		return FORMAT_JPEG;
+	}
+	if (size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0) {
+		return FORMAT_PNG;
+	}
+	if (size >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0)) {
+		return FORMAT_GIF;
+	}
+	if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) {
+		return FORMAT_WEBP;
+	}
+	if (size >= 14 && data[0] == 'B' && data[1] == 'M') {
+		return FORMAT_BMP;
+	}
+	if (size >= 6 && data[0] == 0 && data[1] == 0
+		&& (data[2] == 1 || data[2] == 2) && data[3] == 0)
+	{
+		return FORMAT_ICO;
+	}
+	if (size >= 14 && memcmp(data, "qoif", 4) == 0) {
+		return FORMAT_QOI;
+	}
+	return FORMAT_UNKNOWN;
+}
+
+/* }}} */
+/* {{{ _get_magick_write_options() */
+
+/*
+ * Get 'quality' and 'compression' options for the writer
+ */
+static int
+_get_magick_write_options(HashTable *options, long *quality,
+                          CompressionType *compression TSRMLS_DC)
+{
+	zval **entry;
+	int i;
+
+	*quality = -1L;
+	*compression = UndefinedCompression;
+	if (options == NULL) {
+		return SUCCESS;
+	}
+
+	if (hash_find(options, "quality", &entry) == SUCCESS) {
+		*quality = gdex_get_lval(*entry);
+		if (*quality < 0L || *quality > 100L) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid quality (%ld)", *quality);
+			return FAILURE;
+		}
+	}
+	if (hash_find(options, "compression", &entry) == SUCCESS) {
+		if (Z_TYPE_PP(entry) != IS_STRING) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Compression must be a string");
+			return FAILURE;
+		}
+		for (i = 0; _compression_types[i].name != NULL; i++) {
+			if (strcmp(Z_STRVAL_PP(entry), _compression_types[i].name) == 0) {
+				*compression = _compression_types[i].type;
+				break;
+			}
+		}
+		if (_compression_types[i].name == NULL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Unsupported compression '%s'", Z_STRVAL_PP(entry));
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _gdimage_to_pixels() */
+
+/*
+ * Copy the pixels to a packed 8-bit RGB or RGBA buffer
+ */
+static unsigned char *
+_gdimage_to_pixels(const gdImagePtr im, zend_bool has_alpha)
+{
+	unsigned char *pixels, *p;
+	int x, y, c;
+	int width = gdImageSX(im);
+	int height = gdImageSY(im);
+
+	pixels = (unsigned char *)safe_emalloc((size_t)width * (has_alpha ? 4 : 3), (size_t)height, 0);
+	p = pixels;
+
+	if (gdImageTrueColor(im)) {
+		for (y = 0; y < height; y++) {
+			const int *src = im->tpixels[y];
+			for (x = 0; x < width; x++) {
+				c = src[x];
+				*p++ = (unsigned char)gdTrueColorGetRed(c);
+				*p++ = (unsigned char)gdTrueColorGetGreen(c);
+				*p++ = (unsigned char)gdTrueColorGetBlue(c);
+				if (has_alpha) {
+					*p++ = (unsigned char)_alpha2gray(gdTrueColorGetAlpha(c));
+				}
+			}
+		}
+	} else {
+		for (y = 0; y < height; y++) {
+			const unsigned char *src = im->pixels[y];
+			for (x = 0; x < width; x++) {
+				c = src[x];
+				*p++ = (unsigned char)im->red[c];
+				*p++ = (unsigned char)im->green[c];
+				*p++ = (unsigned char)im->blue[c];
+				if (has_alpha) {
+					*p++ = (c == im->transparent) ? 0 : (unsigned char)_alpha2gray(im->alpha[c]);
+				}
+			}
+		}
+	}
+
+	return pixels;
+}
+
+/* }}} */
+/* {{{ mixed imagecreatebymagick(string filename[, bool is_blob[, array options]]) */
 
 /*
  * Create a new image from a file, an URI or an image data
+ * With 'max_width' and/or 'max_height', JPEG images are decoded at a
+ * reduced scale (jpeg:size hint) and then shrunk to fit.
+ * With 'frames', an array of images is returned for the selected frames.
  */
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatebymagick)
 {
 	char *input = NULL;
 	int input_len = 0;
 	const char *errmsg = NULL;
-	php_stream *stream = NULL;
 	gdImagePtr im = NULL;
 	zend_bool is_blob = 0;
+	zval *zoptions = NULL;
 	MagickWand *wand = NULL;
-	PixelWand *pixel = NULL;
 	MagickBooleanType status;
-	unsigned long width, height, x, y;
+	unsigned long max_width = 0UL, max_height = 0UL;
+	unsigned long num_frames;
+	zval **entry;
+	zend_bool multi = 0;
+	magick_frames_t *ranges = NULL;
+	int num_ranges = 0, i;
+	long max_index = 0L;
+	char scenes[64];
 
 	/* parse the arguments */
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|b",
-			&input, &input_len, &is_blob) == FAILURE)
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|ba!",
+			&input, &input_len, &is_blob, &zoptions) == FAILURE)
 	{
 		return;
 	}
+	if (_get_magick_size_limits((zoptions != NULL) ? Z_ARRVAL_P(zoptions) : NULL,
+			&max_width, &max_height TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
+	if (zoptions != NULL && hash_find(Z_ARRVAL_P(zoptions), "frames", &entry) == SUCCESS) {
+		ranges = _get_magick_frames(*entry, &num_ranges, &max_index TSRMLS_CC);
+		if (ranges == NULL && num_ranges < 0) {
+			RETURN_FALSE;
+		}
+		multi = 1;
+	}
+
+	/* the frames before the selected ones are needed to coalesce them */
+	if (!multi) {
+		strcpy(scenes, "[0]");
+	} else if (ranges != NULL) {
+		snprintf(scenes, sizeof(scenes), "[0-%ld]", max_index);
+	} else {
+		*scenes = '\0';
+	}
 
 	/* initialize MagickWand */
 	wand = NewMagickWand();
 
+	/* decode only the selected frames */
+	if (*scenes != '\0') {
+		(void)MagickSetFilename(wand, scenes);
+	}
+
+	/* let libjpeg scale down in the DCT domain, not below the limits */
+	if (max_width > 0UL || max_height > 0UL) {
+		char hint[64];
+
+		snprintf(hint, sizeof(hint), "%lux%lu",
+				(max_width > 0UL) ? max_width : max_height,
+				(max_height > 0UL) ? max_height : max_width);
+		(void)MagickSetOption(wand, "jpeg:size", hint);
+	}
+
 	/* read the image */
 	if (is_blob) {
 		status = MagickReadImageBlob(wand, (const void *)input, (const size_t)input_len);
 	} else {
-		FILE *fp;
-		stream = php_stream_open_wrapper(input, "rb",
-				ENFORCE_SAFE_MODE | REPORT_ERRORS | STREAM_WILL_CAST, NULL);
-		if (stream == NULL) {
-			(void)DestroyMagickWand(wand);
-			RETURN_FALSE;
-		}
-		if (FAILURE == php_stream_cast(stream, PHP_STREAM_AS_STDIO, (void **)&fp, REPORT_ERRORS)) {
-			php_stream_close(stream);
+		gdex_input_t file;
+
+		/* plain files are mapped, other streams are read into a buffer */
+		if (gdex_input_open(&file, input TSRMLS_CC) == FAILURE) {
 			(void)DestroyMagickWand(wand);
 			RETURN_FALSE;
 		}
-		status = MagickReadImageFile(wand, fp);
+		status = MagickReadImageBlob(wand, (const void *)file.data, file.size);
+		/* the decoded image does not refer to the input */
+		gdex_input_close(&file TSRMLS_CC);
 	}
 	if (status == MagickFalse) {
 		goto error_return_false;
 	}
 
-	/* get the image size */
-	width = MagickGetImageWidth(wand);
-	height = MagickGetImageHeight(wand);
-	if (width == 0UL || width >= (unsigned long)INT_MAX ||
-		height == 0UL || height >= (unsigned long)INT_MAX)
-	{
-		errmsg = "Invalid image dimensions";
+	num_frames = (unsigned long)MagickGetNumberImages(wand);
+	if (num_frames == 0UL) {
+		errmsg = "No frames were read";
 		goto error_return_false;
 	}
 
-	/* initialize gdImage */
-	im = gdImageCreateTrueColor((int)width, (int)height);
-	if (im == NULL) {
-		errmsg = "Cannot create a new image";
-		goto error_return_false;
+	/* compose the optimized frames onto the full canvas */
+	{
+		MagickWand *coalesced = _magickwand_coalesce(wand);
+		if (coalesced == NULL) {
+			goto error_return_false;
+		}
+		wand = coalesced;
 	}
 
-	/* set each pixels */
-	pixel = NewPixelWand();
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			(void)MagickGetImagePixelColor(wand, x, y, pixel);
-			unsafeSetTrueColorPixel(im, x, y, _pixelwand_to_gdtruecolor(pixel));
+	/* convert the first frame to gdImage */
+	if (!multi) {
+		(void)MagickSetIteratorIndex(wand, 0L);
+		if ((max_width > 0UL || max_height > 0UL)
+			&& _magickwand_fit(wand, max_width, max_height) == MagickFalse)
+		{
+			goto error_return_false;
+		}
+		im = _magickwand_to_gdimage(wand, &errmsg);
+		if (im == NULL) {
+			goto error_return_false;
+		}
+		(void)DestroyMagickWand(wand);
+		ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+		return;
+	}
+
+	/* convert each frame to gdImage, in the requested order */
+	array_init(return_value);
+	for (i = 0; i < ((ranges != NULL) ? num_ranges : 1); i++) {
+		long first = 0L, last = (long)num_frames - 1L, index, step;
+
+		if (ranges != NULL) {
+			first = ranges[i].first;
+			last = ranges[i].last;
+			if (MAX(first, last) >= (long)num_frames) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"Frame index (%ld) out of range, the image has %lu frames",
+						MAX(first, last), num_frames);
+				first = MIN(first, (long)num_frames - 1L);
+				last = MIN(last, (long)num_frames - 1L);
+				if (ranges[i].first >= (long)num_frames
+					&& ranges[i].last >= (long)num_frames)
+				{
+					continue;
+				}
+			}
+		}
+		step = (first <= last) ? 1L : -1L;
+
+		for (index = first; index != last + step; index += step) {
+			zval *zim;
+
+			(void)MagickSetIteratorIndex(wand, index);
+			if ((max_width > 0UL || max_height > 0UL)
+				&& _magickwand_fit(wand, max_width, max_height) == MagickFalse)
+			{
+				zval_dtor(return_value);
+				goto error_return_false;
+			}
+			im = _magickwand_to_gdimage(wand, &errmsg);
+			if (im == NULL) {
+				zval_dtor(return_value);
+				goto error_return_false;
+			}
+			MAKE_STD_ZVAL(zim);
+			ZEND_REGISTER_RESOURCE(zim, im, GDEXG(le_gd));
+			add_next_index_zval(return_value, zim);
+			im = NULL;
 		}
 	}
-	(void)DestroyPixelWand(pixel);
 
 	/* cleanup */
-	if (stream != NULL) {
-		php_stream_close(stream);
+	if (ranges != NULL) {
+		efree(ranges);
 	}
 	(void)DestroyMagickWand(wand);
-
-	/* return a new image resource */
-	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
 	return;
 
 	/* on failure... */
@@ -204,13 +823,210 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatebymagick)
 	if (im != NULL) {
 		gdImageDestroy(im);
 	}
-	if (stream != NULL) {
-		php_stream_close(stream);
+	if (ranges != NULL) {
+		efree(ranges);
+	}
+	(void)DestroyMagickWand(wand);
+	RETURN_FALSE;
+}
+
+/* }}} */
+/* {{{ bool imagewritebymagick(resource im, string filename, string format[, array options]) */
+
+/*
+ * Output an image in any format that ImageMagick can write
+ * The pixels are imported at once, and the encoded data is written to
+ * either the browser or a file.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagewritebymagick)
+{
+	zval *zim = NULL, *zoptions = NULL;
+	gdImagePtr im = NULL;
+	char *filename = NULL, *format = NULL;
+	int filename_len = 0, format_len = 0;
+	const char *errmsg = NULL;
+	long quality;
+	CompressionType compression;
+	zend_bool has_alpha, success;
+	unsigned char *pixels, *blob = NULL;
+	size_t blob_size = 0;
+	MagickWand *wand;
+	PixelWand *background;
+	MagickBooleanType status;
+	gdex_output_t output;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rs!s|a!",
+			&zim, &filename, &filename_len, &format, &format_len, &zoptions) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+	if (format_len == 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Empty format given");
+		RETURN_FALSE;
+	}
+	if (_get_magick_write_options((zoptions != NULL) ? Z_ARRVAL_P(zoptions) : NULL,
+			&quality, &compression TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
+
+	/* keep the alpha channel in the same cases as imagepng() does */
+	if (gdImageTrueColor(im)) {
+		has_alpha = (im->saveAlphaFlag != 0);
+	} else {
+		int i, colors = gdImageColorsTotal(im);
+
+		has_alpha = (gdImageGetTransparent(im) != -1);
+		for (i = 0; i < colors && !has_alpha; i++) {
+			has_alpha = (paletteA(im, i) != gdAlphaOpaque);
+		}
+	}
+
+	/* create a new image and import the pixels */
+	wand = NewMagickWand();
+	background = NewPixelWand();
+	(void)PixelSetColor(background, has_alpha ? "none" : "black");
+	status = MagickNewImage(wand, (size_t)gdImageSX(im), (size_t)gdImageSY(im), background);
+	(void)DestroyPixelWand(background);
+	if (status == MagickFalse) {
+		goto error_return_false;
+	}
+	pixels = _gdimage_to_pixels(im, has_alpha);
+	status = MagickImportImagePixels(wand, 0L, 0L,
+			(size_t)gdImageSX(im), (size_t)gdImageSY(im),
+			has_alpha ? "RGBA" : "RGB", CharPixel, pixels);
+	efree(pixels);
+	if (status == MagickFalse) {
+		goto error_return_false;
+	}
+
+	/* encode */
+	if (MagickSetImageFormat(wand, format) == MagickFalse) {
+		goto error_return_false;
+	}
+	if (quality >= 0L) {
+		(void)MagickSetImageCompressionQuality(wand, (size_t)quality);
+	}
+	if (compression != UndefinedCompression) {
+		(void)MagickSetImageCompression(wand, compression);
+	}
+	blob = MagickGetImageBlob(wand, &blob_size);
+	if (blob == NULL || blob_size == 0) {
+		errmsg = "Failed to encode the image";
+		goto error_return_false;
+	}
+
+	/* write the image */
+	if (gdex_output_open(&output, ((filename_len > 0) ? filename : NULL) TSRMLS_CC) == FAILURE) {
+		MagickRelinquishMemory(blob);
+		(void)DestroyMagickWand(wand);
+		RETURN_FALSE;
+	}
+	gdex_output_write(&output, blob, blob_size TSRMLS_CC);
+	success = gdex_output_close(&output TSRMLS_CC);
+	MagickRelinquishMemory(blob);
+	(void)DestroyMagickWand(wand);
+
+	RETURN_BOOL(success);
+
+	/* on failure... */
+  error_return_false:
+	_magickwand_error(wand, E_WARNING, errmsg TSRMLS_CC);
+	if (blob != NULL) {
+		MagickRelinquishMemory(blob);
 	}
 	(void)DestroyMagickWand(wand);
 	RETURN_FALSE;
 }
 
+/* }}} */
+/* {{{ resource gdextra\imagecreatefromstring(string data) */
+
+/*
+ * Create a new image from the image stream in the string
+ * JPEG, PNG, GIF and WebP are decoded by GD, BMP, ICO and QOI by
+ * this extension, and only the other formats by ImageMagick.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefromstring)
+{
+	char *data = NULL;
+	int data_len = 0;
+	const char *errmsg = NULL;
+	const unsigned char *ptr;
+	size_t size;
+	gdImagePtr im = NULL;
+	MagickWand *wand;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s",
+			&data, &data_len) == FAILURE)
+	{
+		return;
+	}
+	if (data_len == 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Empty string given");
+		RETURN_FALSE;
+	}
+	ptr = (const unsigned char *)data;
+	size = (size_t)data_len;
+
+	/* dispatch to the native decoders */
+	switch (_sniff_format(ptr, size)) {
+		case FORMAT_JPEG:
+			im = gdImageCreateFromJpegPtr(data_len, (void *)data);
+			break;
+		case FORMAT_PNG:
+			im = gdImageCreateFromPngPtr(data_len, (void *)data);
+			break;
+		case FORMAT_GIF:
+			im = gdImageCreateFromGifPtr(data_len, (void *)data);
+			break;
+#if GDEX_HAVE_WEBP_DECODER
+		case FORMAT_WEBP:
+			im = gdImageCreateFromWebpPtr(data_len, (void *)data);
+			break;
+#endif
+		case FORMAT_BMP:
+			im = gdex_bmp_decode(ptr, size TSRMLS_CC);
+			break;
+		case FORMAT_ICO:
+			im = gdex_icon_decode(ptr, size TSRMLS_CC);
+			break;
+		case FORMAT_QOI:
+			im = gdex_qoi_decode(ptr, size TSRMLS_CC);
+			break;
+		default:
+			goto fallback;
+	}
+	if (im == NULL) {
+		RETURN_FALSE;
+	}
+	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+	return;
+
+	/* let ImageMagick decode the first frame of the others */
+  fallback:
+	wand = NewMagickWand();
+	(void)MagickSetFilename(wand, "[0]");
+	if (MagickReadImageBlob(wand, (const void *)data, size) == MagickFalse) {
+		_magickwand_error(wand, E_WARNING, NULL TSRMLS_CC);
+		(void)DestroyMagickWand(wand);
+		RETURN_FALSE;
+	}
+	(void)MagickSetIteratorIndex(wand, 0L);
+	im = _magickwand_to_gdimage(wand, &errmsg);
+	if (im == NULL) {
+		_magickwand_error(wand, E_WARNING, errmsg TSRMLS_CC);
+		(void)DestroyMagickWand(wand);
+		RETURN_FALSE;
+	}
+	(void)DestroyMagickWand(wand);
+
+	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+}
+
 /* }}} */
 
 /*
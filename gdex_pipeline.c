@@ -0,0 +1,473 @@
+/*
+ * Extra image functions: operation pipeline
+ *
+ * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * @package     php-gdextra
+ * @author      Ryusuke SEKIYAMA <rsky0711@gmail.com>
+ * @copyright   2007-2012 Ryusuke SEKIYAMA
+ * @license     http://www.opensource.org/licenses/mit-license.php  MIT License
+ */
+
+#include "php_gdextra.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(gdextra);
+
+/* {{{ macros */
+
+/*
+ * Approximate number of bytes processed by all point-wise stages at once.
+ */
+#define PIPELINE_BAND_SIZE 131072
+
+/* }}} */
+/* {{{ private type definitions */
+
+typedef enum _pipeline_op_t {
+	PIPELINE_SCALE,
+	PIPELINE_FLIP,
+	PIPELINE_CARVE,
+	PIPELINE_CORRECT,
+	PIPELINE_CLUT,
+	PIPELINE_ALPHAMASK
+} pipeline_op_t;
+
+typedef struct _pipeline_stage_t {
+	pipeline_op_t op;
+	long width;
+	long height;
+	long mode;
+	HashTable *options;
+	gdex_corrector_t *corrector;
+	gdex_alphamask_t *alphamask;
+	gdex_clut_t *clut;
+	int shared;
+} pipeline_stage_t;
+
+/* }}} */
+/* {{{ private function prototypes */
+
+static int
+_pipeline_compile(HashTable *ops, pipeline_stage_t *stages TSRMLS_DC);
+
+static int
+_pipeline_compile_stage(HashTable *op, pipeline_stage_t *stage TSRMLS_DC);
+
+static void
+_pipeline_free(pipeline_stage_t *stages, int num_stages);
+
+static gdImagePtr
+_pipeline_clone(const gdImagePtr src TSRMLS_DC);
+
+static void
+_pipeline_apply_rows(pipeline_stage_t *stages, int first, int last, gdImagePtr im);
+
+/* }}} */
+/* {{{ _pipeline_get_arg() */
+
+#define _pipeline_get_arg(_op, _n, _pp) \
+	zend_hash_index_find((_op), (_n), (void **)(_pp))
+
+/* }}} */
+/* {{{ _pipeline_compile_stage() */
+
+/*
+ * Compile a stage from array('name', arg1, arg2, ...).
+ * The arguments are the same as the standalone function without the image.
+ */
+static int
+_pipeline_compile_stage(HashTable *op, pipeline_stage_t *stage TSRMLS_DC)
+{
+	zval **entry = NULL;
+	char *name;
+	int name_len;
+	int nargs = zend_hash_num_elements(op) - 1;
+
+	if (_pipeline_get_arg(op, 0, &entry) == FAILURE || Z_TYPE_PP(entry) != IS_STRING) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Operation name is missing");
+		return FAILURE;
+	}
+	name = gdex_str_tolower_trim(Z_STRVAL_PP(entry), Z_STRLEN_PP(entry), &name_len);
+
+#define _NAME_IS(_s) (name_len == sizeof(_s) - 1 && !strcmp(name, _s))
+#define _GET_LONG(_n, _dst) \
+	if (nargs >= (_n) && _pipeline_get_arg(op, (_n), &entry) == SUCCESS) { \
+		(_dst) = gdex_get_lval(*entry); \
+	}
+#define _GET_ARRAY(_n, _dst) \
+	if (nargs >= (_n) && _pipeline_get_arg(op, (_n), &entry) == SUCCESS) { \
+		(_dst) = HASH_OF(*entry); \
+	}
+
+	if (_NAME_IS("scale")) {
+		/* array('scale', width, height[, mode[, options]]) */
+		stage->op = PIPELINE_SCALE;
+		stage->mode = SCALE_FIT;
+		if (nargs < 2) {
+			goto wrong_param_count;
+		}
+		_GET_LONG(1, stage->width);
+		_GET_LONG(2, stage->height);
+		_GET_LONG(3, stage->mode);
+		_GET_ARRAY(4, stage->options);
+	} else if (_NAME_IS("flip")) {
+		/* array('flip', mode) */
+		stage->op = PIPELINE_FLIP;
+		if (nargs < 1) {
+			goto wrong_param_count;
+		}
+		_GET_LONG(1, stage->mode);
+	} else if (_NAME_IS("carve")) {
+		/* array('carve', width, height[, options]) */
+		stage->op = PIPELINE_CARVE;
+		if (nargs < 2) {
+			goto wrong_param_count;
+		}
+		_GET_LONG(1, stage->width);
+		_GET_LONG(2, stage->height);
+		_GET_ARRAY(3, stage->options);
+		if (stage->width < 1L || stage->height < 1L ||
+			stage->width > INT_MAX || stage->height > INT_MAX)
+		{
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid image dimensions");
+			goto error_return_failure;
+		}
+	} else if (_NAME_IS("colorcorrect")) {
+		/* array('colorcorrect', params[, colorspace]) */
+		/* array('colorcorrect', ColorCorrector corrector) */
+		stage->op = PIPELINE_CORRECT;
+		stage->mode = COLORSPACE_RGB;
+		if (nargs < 1 || _pipeline_get_arg(op, 1, &entry) == FAILURE) {
+			goto wrong_param_count;
+		}
+		if (Z_TYPE_PP(entry) == IS_OBJECT) {
+			stage->corrector = gdex_corrector_fetch_object(*entry TSRMLS_CC);
+			if (stage->corrector == NULL) {
+				goto error_return_failure;
+			}
+			stage->shared = 1;
+			efree(name);
+			return SUCCESS;
+		}
+		if (Z_TYPE_PP(entry) != IS_ARRAY) {
+			goto wrong_param_count;
+		}
+		stage->options = Z_ARRVAL_PP(entry);
+		_GET_LONG(2, stage->mode);
+		stage->corrector = gdex_corrector_new(stage->options, stage->mode TSRMLS_CC);
+		if (stage->corrector == NULL) {
+			goto error_return_failure;
+		}
+	} else if (_NAME_IS("clut")) {
+		/* array('clut', lut) */
+		stage->op = PIPELINE_CLUT;
+		if (nargs < 1 || _pipeline_get_arg(op, 1, &entry) == FAILURE) {
+			goto wrong_param_count;
+		}
+		stage->clut = gdex_clut_fetch(*entry, &stage->shared TSRMLS_CC);
+		if (stage->clut == NULL) {
+			goto error_return_failure;
+		}
+	} else if (_NAME_IS("alphamask")) {
+		/* array('alphamask', mask[, mode[, position]]) */
+		gdImagePtr mask = NULL;
+		long position = POSITION_DEFAULT;
+
+		stage->op = PIPELINE_ALPHAMASK;
+		stage->mode = MASK_SET;
+		if (nargs < 1 || _pipeline_get_arg(op, 1, &entry) == FAILURE) {
+			goto wrong_param_count;
+		}
+		mask = (gdImagePtr)zend_fetch_resource(entry TSRMLS_CC, -1, "Image",
+				NULL, 1, GDEXG(le_gd));
+		if (mask == NULL) {
+			goto error_return_failure;
+		}
+		_GET_LONG(2, stage->mode);
+		_GET_LONG(3, position);
+		stage->alphamask = gdex_alphamask_new(mask, stage->mode, position TSRMLS_CC);
+		if (stage->alphamask == NULL) {
+			goto error_return_failure;
+		}
+	} else {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Unsupported operation given (%s)", name);
+		goto error_return_failure;
+	}
+
+#undef _NAME_IS
+#undef _GET_LONG
+#undef _GET_ARRAY
+
+	efree(name);
+	return SUCCESS;
+
+  wrong_param_count:
+	php_error_docref(NULL TSRMLS_CC, E_WARNING,
+			"Wrong arguments for the operation '%s'", name);
+  error_return_failure:
+	efree(name);
+	return FAILURE;
+}
+
+/* }}} */
+/* {{{ _pipeline_compile() */
+
+/*
+ * Compile all stages.
+ */
+static int
+_pipeline_compile(HashTable *ops, pipeline_stage_t *stages TSRMLS_DC)
+{
+	HashPosition pos;
+	zval **entry = NULL;
+	int i = 0;
+
+	zend_hash_internal_pointer_reset_ex(ops, &pos);
+	while (zend_hash_get_current_data_ex(ops, (void **)&entry, &pos) == SUCCESS) {
+		if (Z_TYPE_PP(entry) != IS_ARRAY) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"Each operation should be an array");
+			return FAILURE;
+		}
+		if (_pipeline_compile_stage(Z_ARRVAL_PP(entry), &stages[i] TSRMLS_CC) == FAILURE) {
+			return FAILURE;
+		}
+		zend_hash_move_forward_ex(ops, &pos);
+		i++;
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _pipeline_free() */
+
+/*
+ * Free all stages.
+ */
+static void
+_pipeline_free(pipeline_stage_t *stages, int num_stages)
+{
+	int i;
+
+	for (i = 0; i < num_stages; i++) {
+		if (stages[i].corrector != NULL && !stages[i].shared) {
+			gdex_corrector_destroy(stages[i].corrector);
+		}
+		if (stages[i].clut != NULL && !stages[i].shared) {
+			gdex_clut_destroy(stages[i].clut);
+		}
+		if (stages[i].alphamask != NULL) {
+			gdex_alphamask_destroy(stages[i].alphamask);
+		}
+	}
+	efree(stages);
+}
+
+/* }}} */
+/* {{{ _pipeline_clone() */
+
+/*
+ * Create a true color copy of the image.
+ */
+static gdImagePtr
+_pipeline_clone(const gdImagePtr src TSRMLS_DC)
+{
+	gdImagePtr dst;
+	int width, height;
+
+	width = gdImageSX(src);
+	height = gdImageSY(src);
+	dst = gdImageCreateTrueColor(width, height);
+	if (dst == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create a new image");
+		return NULL;
+	}
+
+	dst->alphaBlendingFlag = gdEffectReplace;
+	gdImageCopy(dst, src, 0, 0, 0, 0, width, height);
+	dst->alphaBlendingFlag = src->alphaBlendingFlag;
+	dst->saveAlphaFlag = src->saveAlphaFlag;
+
+	return dst;
+}
+
+/* }}} */
+/* {{{ _pipeline_apply_rows() */
+
+/*
+ * Apply the point-wise stages [first..last) band by band,
+ * so that each band stays in the cache through all stages.
+ */
+static void
+_pipeline_apply_rows(pipeline_stage_t *stages, int first, int last, gdImagePtr im)
+{
+	int i, y, z, band, height;
+
+	height = gdImageSY(im);
+	band = PIPELINE_BAND_SIZE / (gdImageSX(im) * (int)sizeof(int));
+	if (band < 1) {
+		band = 1;
+	}
+
+	for (y = 0; y < height; y += band) {
+		z = MIN(y + band, height);
+		for (i = first; i < last; i++) {
+			switch (stages[i].op) {
+				case PIPELINE_CORRECT:
+					gdex_corrector_apply(stages[i].corrector, im, y, z);
+					break;
+				case PIPELINE_CLUT:
+					gdex_clut_apply(stages[i].clut, im, y, z);
+					break;
+				default:
+					gdex_alphamask_apply(stages[i].alphamask, im, y, z);
+			}
+		}
+	}
+}
+
+/* }}} */
+/* {{{ resource imagepipeline(resource im, array operations) */
+
+/*
+ * Apply the operations to a copy of the image.
+ * Consecutive point-wise operations are fused and executed in a single pass.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagepipeline)
+{
+	zval *zim = NULL, *zops = NULL;
+	gdImagePtr src = NULL, im = NULL, tmp;
+	pipeline_stage_t *stages;
+	int num_stages, i, j;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ra",
+			&zim, &zops) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(src, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	/* compile the operations */
+	num_stages = zend_hash_num_elements(Z_ARRVAL_P(zops));
+	stages = (pipeline_stage_t *)ecalloc(num_stages + 1, sizeof(pipeline_stage_t));
+	if (_pipeline_compile(Z_ARRVAL_P(zops), stages TSRMLS_CC) == FAILURE) {
+		goto error_return_false;
+	}
+
+	/* execute the operations */
+	i = 0;
+	while (i < num_stages) {
+		switch (stages[i].op) {
+			case PIPELINE_SCALE:
+				tmp = gdex_image_scale((im) ? im : src,
+						stages[i].width, stages[i].height,
+						stages[i].mode, stages[i].options TSRMLS_CC);
+				if (tmp == NULL) {
+					goto error_return_false;
+				}
+				if (im != NULL) {
+					gdImageDestroy(im);
+				}
+				im = tmp;
+				i++;
+				break;
+
+			case PIPELINE_CARVE:
+				tmp = gdex_carve((im) ? im : src,
+						(int)stages[i].width, (int)stages[i].height,
+						stages[i].options TSRMLS_CC);
+				if (tmp == NULL) {
+					goto error_return_false;
+				}
+				if (im != NULL) {
+					gdImageDestroy(im);
+				}
+				im = tmp;
+				i++;
+				break;
+
+			case PIPELINE_FLIP:
+				if (im == NULL && (im = _pipeline_clone(src TSRMLS_CC)) == NULL) {
+					goto error_return_false;
+				}
+				gdex_image_flip(im, (int)stages[i].mode);
+				i++;
+				break;
+
+			default:
+				/* fuse the consecutive point-wise stages */
+				if (im == NULL && (im = _pipeline_clone(src TSRMLS_CC)) == NULL) {
+					goto error_return_false;
+				}
+				if (!gdImageTrueColor(im) && gdex_palette_to_truecolor(im TSRMLS_CC) == FAILURE) {
+					goto error_return_false;
+				}
+				j = i;
+				while (j < num_stages && (stages[j].op == PIPELINE_CORRECT ||
+				                          stages[j].op == PIPELINE_CLUT ||
+				                          stages[j].op == PIPELINE_ALPHAMASK))
+				{
+					if (stages[j].op == PIPELINE_CORRECT &&
+						gdex_corrector_is_empty(stages[j].corrector))
+					{
+						php_error_docref(NULL TSRMLS_CC, E_NOTICE, "Nothing to do.");
+					} else if (stages[j].op == PIPELINE_ALPHAMASK) {
+						gdImageSaveAlpha(im, 1);
+					}
+					j++;
+				}
+				_pipeline_apply_rows(stages, i, j, im);
+				i = j;
+		}
+	}
+
+	/* copy the image if nothing has been done */
+	if (im == NULL && (im = _pipeline_clone(src TSRMLS_CC)) == NULL) {
+		goto error_return_false;
+	}
+
+	_pipeline_free(stages, num_stages);
+
+	/* return a new image resource */
+	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+	return;
+
+  error_return_false:
+	if (im != NULL) {
+		gdImageDestroy(im);
+	}
+	_pipeline_free(stages, num_stages);
+	RETURN_FALSE;
+}
+
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,379 @@
+/*
+ * Extra image functions: bulk pixel access functions
+ *
+ * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * @package     php-gdextra
+ * @author      Ryusuke SEKIYAMA <rsky0711@gmail.com>
+ * @copyright   2007-2012 Ryusuke SEKIYAMA
+ * @license     http://www.opensource.org/licenses/mit-license.php  MIT License
+ */
+
+#include "php_gdextra.h"
+#include <stdint.h>
+
+ZEND_EXTERN_MODULE_GLOBALS(gdextra);
+
+/* {{{ type definitions */
+
+typedef unsigned char byte_t;
+
+/*
+ * Rectangle to be accessed.
+ */
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+} pixels_region_t;
+
+/* }}} */
+/* {{{ private function prototypes */
+
+static int
+_get_pixels_region(pixels_region_t *region, const gdImagePtr im, HashTable *ht TSRMLS_DC);
+
+static int
+_get_pixel_size(long format TSRMLS_DC);
+
+static void
+_pack_row(byte_t *dst, const int *src, int width, long format);
+
+static void
+_unpack_row(int *dst, const byte_t *src, int width, long format);
+
+/* }}} */
+/* {{{ _get_pixels_region() */
+
+/*
+ * Get the rectangle from an array like array('x'=>0, 'y'=>0, 'width'=>10, 'height'=>10)
+ * The whole image is used if ht is NULL, and omitted sizes extend to the edges.
+ */
+static int
+_get_pixels_region(pixels_region_t *region, const gdImagePtr im, HashTable *ht TSRMLS_DC)
+{
+	zval **entry;
+	long x = 0L, y = 0L, width, height;
+
+	if (ht != NULL) {
+		if (hash_find(ht, "x", &entry) == SUCCESS) {
+			x = gdex_get_lval(*entry);
+		}
+		if (hash_find(ht, "y", &entry) == SUCCESS) {
+			y = gdex_get_lval(*entry);
+		}
+	}
+	if (x < 0L || y < 0L || x >= (long)gdImageSX(im) || y >= (long)gdImageSY(im)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid region offset");
+		return FAILURE;
+	}
+
+	width = (long)gdImageSX(im) - x;
+	height = (long)gdImageSY(im) - y;
+	if (ht != NULL) {
+		if (hash_find(ht, "width", &entry) == SUCCESS) {
+			width = gdex_get_lval(*entry);
+		}
+		if (hash_find(ht, "height", &entry) == SUCCESS) {
+			height = gdex_get_lval(*entry);
+		}
+	}
+	if (width < 1L || height < 1L
+		|| width > (long)gdImageSX(im) - x || height > (long)gdImageSY(im) - y)
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid region size");
+		return FAILURE;
+	}
+
+	region->x = (int)x;
+	region->y = (int)y;
+	region->width = (int)width;
+	region->height = (int)height;
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _get_pixel_size() */
+
+/*
+ * Get the number of bytes per pixel, or 0 for unknown formats
+ */
+static int
+_get_pixel_size(long format TSRMLS_DC)
+{
+	switch (format) {
+		case PIXELS_RGBA8:
+		case PIXELS_BGRA8:
+		case PIXELS_ARGB32:
+			return 4;
+		case PIXELS_RGB8:
+			return 3;
+		case PIXELS_GRAY8:
+			return 1;
+	}
+
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "Unsupported pixel format (%ld)", format);
+	return 0;
+}
+
+/* }}} */
+/* {{{ _pack_row() */
+
+/*
+ * Convert a row of true color pixels to the format
+ * The format is checked once per row so that each loop stays simple
+ * enough for the compiler to vectorize.
+ */
+static void
+_pack_row(byte_t *dst, const int *src, int width, long format)
+{
+	int x;
+
+	switch (format) {
+		case PIXELS_RGBA8:
+			for (x = 0; x < width; x++, dst += 4) {
+				int c = src[x];
+				dst[0] = (byte_t)getR(c);
+				dst[1] = (byte_t)getG(c);
+				dst[2] = (byte_t)getB(c);
+				dst[3] = (byte_t)_alpha2gray(getA(c));
+			}
+			break;
+		case PIXELS_BGRA8:
+			for (x = 0; x < width; x++, dst += 4) {
+				int c = src[x];
+				dst[0] = (byte_t)getB(c);
+				dst[1] = (byte_t)getG(c);
+				dst[2] = (byte_t)getR(c);
+				dst[3] = (byte_t)_alpha2gray(getA(c));
+			}
+			break;
+		case PIXELS_RGB8:
+			for (x = 0; x < width; x++, dst += 3) {
+				int c = src[x];
+				dst[0] = (byte_t)getR(c);
+				dst[1] = (byte_t)getG(c);
+				dst[2] = (byte_t)getB(c);
+			}
+			break;
+		case PIXELS_GRAY8:
+			for (x = 0; x < width; x++) {
+				int c = src[x];
+				dst[x] = (byte_t)_rgb2gray(getR(c), getG(c), getB(c));
+			}
+			break;
+		case PIXELS_ARGB32:
+			for (x = 0; x < width; x++, dst += 4) {
+				int c = src[x];
+				uint32_t v = ((uint32_t)_alpha2gray(getA(c)) << 24) | ((uint32_t)c & 0xffffffU);
+				memcpy(dst, &v, 4);
+			}
+			break;
+	}
+}
+
+/* }}} */
+/* {{{ _unpack_row() */
+
+/*
+ * Convert a row of the format to true color pixels
+ */
+static void
+_unpack_row(int *dst, const byte_t *src, int width, long format)
+{
+	int x;
+
+	switch (format) {
+		case PIXELS_RGBA8:
+			for (x = 0; x < width; x++, src += 4) {
+				dst[x] = gdTrueColorAlpha(src[0], src[1], src[2], _gray2alpha(src[3]));
+			}
+			break;
+		case PIXELS_BGRA8:
+			for (x = 0; x < width; x++, src += 4) {
+				dst[x] = gdTrueColorAlpha(src[2], src[1], src[0], _gray2alpha(src[3]));
+			}
+			break;
+		case PIXELS_RGB8:
+			for (x = 0; x < width; x++, src += 3) {
+				dst[x] = gdTrueColor(src[0], src[1], src[2]);
+			}
+			break;
+		case PIXELS_GRAY8:
+			for (x = 0; x < width; x++) {
+				dst[x] = gdTrueColor(src[x], src[x], src[x]);
+			}
+			break;
+		case PIXELS_ARGB32:
+			for (x = 0; x < width; x++, src += 4) {
+				uint32_t v;
+				memcpy(&v, src, 4);
+				dst[x] = (int)(v & 0xffffffU) | (_gray2alpha((int)(v >> 24)) << 24);
+			}
+			break;
+	}
+}
+
+/* }}} */
+/* {{{ string imagegetpixels(resource im, int format[, array region]) */
+
+/*
+ * Get the pixels as a binary string
+ * Alpha values are 8-bit (255 = opaque), and IMAGE_EX_PIXELS_ARGB32
+ * is a native endian 32-bit integer per pixel.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagegetpixels)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	long format = 0L;
+	zval *zregion = NULL;
+	pixels_region_t region;
+	int pixel_size, y;
+	size_t row_size, length;
+	byte_t *buffer;
+	int *row = NULL;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rl|a!",
+			&zim, &format, &zregion) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	if ((pixel_size = _get_pixel_size(format TSRMLS_CC)) == 0) {
+		RETURN_FALSE;
+	}
+	if (_get_pixels_region(&region, im,
+			(zregion != NULL) ? Z_ARRVAL_P(zregion) : NULL TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
+
+	row_size = (size_t)region.width * (size_t)pixel_size;
+	if ((size_t)region.height > (size_t)(INT_MAX - 1) / row_size) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Required memory size too large");
+		RETURN_FALSE;
+	}
+	length = row_size * (size_t)region.height;
+	buffer = (byte_t *)emalloc(length + 1);
+
+	/* palette images are converted a row at a time */
+	if (!gdImageTrueColor(im)) {
+		row = (int *)safe_emalloc((size_t)region.width, sizeof(int), 0);
+	}
+
+	for (y = 0; y < region.height; y++) {
+		const int *src;
+
+		if (row == NULL) {
+			src = im->tpixels[region.y + y] + region.x;
+		} else {
+			const unsigned char *p = im->pixels[region.y + y] + region.x;
+			int x, transparent = gdImageGetTransparent(im);
+
+			for (x = 0; x < region.width; x++) {
+				int c = (int)p[x];
+				row[x] = gdTrueColorAlpha(paletteR(im, c), paletteG(im, c), paletteB(im, c),
+						(c == transparent) ? gdAlphaTransparent : paletteA(im, c));
+			}
+			src = row;
+		}
+		_pack_row(buffer + row_size * (size_t)y, src, region.width, format);
+	}
+
+	if (row != NULL) {
+		efree(row);
+	}
+	buffer[length] = '\0';
+
+	RETURN_STRINGL((char *)buffer, (int)length, 0);
+}
+
+/* }}} */
+/* {{{ bool imagesetpixels(resource im, int format, string data[, array region]) */
+
+/*
+ * Set the pixels from a binary string
+ * The image must be a true color image, and the data must fill the region.
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagesetpixels)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	long format = 0L;
+	char *data = NULL;
+	int data_len = 0;
+	zval *zregion = NULL;
+	pixels_region_t region;
+	int pixel_size, y;
+	size_t row_size;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rls|a!",
+			&zim, &format, &data, &data_len, &zregion) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	if (!gdImageTrueColor(im)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Palette images are not supported");
+		RETURN_FALSE;
+	}
+	if ((pixel_size = _get_pixel_size(format TSRMLS_CC)) == 0) {
+		RETURN_FALSE;
+	}
+	if (_get_pixels_region(&region, im,
+			(zregion != NULL) ? Z_ARRVAL_P(zregion) : NULL TSRMLS_CC) == FAILURE)
+	{
+		RETURN_FALSE;
+	}
+
+	row_size = (size_t)region.width * (size_t)pixel_size;
+	if ((size_t)data_len / row_size < (size_t)region.height) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+				"Data too short (%d bytes given, %lu bytes required)", data_len,
+				(unsigned long)(row_size * (size_t)region.height));
+		RETURN_FALSE;
+	}
+
+	for (y = 0; y < region.height; y++) {
+		_unpack_row(im->tpixels[region.y + y] + region.x,
+				(const byte_t *)data + row_size * (size_t)y, region.width, format);
+	}
+
+	RETURN_TRUE;
+}
+
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
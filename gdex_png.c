@@ -0,0 +1,619 @@
+/*
+ * Extra image functions: PNG encoder
+ *
+ * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * @package     php-gdextra
+ * @author      Ryusuke SEKIYAMA <rsky0711@gmail.com>
+ * @copyright   2007-2012 Ryusuke SEKIYAMA
+ * @license     http://www.opensource.org/licenses/mit-license.php  MIT License
+ */
+
+#include "php_gdextra.h"
+#include <stdint.h>
+#include <zlib.h>
+#if PHP_GDEXTRA_WITH_PTHREADS
+#include <pthread.h>
+#endif
+
+ZEND_EXTERN_MODULE_GLOBALS(gdextra);
+
+/* {{{ macros */
+
+#define PNG_COLOR_TYPE_RGB     2
+#define PNG_COLOR_TYPE_PALETTE 3
+#define PNG_COLOR_TYPE_RGBA    6
+
+#define PNG_FILTER_NONE    0
+#define PNG_FILTER_SUB     1
+#define PNG_FILTER_UP      2
+#define PNG_FILTER_AVERAGE 3
+#define PNG_FILTER_PAETH   4
+#define PNG_FILTER_NUM     5
+
+/* raw bytes compressed as an independent deflate stream */
+#define PNG_BAND_SIZE   (256 * 1024)
+#define PNG_MAX_THREADS 16
+
+/* }}} */
+/* {{{ type definitions */
+
+/*
+ * Rows compressed by a thread.
+ */
+typedef struct {
+	gdImagePtr im;
+	int channels;
+	int level;
+	int adaptive;
+	int y_start;
+	int y_end;
+	int finish;
+	size_t row_size;
+	unsigned char *work;
+	unsigned char *raw;
+	unsigned char *out;
+	size_t out_size;
+	size_t out_length;
+	uLong adler;
+	int status;
+} png_band_t;
+
+/* }}} */
+/* {{{ inline functions */
+
+static inline unsigned char *
+_write_uint32be(unsigned char *ptr, uint32_t n)
+{
+	*ptr++ = (unsigned char)(0xffU & (n >> 24));
+	*ptr++ = (unsigned char)(0xffU & (n >> 16));
+	*ptr++ = (unsigned char)(0xffU & (n >> 8));
+	*ptr++ = (unsigned char)(0xffU & n);
+	return ptr;
+}
+
+/*
+ * Predict a byte from the left, upper and upper left bytes.
+ */
+static inline int
+_paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc) {
+		return a;
+	} else if (pb <= pc) {
+		return b;
+	}
+	return c;
+}
+
+/* }}} */
+/* {{{ gdex_png_encode() */
+
+/*
+ * Encode an image as PNG in memory.
+ * True color images are stored as 8-bit RGBA, and palette images as
+ * indexed color with the transparency chunk if required. The image is
+ * written by gdex_png_write() to a memory stream, so that the bands are
+ * compressed in gdextra.threads threads when thread support is enabled.
+ */
+GDEXTRA_LOCAL unsigned char *
+gdex_png_encode(const gdImagePtr im, int level, size_t *size TSRMLS_DC)
+{
+	gdex_output_t output;
+	unsigned char *buffer = NULL;
+	char *data;
+	size_t length = 0;
+
+	(void)gdex_output_open(&output, NULL TSRMLS_CC);
+	output.stream = php_stream_memory_create(TEMP_STREAM_DEFAULT);
+	if (output.stream == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Cannot create a memory stream");
+		return NULL;
+	}
+
+	if (gdex_png_write(&output, im, level, 1, -1, 1 TSRMLS_CC)) {
+		gdex_output_flush(&output TSRMLS_CC);
+		data = php_stream_memory_get_buffer(output.stream, &length);
+		if (!output.failed && data != NULL && length > 0) {
+			buffer = (unsigned char *)emalloc(length);
+			memcpy(buffer, data, length);
+			*size = length;
+		}
+	}
+	gdex_output_close(&output TSRMLS_CC);
+
+	return buffer;
+}
+
+/* }}} */
+/* {{{ _get_png_row() */
+
+/*
+ * Convert a row to 8-bit RGBA, RGB or palette indices.
+ */
+static void
+_get_png_row(const gdImagePtr im, int y, int channels, unsigned char *dst)
+{
+	int x, width = gdImageSX(im);
+
+	if (channels == 1) {
+		memcpy(dst, im->pixels[y], (size_t)width);
+	} else if (channels == 4) {
+		for (x = 0; x < width; x++, dst += 4) {
+			int c = unsafeGetTrueColorPixel(im, x, y);
+			dst[0] = (unsigned char)getR(c);
+			dst[1] = (unsigned char)getG(c);
+			dst[2] = (unsigned char)getB(c);
+			dst[3] = (unsigned char)_alpha2gray(getA(c));
+		}
+	} else {
+		for (x = 0; x < width; x++, dst += 3) {
+			int c = unsafeGetTrueColorPixel(im, x, y);
+			dst[0] = (unsigned char)getR(c);
+			dst[1] = (unsigned char)getG(c);
+			dst[2] = (unsigned char)getB(c);
+		}
+	}
+}
+
+/* }}} */
+/* {{{ _filter_png_row() */
+
+/*
+ * Apply the filter to a row and return the sum of absolute values of the
+ * result as signed bytes, which is the usual heuristic to choose a filter.
+ */
+static unsigned long
+_filter_png_row(unsigned char *dst, const unsigned char *cur, const unsigned char *prev,
+                size_t length, int bpp, int type)
+{
+	unsigned long sum = 0UL;
+	size_t i;
+
+#define PNG_FILTER_LOOP(predictor) \
+	for (i = 0; i < length; i++) { \
+		int a = (i >= (size_t)bpp) ? cur[i - bpp] : 0; \
+		int b = prev[i]; \
+		int c = (i >= (size_t)bpp) ? prev[i - bpp] : 0; \
+		unsigned char v = (unsigned char)(cur[i] - (predictor)); \
+		(void)a; (void)b; (void)c; \
+		dst[i] = v; \
+		sum += (v < 128) ? v : 256 - v; \
+	}
+
+	switch (type) {
+		case PNG_FILTER_SUB:
+			PNG_FILTER_LOOP(a);
+			break;
+		case PNG_FILTER_UP:
+			PNG_FILTER_LOOP(b);
+			break;
+		case PNG_FILTER_AVERAGE:
+			PNG_FILTER_LOOP((a + b) >> 1);
+			break;
+		case PNG_FILTER_PAETH:
+			PNG_FILTER_LOOP(_paeth(a, b, c));
+			break;
+		default:
+			PNG_FILTER_LOOP(0);
+	}
+
+#undef PNG_FILTER_LOOP
+
+	return sum;
+}
+
+/* }}} */
+/* {{{ _encode_png_band() */
+
+/*
+ * Filter and compress the rows of a band as a raw deflate stream
+ * Runs without touching the Zend engine, so that it can be called from
+ * worker threads; every buffer is allocated by the caller.
+ */
+static void *
+_encode_png_band(void *arg)
+{
+	png_band_t *band = (png_band_t *)arg;
+	size_t row_size = band->row_size;
+	unsigned char *prev = band->work;
+	unsigned char *cur = prev + row_size;
+	unsigned char *best = cur + row_size;
+	unsigned char *trial = best + row_size;
+	unsigned char *raw = band->raw, *tmp;
+	int y, bpp = band->channels;
+	z_stream zs;
+
+	/* the row above the band is needed by the filters */
+	if (band->y_start > 0) {
+		_get_png_row(band->im, band->y_start - 1, band->channels, prev);
+	} else {
+		memset(prev, 0, row_size);
+	}
+
+	for (y = band->y_start; y < band->y_end; y++) {
+		_get_png_row(band->im, y, band->channels, cur);
+
+		if (band->adaptive) {
+			unsigned long sum, best_sum;
+			int type, best_type = PNG_FILTER_NONE;
+
+			best_sum = _filter_png_row(best, cur, prev, row_size, bpp, PNG_FILTER_NONE);
+			for (type = PNG_FILTER_SUB; type < PNG_FILTER_NUM; type++) {
+				sum = _filter_png_row(trial, cur, prev, row_size, bpp, type);
+				if (sum < best_sum) {
+					best_sum = sum;
+					best_type = type;
+					tmp = best;
+					best = trial;
+					trial = tmp;
+				}
+			}
+			*raw++ = (unsigned char)best_type;
+			memcpy(raw, best, row_size);
+		} else {
+			*raw++ = PNG_FILTER_NONE;
+			memcpy(raw, cur, row_size);
+		}
+		raw += row_size;
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	/* compress */
+	band->adler = adler32(adler32(0L, Z_NULL, 0), band->raw, (uInt)(raw - band->raw));
+	band->status = FAILURE;
+
+	memset(&zs, 0, sizeof(z_stream));
+	if (deflateInit2(&zs, band->level, Z_DEFLATED, -MAX_WBITS, 8,
+			(band->adaptive) ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		return NULL;
+	}
+	zs.next_in = band->raw;
+	zs.avail_in = (uInt)(raw - band->raw);
+	zs.next_out = band->out;
+	zs.avail_out = (uInt)band->out_size;
+
+	/* a sync flush ends the stream at a byte boundary without the final block */
+	if (band->finish) {
+		if (deflate(&zs, Z_FINISH) == Z_STREAM_END) {
+			band->status = SUCCESS;
+		}
+	} else {
+		if (deflate(&zs, Z_SYNC_FLUSH) == Z_OK && zs.avail_in == 0) {
+			band->status = SUCCESS;
+		}
+	}
+	band->out_length = (size_t)zs.total_out;
+	deflateEnd(&zs);
+
+	return NULL;
+}
+
+/* }}} */
+/* {{{ _write_png_chunk() */
+
+/*
+ * Write a chunk whose data is given in up to three parts.
+ */
+static void
+_write_png_chunk(gdex_output_t *output, const char *type,
+                 const unsigned char *head, size_t head_length,
+                 const unsigned char *body, size_t body_length,
+                 const unsigned char *tail, size_t tail_length TSRMLS_DC)
+{
+	unsigned char buf[8];
+	uLong crc;
+
+	_write_uint32be(buf, (uint32_t)(head_length + body_length + tail_length));
+	memcpy(buf + 4, type, 4);
+	gdex_output_write(output, buf, 8 TSRMLS_CC);
+
+	crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)type, 4);
+	if (head_length > 0) {
+		gdex_output_write(output, head, head_length TSRMLS_CC);
+		crc = crc32(crc, head, (uInt)head_length);
+	}
+	if (body_length > 0) {
+		gdex_output_write(output, body, body_length TSRMLS_CC);
+		crc = crc32(crc, body, (uInt)body_length);
+	}
+	if (tail_length > 0) {
+		gdex_output_write(output, tail, tail_length TSRMLS_CC);
+		crc = crc32(crc, tail, (uInt)tail_length);
+	}
+
+	_write_uint32be(buf, (uint32_t)crc);
+	gdex_output_write(output, buf, 4 TSRMLS_CC);
+}
+
+/* }}} */
+/* {{{ gdex_png_write() */
+
+/*
+ * Encode an image as PNG and write it to the output
+ * Rows are split into bands which are compressed as independent deflate
+ * streams, concatenated with sync flushes, and written as IDAT chunks in
+ * order. With thread support the bands of each round are compressed in
+ * parallel.
+ */
+GDEXTRA_LOCAL zend_bool
+gdex_png_write(gdex_output_t *output, const gdImagePtr im,
+               int level, int adaptive, int threads, int force_alpha TSRMLS_DC)
+{
+	png_band_t bands[PNG_MAX_THREADS];
+	unsigned char *buffer, *ptr, ihdr[13], zhead[2], ztail[4];
+	size_t row_size, raw_size, out_size, band_size;
+	int i, width, height, channels, colors = 0, transparent, trns_size = 0;
+	int band_rows, num_bands, done;
+	uLong adler = 1L;
+	z_stream zs;
+	zend_bool success = 1;
+
+	width = gdImageSX(im);
+	height = gdImageSY(im);
+	if (level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION) {
+		level = Z_DEFAULT_COMPRESSION;
+	}
+
+	/* determine the pixel format */
+	if (!gdImageTrueColor(im)) {
+		channels = 1;
+		colors = gdImageColorsTotal(im);
+		if (colors < 1) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "The palette has no colors");
+			return 0;
+		}
+		transparent = gdImageGetTransparent(im);
+		for (i = 0; i < colors; i++) {
+			if (i == transparent || paletteA(im, i) != gdAlphaOpaque) {
+				trns_size = i + 1;
+			}
+		}
+		/* filters rarely help indexed color */
+		adaptive = 0;
+	} else {
+		channels = (im->saveAlphaFlag || force_alpha) ? 4 : 3;
+	}
+
+	/* split the rows into bands */
+	row_size = (size_t)width * (size_t)channels;
+	if (row_size > (size_t)INT_MAX / 4) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Required memory size too large");
+		return 0;
+	}
+	band_rows = (int)(PNG_BAND_SIZE / (row_size + 1));
+	band_rows = MINMAX(band_rows, 1, height);
+	num_bands = (height + band_rows - 1) / band_rows;
+	raw_size = (row_size + 1) * (size_t)band_rows;
+
+	threads = gdex_get_threads((long)threads, PNG_MAX_THREADS TSRMLS_CC);
+	threads = MIN(threads, num_bands);
+
+	memset(&zs, 0, sizeof(z_stream));
+	if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to initialize zlib");
+		return 0;
+	}
+	out_size = (size_t)deflateBound(&zs, (uLong)raw_size) + 16; /* + sync flush marker */
+	deflateEnd(&zs);
+
+	/* allocate the buffers of all bands at once */
+	band_size = 4 * row_size + raw_size + out_size;
+	buffer = (unsigned char *)safe_emalloc((size_t)threads, band_size, 0);
+	memset(bands, 0, sizeof(bands));
+	for (i = 0, ptr = buffer; i < threads; i++, ptr += band_size) {
+		bands[i].im = im;
+		bands[i].channels = channels;
+		bands[i].level = level;
+		bands[i].adaptive = adaptive;
+		bands[i].row_size = row_size;
+		bands[i].work = ptr;
+		bands[i].raw = ptr + 4 * row_size;
+		bands[i].out = bands[i].raw + raw_size;
+		bands[i].out_size = out_size;
+	}
+
+	/* write the signature and the header */
+	gdex_output_write(output, "\x89PNG\r\n\x1a\n", 8 TSRMLS_CC);
+	ptr = _write_uint32be(ihdr, (uint32_t)width);
+	ptr = _write_uint32be(ptr, (uint32_t)height);
+	*ptr++ = 8; /* bit depth */
+	if (channels == 1) {
+		*ptr++ = PNG_COLOR_TYPE_PALETTE;
+	} else {
+		*ptr++ = (channels == 4) ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB;
+	}
+	*ptr++ = 0; /* compression method: deflate */
+	*ptr++ = 0; /* filter method: adaptive */
+	*ptr++ = 0; /* interlace method: none */
+	_write_png_chunk(output, "IHDR", ihdr, 13, NULL, 0, NULL, 0 TSRMLS_CC);
+
+	/* write PLTE and tRNS */
+	if (colors > 0) {
+		unsigned char plte[3 * 256], trns[256];
+
+		transparent = gdImageGetTransparent(im);
+		for (i = 0; i < colors; i++) {
+			plte[3 * i]     = (unsigned char)paletteR(im, i);
+			plte[3 * i + 1] = (unsigned char)paletteG(im, i);
+			plte[3 * i + 2] = (unsigned char)paletteB(im, i);
+			trns[i] = (unsigned char)((i == transparent) ? 0 : _alpha2gray(paletteA(im, i)));
+		}
+		_write_png_chunk(output, "PLTE", plte, 3 * (size_t)colors, NULL, 0, NULL, 0 TSRMLS_CC);
+		if (trns_size > 0) {
+			_write_png_chunk(output, "tRNS", trns, (size_t)trns_size, NULL, 0, NULL, 0 TSRMLS_CC);
+		}
+	}
+
+	/* the zlib header */
+	zhead[0] = 0x78;
+	if (level == Z_DEFAULT_COMPRESSION || level == 6) {
+		zhead[1] = 0x9c;
+	} else if (level < 2) {
+		zhead[1] = 0x01;
+	} else if (level < 6) {
+		zhead[1] = 0x5e;
+	} else {
+		zhead[1] = 0xda;
+	}
+
+	/* compress and write IDAT */
+	for (done = 0; done < num_bands && success; done += threads) {
+		int n = MIN(threads, num_bands - done);
+#if PHP_GDEXTRA_WITH_PTHREADS
+		pthread_t tids[PNG_MAX_THREADS];
+		int started[PNG_MAX_THREADS];
+#endif
+
+		for (i = 0; i < n; i++) {
+			bands[i].y_start = (done + i) * band_rows;
+			bands[i].y_end = MIN(bands[i].y_start + band_rows, height);
+			bands[i].finish = (done + i == num_bands - 1);
+		}
+
+#if PHP_GDEXTRA_WITH_PTHREADS
+		/* the first band of each round runs in the calling thread */
+		for (i = 1; i < n; i++) {
+			started[i] = (pthread_create(&tids[i], NULL, _encode_png_band, &bands[i]) == 0);
+		}
+		_encode_png_band(&bands[0]);
+		for (i = 1; i < n; i++) {
+			if (started[i]) {
+				pthread_join(tids[i], NULL);
+			} else {
+				_encode_png_band(&bands[i]);
+			}
+		}
+#else
+		for (i = 0; i < n; i++) {
+			_encode_png_band(&bands[i]);
+		}
+#endif
+
+		for (i = 0; i < n; i++) {
+			png_band_t *band = &bands[i];
+			size_t raw_length = (row_size + 1) * (size_t)(band->y_end - band->y_start);
+
+			if (band->status == FAILURE) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to compress the image");
+				success = 0;
+				break;
+			}
+			adler = (done + i == 0) ? band->adler
+				: adler32_combine(adler, band->adler, (z_off_t)raw_length);
+			if (band->finish) {
+				_write_uint32be(ztail, (uint32_t)adler);
+			}
+			_write_png_chunk(output, "IDAT",
+					zhead, (done + i == 0) ? 2 : 0,
+					band->out, band->out_length,
+					ztail, (band->finish) ? 4 : 0 TSRMLS_CC);
+		}
+	}
+	efree(buffer);
+
+	/* write IEND */
+	if (success) {
+		_write_png_chunk(output, "IEND", NULL, 0, NULL, 0, NULL, 0 TSRMLS_CC);
+	}
+
+	return success;
+}
+
+/* }}} */
+/* {{{ bool imagefastpng(resource im[, string filename[, array options]]) */
+
+/*
+ * Output a PNG image to either the browser or a file
+ * Options are 'level' (zlib compression level), 'filter' (choose a filter
+ * for each row, default true) and 'threads' (default gdextra.threads,
+ * 0 for the number of CPUs, ignored without thread support).
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagefastpng)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	char *filename = NULL;
+	int filename_len = 0;
+	zval *zoptions = NULL;
+	zval **entry;
+	long level = Z_DEFAULT_COMPRESSION, threads = -1L;
+	int adaptive = 1;
+	gdex_output_t output;
+	zend_bool success;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|sa!",
+			&zim, &filename, &filename_len, &zoptions) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	/* get the options */
+	if (zoptions != NULL) {
+		HashTable *options = Z_ARRVAL_P(zoptions);
+
+		if (hash_find(options, "level", &entry) == SUCCESS) {
+			level = gdex_get_lval(*entry);
+			if (level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING,
+						"Compression level must be between 0 and 9");
+				RETURN_FALSE;
+			}
+		}
+		if (hash_find(options, "filter", &entry) == SUCCESS) {
+			adaptive = zval_is_true(*entry);
+		}
+		if (hash_find(options, "threads", &entry) == SUCCESS) {
+			threads = MINMAX(gdex_get_lval(*entry), 0L, (long)PNG_MAX_THREADS);
+		}
+	}
+
+	/* write the image */
+	if (gdex_output_open(&output, ((filename_len > 0) ? filename : NULL) TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	success = gdex_png_write(&output, im, (int)level, adaptive, (int)threads, 0 TSRMLS_CC);
+	if (!gdex_output_close(&output TSRMLS_CC)) {
+		success = 0;
+	}
+
+	RETURN_BOOL(success);
+}
+
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
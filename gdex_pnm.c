@@ -0,0 +1,493 @@
+/*
+ * Extra image functions: PNM (PPM/PGM/PAM) reader/writer functions
+ *
+ * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * @package     php-gdextra
+ * @author      Ryusuke SEKIYAMA <rsky0711@gmail.com>
+ * @copyright   2007-2012 Ryusuke SEKIYAMA
+ * @license     http://www.opensource.org/licenses/mit-license.php  MIT License
+ */
+
+#include "php_gdextra.h"
+
+ZEND_EXTERN_MODULE_GLOBALS(gdextra);
+
+/* {{{ type definitions */
+
+typedef unsigned char byte_t;
+
+/*
+ * Header of a binary PNM image.
+ */
+typedef struct {
+	int width;
+	int height;
+	int depth;
+	int maxval;
+	size_t offset;
+} pnm_header_t;
+
+/* }}} */
+/* {{{ private function prototypes */
+
+static int
+_read_pnm_header(pnm_header_t *header, const byte_t *data, size_t size);
+
+static gdImagePtr
+_decode_pnm(const pnm_header_t *header, const byte_t *data, size_t size TSRMLS_DC);
+
+static zend_bool
+_write_pnm(gdex_output_t *output, const gdImagePtr im, int format TSRMLS_DC);
+
+/* }}} */
+/* {{{ inline functions */
+
+static inline int
+_pnm_isspace(int c)
+{
+	return (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f');
+}
+
+/*
+ * Skip whitespace and comments.
+ */
+static inline const byte_t *
+_pnm_skip(const byte_t *ptr, const byte_t *end)
+{
+	while (ptr < end) {
+		if (*ptr == '#') {
+			while (ptr < end && *ptr != '\n') {
+				ptr++;
+			}
+		} else if (_pnm_isspace(*ptr)) {
+			ptr++;
+		} else {
+			break;
+		}
+	}
+	return ptr;
+}
+
+/*
+ * Parse a positive decimal integer up to 0xffff.
+ */
+static inline const byte_t *
+_pnm_uint(const byte_t *ptr, const byte_t *end, int *value)
+{
+	int n = 0;
+
+	ptr = _pnm_skip(ptr, end);
+	if (ptr == end || *ptr < '0' || *ptr > '9') {
+		return NULL;
+	}
+	while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+		n = n * 10 + (*ptr++ - '0');
+		if (n > 0xffff) {
+			return NULL;
+		}
+	}
+	*value = n;
+	return ptr;
+}
+
+/*
+ * Get a sample scaled to 8 bits, clamped to maxval.
+ */
+static inline int
+_pnm_sample(const byte_t *ptr, int maxval)
+{
+	int v;
+
+	if (maxval == 255) {
+		return (int)*ptr;
+	} else if (maxval > 255) {
+		v = (int)ptr[0] << 8 | (int)ptr[1];
+	} else {
+		v = (int)*ptr;
+	}
+	if (v > maxval) {
+		v = maxval;
+	}
+	return (v * 255 + maxval / 2) / maxval;
+}
+
+/*
+ * Get the pixel at (x, y) as 8-bit RGB and GD's alpha.
+ */
+static inline int
+_get_pixel(const gdImagePtr im, int x, int y)
+{
+	int c;
+
+	if (gdImageTrueColor(im)) {
+		return unsafeGetTrueColorPixel(im, x, y);
+	}
+	c = unsafeGetPalettePixel(im, x, y);
+	return gdTrueColorAlpha(paletteR(im, c), paletteG(im, c), paletteB(im, c),
+			(c == gdImageGetTransparent(im)) ? gdAlphaTransparent : paletteA(im, c));
+}
+
+/* }}} */
+/* {{{ _read_pnm_header() */
+
+/*
+ * Parse the header of P5 (PGM), P6 (PPM) or P7 (PAM)
+ * Nothing is reported here, so that the caller can check whether
+ * a string looks like PNM data.
+ */
+static int
+_read_pnm_header(pnm_header_t *header, const byte_t *data, size_t size)
+{
+	const byte_t *ptr, *end = data + size;
+	size_t sample_size;
+
+	memset(header, 0, sizeof(pnm_header_t));
+	if (size < 3 || data[0] != 'P' || !_pnm_isspace(data[2])) {
+		return FAILURE;
+	}
+	ptr = data + 2;
+
+	if (data[1] == '5' || data[1] == '6') {
+		header->depth = (data[1] == '5') ? 1 : 3;
+		if ((ptr = _pnm_uint(ptr, end, &header->width)) == NULL
+			|| (ptr = _pnm_uint(ptr, end, &header->height)) == NULL
+			|| (ptr = _pnm_uint(ptr, end, &header->maxval)) == NULL
+			|| ptr == end || !_pnm_isspace(*ptr))
+		{
+			return FAILURE;
+		}
+		ptr++; /* a single whitespace */
+	} else if (data[1] == '7') {
+		header->depth = 0;
+		while (1) {
+			const byte_t *key;
+			size_t key_len;
+			int *value = NULL;
+
+			ptr = _pnm_skip(ptr, end);
+			key = ptr;
+			while (ptr < end && !_pnm_isspace(*ptr)) {
+				ptr++;
+			}
+			key_len = (size_t)(ptr - key);
+
+			if (key_len == 6 && !memcmp(key, "ENDHDR", 6)) {
+				if (ptr == end || *ptr != '\n') {
+					return FAILURE;
+				}
+				ptr++;
+				break;
+			} else if (key_len == 8 && !memcmp(key, "TUPLTYPE", 8)) {
+				/* the layout is determined by DEPTH */
+				while (ptr < end && *ptr != '\n') {
+					ptr++;
+				}
+				continue;
+			} else if (key_len == 5 && !memcmp(key, "WIDTH", 5)) {
+				value = &header->width;
+			} else if (key_len == 6 && !memcmp(key, "HEIGHT", 6)) {
+				value = &header->height;
+			} else if (key_len == 5 && !memcmp(key, "DEPTH", 5)) {
+				value = &header->depth;
+			} else if (key_len == 6 && !memcmp(key, "MAXVAL", 6)) {
+				value = &header->maxval;
+			} else {
+				return FAILURE;
+			}
+			if ((ptr = _pnm_uint(ptr, end, value)) == NULL) {
+				return FAILURE;
+			}
+		}
+	} else {
+		return FAILURE;
+	}
+
+	if (header->width < 1 || header->height < 1 || header->depth < 1 || header->depth > 4
+		|| header->maxval < 1)
+	{
+		return FAILURE;
+	}
+
+	sample_size = (header->maxval > 255) ? 2 : 1;
+	header->offset = (size_t)(ptr - data);
+	if ((size_t)header->width * (size_t)header->depth * sample_size
+			> (size - header->offset) / (size_t)header->height)
+	{
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ _decode_pnm() */
+
+/*
+ * Create a true color image from the samples
+ * Gray scale images are expanded to RGB, and images with the alpha
+ * channel (DEPTH 2 or 4) are created with the alpha channel saved.
+ */
+static gdImagePtr
+_decode_pnm(const pnm_header_t *header, const byte_t *data, size_t size TSRMLS_DC)
+{
+	gdImagePtr im;
+	const byte_t *ptr = data + header->offset;
+	int x, y, width, height, maxval, step;
+
+	width = header->width;
+	height = header->height;
+	maxval = header->maxval;
+	step = (maxval > 255) ? 2 : 1;
+
+	im = gdImageCreateTrueColor(width, height);
+	if (im == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to create an image");
+		return NULL;
+	}
+
+	for (y = 0; y < height; y++) {
+		int *dst = im->tpixels[y];
+
+		switch (header->depth) {
+			case 1:
+				for (x = 0; x < width; x++, ptr += step) {
+					int v = _pnm_sample(ptr, maxval);
+					dst[x] = gdTrueColor(v, v, v);
+				}
+				break;
+			case 2:
+				for (x = 0; x < width; x++, ptr += 2 * step) {
+					int v = _pnm_sample(ptr, maxval);
+					dst[x] = gdTrueColorAlpha(v, v, v, _gray2alpha(_pnm_sample(ptr + step, maxval)));
+				}
+				break;
+			case 3:
+				if (maxval == 255) {
+					for (x = 0; x < width; x++, ptr += 3) {
+						dst[x] = gdTrueColor(ptr[0], ptr[1], ptr[2]);
+					}
+				} else {
+					for (x = 0; x < width; x++, ptr += 3 * step) {
+						dst[x] = gdTrueColor(_pnm_sample(ptr, maxval),
+								_pnm_sample(ptr + step, maxval),
+								_pnm_sample(ptr + 2 * step, maxval));
+					}
+				}
+				break;
+			default:
+				if (maxval == 255) {
+					for (x = 0; x < width; x++, ptr += 4) {
+						dst[x] = gdTrueColorAlpha(ptr[0], ptr[1], ptr[2], _gray2alpha(ptr[3]));
+					}
+				} else {
+					for (x = 0; x < width; x++, ptr += 4 * step) {
+						dst[x] = gdTrueColorAlpha(_pnm_sample(ptr, maxval),
+								_pnm_sample(ptr + step, maxval),
+								_pnm_sample(ptr + 2 * step, maxval),
+								_gray2alpha(_pnm_sample(ptr + 3 * step, maxval)));
+					}
+				}
+		}
+	}
+
+	if (header->depth == 2 || header->depth == 4) {
+		im->saveAlphaFlag = 1;
+	}
+
+	return im;
+}
+
+/* }}} */
+/* {{{ _write_pnm() */
+
+/*
+ * Write the header and the samples as top-down rows to the output
+ */
+static zend_bool
+_write_pnm(gdex_output_t *output, const gdImagePtr im, int format TSRMLS_DC)
+{
+	byte_t *ptr;
+	int x, y, width, height, depth;
+
+	width = gdImageSX(im);
+	height = gdImageSY(im);
+
+	/* determine the format */
+	if (format == PNM_AUTO) {
+		int use_alpha;
+
+		if (gdImageTrueColor(im)) {
+			use_alpha = im->saveAlphaFlag;
+		} else {
+			int i, colors = gdImageColorsTotal(im);
+			use_alpha = (gdImageGetTransparent(im) != -1);
+			for (i = 0; i < colors && !use_alpha; i++) {
+				use_alpha = (paletteA(im, i) != gdAlphaOpaque);
+			}
+		}
+		format = (use_alpha) ? PNM_PAM : PNM_PPM;
+	}
+
+	/* write the header */
+	switch (format) {
+		case PNM_PPM:
+			depth = 3;
+			output->used = (size_t)snprintf((char *)output->buffer, GDEX_OUTPUT_BUFFER_SIZE,
+					"P6\n%d %d\n255\n", width, height);
+			break;
+		case PNM_PGM:
+			depth = 1;
+			output->used = (size_t)snprintf((char *)output->buffer, GDEX_OUTPUT_BUFFER_SIZE,
+					"P5\n%d %d\n255\n", width, height);
+			break;
+		case PNM_PAM:
+			depth = 4;
+			output->used = (size_t)snprintf((char *)output->buffer, GDEX_OUTPUT_BUFFER_SIZE,
+					"P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+					width, height);
+			break;
+		default:
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Unsupported format (%d)", format);
+			return 0;
+	}
+
+	/* write the samples */
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			int c = _get_pixel(im, x, y);
+
+			if (output->used + 4 > GDEX_OUTPUT_BUFFER_SIZE) {
+				gdex_output_flush(output TSRMLS_CC);
+			}
+			ptr = output->buffer + output->used;
+
+			if (depth == 1) {
+				*ptr = (byte_t)_rgb2gray(getR(c), getG(c), getB(c));
+			} else {
+				ptr[0] = (byte_t)getR(c);
+				ptr[1] = (byte_t)getG(c);
+				ptr[2] = (byte_t)getB(c);
+				if (depth == 4) {
+					ptr[3] = (byte_t)_alpha2gray(getA(c));
+				}
+			}
+			output->used += (size_t)depth;
+		}
+	}
+
+	return 1;
+}
+
+/* }}} */
+/* {{{ bool imagepam(resource im[, string filename[, int format]]) */
+
+/*
+ * Output a PPM, PGM or PAM image to either the browser or a file
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagepam)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	char *filename = NULL;
+	int filename_len = 0;
+	long format = PNM_AUTO;
+	gdex_output_t output;
+	zend_bool success;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|sl",
+			&zim, &filename, &filename_len, &format) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	if (format < PNM_AUTO || format > PNM_PAM) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Unsupported format (%ld)", format);
+		RETURN_FALSE;
+	}
+
+	/* write the image */
+	if (gdex_output_open(&output, ((filename_len > 0) ? filename : NULL) TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	success = _write_pnm(&output, im, (int)format TSRMLS_CC);
+	if (!gdex_output_close(&output TSRMLS_CC)) {
+		success = 0;
+	}
+
+	RETURN_BOOL(success);
+}
+
+/* }}} */
+/* {{{ resource imagecreatefrompam(string input) */
+
+/*
+ * Create a new image from a PPM, PGM or PAM file or data string
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefrompam)
+{
+	char *str = NULL;
+	int str_len = 0;
+	gdex_input_t input;
+	pnm_header_t header;
+	gdImagePtr im = NULL;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s",
+			&str, &str_len) == FAILURE)
+	{
+		return;
+	}
+
+	/* decode the string itself if it has a valid header */
+	if (_read_pnm_header(&header, (const byte_t *)str, (size_t)str_len) == SUCCESS) {
+		im = _decode_pnm(&header, (const byte_t *)str, (size_t)str_len TSRMLS_CC);
+	} else {
+		if (gdex_input_open(&input, str TSRMLS_CC) == FAILURE) {
+			RETURN_FALSE;
+		}
+		if (_read_pnm_header(&header, input.data, input.size) == SUCCESS) {
+			im = _decode_pnm(&header, input.data, input.size TSRMLS_CC);
+		} else {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING,
+					"'%s' is not a valid PPM, PGM or PAM image", str);
+		}
+		gdex_input_close(&input TSRMLS_CC);
+	}
+	if (im == NULL) {
+		RETURN_FALSE;
+	}
+
+	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+}
+
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
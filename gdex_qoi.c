@@ -0,0 +1,429 @@
+/*
+ * Extra image functions: QOI reader/writer functions
+ *
+ * Copyright (c) 2007-2012 Ryusuke SEKIYAMA. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * @package     php-gdextra
+ * @author      Ryusuke SEKIYAMA <rsky0711@gmail.com>
+ * @copyright   2007-2012 Ryusuke SEKIYAMA
+ * @license     http://www.opensource.org/licenses/mit-license.php  MIT License
+ */
+
+#include "php_gdextra.h"
+#include <stdint.h>
+
+ZEND_EXTERN_MODULE_GLOBALS(gdextra);
+
+/* {{{ macros */
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE  14
+#define QOI_PADDING_SIZE 8
+#define QOI_PIXELS_MAX   400000000U
+
+#define QOI_HASH(r, g, b, a) \
+	((((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11)) & 63)
+
+/* }}} */
+/* {{{ type definitions */
+
+typedef unsigned char byte_t;
+
+/*
+ * RGBA pixel in QOI's byte order.
+ */
+typedef struct {
+	byte_t r;
+	byte_t g;
+	byte_t b;
+	byte_t a;
+} qoi_rgba_t;
+
+/* }}} */
+/* {{{ private function prototypes */
+
+static zend_bool
+_write_qoi(gdex_output_t *output, const gdImagePtr im TSRMLS_DC);
+
+/* }}} */
+/* {{{ inline functions */
+
+static inline byte_t *
+_write_uint32be(byte_t *ptr, uint32_t n)
+{
+	*ptr++ = (byte_t)(0xffU & (n >> 24));
+	*ptr++ = (byte_t)(0xffU & (n >> 16));
+	*ptr++ = (byte_t)(0xffU & (n >> 8));
+	*ptr++ = (byte_t)(0xffU & n);
+	return ptr;
+}
+
+static inline uint32_t
+_read_uint32be(const byte_t *ptr)
+{
+	return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16)
+		| ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+/*
+ * Get the pixel at (x, y) as 8-bit RGBA.
+ */
+static inline qoi_rgba_t
+_get_rgba(const gdImagePtr im, int x, int y, zend_bool use_alpha)
+{
+	qoi_rgba_t px;
+	int c, a;
+
+	if (gdImageTrueColor(im)) {
+		c = unsafeGetTrueColorPixel(im, x, y);
+		px.r = (byte_t)getR(c);
+		px.g = (byte_t)getG(c);
+		px.b = (byte_t)getB(c);
+		a = getA(c);
+	} else {
+		c = unsafeGetPalettePixel(im, x, y);
+		px.r = (byte_t)paletteR(im, c);
+		px.g = (byte_t)paletteG(im, c);
+		px.b = (byte_t)paletteB(im, c);
+		a = (c == gdImageGetTransparent(im)) ? gdAlphaTransparent : paletteA(im, c);
+	}
+	px.a = (byte_t)((use_alpha) ? _alpha2gray(a) : 255);
+
+	return px;
+}
+
+/* }}} */
+/* {{{ _write_qoi() */
+
+/*
+ * Encode the image and write it to the output
+ * At most 5 bytes are written for a pixel, so the buffer is flushed
+ * only when less than that is left.
+ */
+static zend_bool
+_write_qoi(gdex_output_t *output, const gdImagePtr im TSRMLS_DC)
+{
+	qoi_rgba_t index[64], px, prev;
+	int x, y, width, height, run = 0;
+	zend_bool use_alpha;
+	byte_t *ptr;
+
+	width = gdImageSX(im);
+	height = gdImageSY(im);
+	if ((uint32_t)width > QOI_PIXELS_MAX / (uint32_t)height) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Image too large");
+		return 0;
+	}
+
+	/* true color images without the alpha channel are stored as RGB */
+	if (gdImageTrueColor(im)) {
+		use_alpha = (zend_bool)im->saveAlphaFlag;
+	} else {
+		int i, colors = gdImageColorsTotal(im);
+		use_alpha = (zend_bool)(gdImageGetTransparent(im) != -1);
+		for (i = 0; i < colors && !use_alpha; i++) {
+			use_alpha = (zend_bool)(paletteA(im, i) != gdAlphaOpaque);
+		}
+	}
+
+	/* write the header */
+	ptr = output->buffer;
+	memcpy(ptr, "qoif", 4);
+	ptr = _write_uint32be(ptr + 4, (uint32_t)width);
+	ptr = _write_uint32be(ptr, (uint32_t)height);
+	*ptr++ = (use_alpha) ? 4 : 3; /* channels */
+	*ptr++ = 0; /* colorspace: sRGB with linear alpha */
+	output->used = QOI_HEADER_SIZE;
+
+	/* write the pixels */
+	memset(index, 0, sizeof(index));
+	prev.r = prev.g = prev.b = 0;
+	prev.a = 255;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			int h;
+
+			px = _get_rgba(im, x, y, use_alpha);
+			if (px.r == prev.r && px.g == prev.g && px.b == prev.b && px.a == prev.a) {
+				if (++run < 62) {
+					continue;
+				}
+			}
+
+			if (output->used + 6 > GDEX_OUTPUT_BUFFER_SIZE) {
+				gdex_output_flush(output TSRMLS_CC);
+			}
+			ptr = output->buffer + output->used;
+
+			if (run > 0) {
+				*ptr++ = (byte_t)(QOI_OP_RUN | (run - 1));
+				if (run == 62) {
+					run = 0;
+					output->used = (size_t)(ptr - output->buffer);
+					continue;
+				}
+				run = 0;
+			}
+
+			h = QOI_HASH(px.r, px.g, px.b, px.a);
+			if (index[h].r == px.r && index[h].g == px.g
+					&& index[h].b == px.b && index[h].a == px.a)
+			{
+				*ptr++ = (byte_t)(QOI_OP_INDEX | h);
+			} else {
+				index[h] = px;
+				if (px.a == prev.a) {
+					signed char vr = (signed char)(px.r - prev.r);
+					signed char vg = (signed char)(px.g - prev.g);
+					signed char vb = (signed char)(px.b - prev.b);
+					signed char vg_r = (signed char)(vr - vg);
+					signed char vg_b = (signed char)(vb - vg);
+
+					if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+						*ptr++ = (byte_t)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+					} else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32
+							&& vg_b > -9 && vg_b < 8)
+					{
+						*ptr++ = (byte_t)(QOI_OP_LUMA | (vg + 32));
+						*ptr++ = (byte_t)((vg_r + 8) << 4 | (vg_b + 8));
+					} else {
+						*ptr++ = QOI_OP_RGB;
+						*ptr++ = px.r;
+						*ptr++ = px.g;
+						*ptr++ = px.b;
+					}
+				} else {
+					*ptr++ = QOI_OP_RGBA;
+					*ptr++ = px.r;
+					*ptr++ = px.g;
+					*ptr++ = px.b;
+					*ptr++ = px.a;
+				}
+			}
+			output->used = (size_t)(ptr - output->buffer);
+			prev = px;
+		}
+	}
+
+	/* write the last run and the end marker */
+	if (output->used + 1 + QOI_PADDING_SIZE > GDEX_OUTPUT_BUFFER_SIZE) {
+		gdex_output_flush(output TSRMLS_CC);
+	}
+	ptr = output->buffer + output->used;
+	if (run > 0) {
+		*ptr++ = (byte_t)(QOI_OP_RUN | (run - 1));
+	}
+	memcpy(ptr, "\0\0\0\0\0\0\0\1", QOI_PADDING_SIZE);
+	output->used = (size_t)(ptr - output->buffer) + QOI_PADDING_SIZE;
+
+	return 1;
+}
+
+/* }}} */
+/* {{{ gdex_qoi_decode() */
+
+/*
+ * Decode QOI data
+ * Images with 4 channels are created with the alpha channel saved.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_qoi_decode(const unsigned char *data, size_t size TSRMLS_DC)
+{
+	gdImagePtr im;
+	qoi_rgba_t index[64], px;
+	const byte_t *ptr, *end;
+	uint32_t width, height;
+	int x, y, channels, run = 0;
+
+	if (size < QOI_HEADER_SIZE + QOI_PADDING_SIZE || memcmp(data, "qoif", 4) != 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Not a QOI image");
+		return NULL;
+	}
+	width = _read_uint32be(data + 4);
+	height = _read_uint32be(data + 8);
+	channels = (int)data[12];
+	if (width == 0 || height == 0 || width > QOI_PIXELS_MAX / height
+			|| (channels != 3 && channels != 4) || data[13] > 1)
+	{
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Invalid QOI header");
+		return NULL;
+	}
+
+	im = gdImageCreateTrueColor((int)width, (int)height);
+	if (im == NULL) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to create an image");
+		return NULL;
+	}
+
+	memset(index, 0, sizeof(index));
+	px.r = px.g = px.b = 0;
+	px.a = 255;
+	ptr = data + QOI_HEADER_SIZE;
+	end = data + size - QOI_PADDING_SIZE;
+
+	for (y = 0; y < (int)height; y++) {
+		int *dst = im->tpixels[y];
+
+		for (x = 0; x < (int)width; x++) {
+			if (run > 0) {
+				run--;
+			} else if (ptr < end) {
+				int b1 = *ptr++;
+
+				if (b1 == QOI_OP_RGB) {
+					px.r = ptr[0];
+					px.g = ptr[1];
+					px.b = ptr[2];
+					ptr += 3;
+				} else if (b1 == QOI_OP_RGBA) {
+					px.r = ptr[0];
+					px.g = ptr[1];
+					px.b = ptr[2];
+					px.a = ptr[3];
+					ptr += 4;
+				} else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+					px = index[b1];
+				} else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+					px.r += ((b1 >> 4) & 3) - 2;
+					px.g += ((b1 >> 2) & 3) - 2;
+					px.b += (b1 & 3) - 2;
+				} else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+					int b2 = *ptr++;
+					int vg = (b1 & 0x3f) - 32;
+					px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+					px.g += vg;
+					px.b += vg - 8 + (b2 & 0x0f);
+				} else {
+					run = b1 & 0x3f;
+				}
+				index[QOI_HASH(px.r, px.g, px.b, px.a)] = px;
+			} else {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "Truncated QOI data");
+				gdImageDestroy(im);
+				return NULL;
+			}
+
+			dst[x] = gdTrueColorAlpha(px.r, px.g, px.b, _gray2alpha(px.a));
+		}
+	}
+
+	if (channels == 4) {
+		im->saveAlphaFlag = 1;
+	}
+
+	return im;
+}
+
+/* }}} */
+/* {{{ bool imageqoi(resource im[, string filename]) */
+
+/*
+ * Output a QOI image to either the browser or a file
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imageqoi)
+{
+	zval *zim = NULL;
+	gdImagePtr im = NULL;
+	char *filename = NULL;
+	int filename_len = 0;
+	gdex_output_t output;
+	zend_bool success;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|s",
+			&zim, &filename, &filename_len) == FAILURE)
+	{
+		return;
+	}
+	ZEND_FETCH_RESOURCE(im, gdImagePtr, &zim, -1, "Image", GDEXG(le_gd));
+
+	/* write the image */
+	if (gdex_output_open(&output, ((filename_len > 0) ? filename : NULL) TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	success = _write_qoi(&output, im TSRMLS_CC);
+	if (!success) {
+		output.used = 0;
+	}
+	if (!gdex_output_close(&output TSRMLS_CC)) {
+		success = 0;
+	}
+
+	RETURN_BOOL(success);
+}
+
+/* }}} */
+/* {{{ resource imagecreatefromqoi(string input) */
+
+/*
+ * Create a new image from a QOI file or a QOI data string
+ */
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefromqoi)
+{
+	char *str = NULL;
+	int str_len = 0;
+	gdex_input_t input;
+	gdImagePtr im;
+
+	/* parse the arguments */
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s",
+			&str, &str_len) == FAILURE)
+	{
+		return;
+	}
+
+	/* decode the string itself if it has the signature and the end marker */
+	if (str_len >= QOI_HEADER_SIZE + QOI_PADDING_SIZE && memcmp(str, "qoif", 4) == 0
+			&& memcmp(str + str_len - QOI_PADDING_SIZE, "\0\0\0\0\0\0\0\1", QOI_PADDING_SIZE) == 0)
+	{
+		im = gdex_qoi_decode((const byte_t *)str, (size_t)str_len TSRMLS_CC);
+	} else {
+		if (gdex_input_open(&input, str TSRMLS_CC) == FAILURE) {
+			RETURN_FALSE;
+		}
+		im = gdex_qoi_decode(input.data, input.size TSRMLS_CC);
+		gdex_input_close(&input TSRMLS_CC);
+	}
+	if (im == NULL) {
+		RETURN_FALSE;
+	}
+
+	ZEND_REGISTER_RESOURCE(return_value, im, GDEXG(le_gd));
+}
+
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -277,6 +277,35 @@ _ex_gdImageSaveAlpha(gdImagePtr im, int saveAlphaArg)
 	im->saveAlphaFlag = saveAlphaArg;
 }
 
+/* }}} */
+/* {{{ _ex_gdImageCreateFromString() */
+
+GDEXTRA_LOCAL gdImagePtr
+_ex_gdImageCreateFromString(int size, void *data)
+{
+	TSRMLS_FETCH();
+	gdImagePtr im = NULL;
+	zval *retval = NULL, *args, *zdata;
+
+	MAKE_STD_ZVAL(zdata);
+	ZVAL_STRINGL(zdata, (char *)data, size, 1);
+
+	args = _gdex_init_args(1 TSRMLS_CC, zdata);
+	zend_fcall_info_call(&GDEXG(func_createfromstring).fci,
+	                     &GDEXG(func_createfromstring).fcc,
+	                     &retval, args TSRMLS_CC);
+	if (retval) {
+		if (Z_TYPE_P(retval) == IS_RESOURCE) {
+			ZEND_FETCH_RESOURCE_NO_RETURN(im, gdImagePtr, &retval, -1, "Image", GDEXG(le_gd));
+			_gdex_fake_resource(retval TSRMLS_CC);
+		}
+		zval_ptr_dtor(&retval);
+	}
+	zval_ptr_dtor(&args);
+
+	return im;
+}
+
 /* }}} */
 /* {{{ _gdex_init_args() */
 
@@ -70,6 +70,9 @@ _ex_gdImageCopyResampled(gdImagePtr dst,
 GDEXTRA_LOCAL void
 _ex_gdImageSaveAlpha(gdImagePtr im, int saveAlphaArg);
 
+GDEXTRA_LOCAL gdImagePtr
+_ex_gdImageCreateFromString(int size, void *data);
+
 END_EXTERN_C()
 
 #if GDEXTRA_USE_WRAPPERS
@@ -81,6 +84,9 @@ END_EXTERN_C()
 #undef gdImageCopy
 #undef gdImageCopyResampled
 #undef gdImageSaveAlpha
+#undef gdImageCreateFromPngPtr
+#undef gdImageCreateFromJpegPtr
+#undef gdImageCreateFromGifPtr
 
 #define gdImageCreate(sx, sy)           _ex_gdImageCreate((sx), (sy), 0)
 #define gdImageCreateTrueColor(sx, sy)  _ex_gdImageCreate((sx), (sy), 1)
@@ -89,6 +95,9 @@ END_EXTERN_C()
 #define gdImageCopy                     _ex_gdImageCopy
 #define gdImageCopyResampled            _ex_gdImageCopyResampled
 #define gdImageSaveAlpha                _ex_gdImageSaveAlpha
+#define gdImageCreateFromPngPtr         _ex_gdImageCreateFromString
+#define gdImageCreateFromJpegPtr        _ex_gdImageCreateFromString
+#define gdImageCreateFromGifPtr         _ex_gdImageCreateFromString
 
 #endif /* GDEXTRA_USE_WRAPPERS */
 
@@ -28,6 +28,9 @@
  */
 
 #include "php_gdextra.h"
+#if PHP_GDEXTRA_WITH_PTHREADS
+#include <unistd.h>
+#endif
 
 #define PHP_GDEXTRA_MODULE_VERSION "0.5.0"
 
@@ -38,6 +41,8 @@
 static HashTable _svg_color_table;
 
 static zend_class_entry *ce_util = NULL;
+static zend_class_entry *ce_corrector = NULL;
+static zend_class_entry *ce_clut = NULL;
 
 /* }}} */
 /* {{{ module globals */
@@ -73,6 +78,20 @@ ARG_INFO_STATIC
 ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecreatebymagick, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
 	ZEND_ARG_INFO(0, filename)
 	ZEND_ARG_INFO(0, is_blob)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecreatefromstring, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, data)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagewritebymagick, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_INFO(0, format)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
 ZEND_END_ARG_INFO()
 #endif /* PHP_GDEXTRA_WITH_MAGICK */
 
@@ -93,6 +112,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_imagechannelmerge, ZEND_SEND_BY_VAL, ZEND_RETURN_
 	ZEND_ARG_ARRAY_INFO(0, channels, 0)
 	ZEND_ARG_INFO(0, colorspace)
 	ZEND_ARG_INFO(0, position)
+	ZEND_ARG_INFO(0, width)
 ZEND_END_ARG_INFO()
 
 ARG_INFO_STATIC
@@ -109,6 +129,84 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_imagewrite, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE,
 	ZEND_ARG_INFO(0, filename)
 ZEND_END_ARG_INFO()
 
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagebmp, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_INFO(0, rle)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imageicon, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imageiconfromimage, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_ARRAY_INFO(0, sizes, 0)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO(arginfo_imagecreatefrom, ZEND_SEND_BY_VAL)
+	ZEND_ARG_INFO(0, filename)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecreatefromicon, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_INFO(0, size)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imageqoi, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, filename)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecreatefromqoi, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, input)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagepam, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_INFO(0, format)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecreatefrompam, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, input)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagegetpixels, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, format)
+	ZEND_ARG_ARRAY_INFO(0, region, 1)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagesetpixels, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, format)
+	ZEND_ARG_INFO(0, data)
+	ZEND_ARG_ARRAY_INFO(0, region, 1)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagefastpng, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+ZEND_END_ARG_INFO()
+
 ARG_INFO_STATIC
 ZEND_BEGIN_ARG_INFO_EX(arginfo_imagetowebsafepalette, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
 	ZEND_ARG_INFO(0, im)
@@ -156,6 +254,21 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecolorcorrect, ZEND_SEND_BY_VAL, ZEND_RETURN_
 	ZEND_ARG_INFO(0, colorspace)
 ZEND_END_ARG_INFO()
 
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO(arginfo_imageapplyclut, ZEND_SEND_BY_VAL)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, lut)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imageapplylut, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 4)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_INFO(0, red)
+	ZEND_ARG_INFO(0, green)
+	ZEND_ARG_INFO(0, blue)
+	ZEND_ARG_INFO(0, alpha)
+ZEND_END_ARG_INFO()
+
 ARG_INFO_STATIC
 ZEND_BEGIN_ARG_INFO(arginfo_imageflip, ZEND_SEND_BY_VAL)
 	ZEND_ARG_INFO(0, im)
@@ -171,7 +284,6 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_imagescale, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE,
 	ZEND_ARG_ARRAY_INFO(0, options, 1)
 ZEND_END_ARG_INFO()
 
-#if PHP_GDEXTRA_WITH_LQR
 ARG_INFO_STATIC
 ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecarve, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
 	ZEND_ARG_INFO(0, im)
@@ -179,8 +291,23 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecarve, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE,
 	ZEND_ARG_INFO(0, height)
 	ZEND_ARG_ARRAY_INFO(0, options, 1)
 ZEND_END_ARG_INFO()
+
+#if PHP_GDEXTRA_WITH_LQR
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagecarvemulti, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_ARRAY_INFO(0, sizes, 0)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+	ZEND_ARG_INFO(1, vmap)
+ZEND_END_ARG_INFO()
 #endif /* PHP_GDEXTRA_WITH_LQR */
 
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_imagepipeline, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, im)
+	ZEND_ARG_ARRAY_INFO(0, operations, 0)
+ZEND_END_ARG_INFO()
+
 ARG_INFO_STATIC
 ZEND_BEGIN_ARG_INFO(arginfo_util_conv_from_cmyk, ZEND_SEND_BY_VAL)
 	ZEND_ARG_INFO(0, cyan)
@@ -215,6 +342,17 @@ ZEND_BEGIN_ARG_INFO(arginfo_util_parsecsscolor, ZEND_SEND_BY_VAL)
 	ZEND_ARG_INFO(0, color)
 ZEND_END_ARG_INFO()
 
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO_EX(arginfo_corrector_construct, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_ARRAY_INFO(0, params, 0)
+	ZEND_ARG_INFO(0, colorspace)
+ZEND_END_ARG_INFO()
+
+ARG_INFO_STATIC
+ZEND_BEGIN_ARG_INFO(arginfo_clut_construct, ZEND_SEND_BY_VAL)
+	ZEND_ARG_INFO(0, filename)
+ZEND_END_ARG_INFO()
+
 /* }}} */
 /* {{{ gdextra_functions[] */
 
@@ -227,6 +365,14 @@ ZEND_END_ARG_INFO()
 static zend_function_entry gdextra_functions[] = {
 #if PHP_GDEXTRA_WITH_MAGICK
 	GDEX_FE(imagecreatebymagick,     arginfo_imagecreatebymagick)
+	GDEX_FE(imagewritebymagick,      arginfo_imagewritebymagick)
+#if PHP_VERSION_ID >= 50300
+#if PHP_GDEXTRA_ADD_FUNCTION_NAME_SUFFIX
+	GDEX_NS_FALIAS(imagecreatefromstring, imagecreatefromstring_ex, arginfo_imagecreatefromstring)
+#else
+	GDEX_NS_FALIAS(imagecreatefromstring, imagecreatefromstring, arginfo_imagecreatefromstring)
+#endif
+#endif
 #endif
 	GDEX_FE(imageclone,              arginfo_image)
 	GDEX_FE(imagehistgram,           arginfo_imagehistgram)
@@ -234,8 +380,18 @@ static zend_function_entry gdextra_functions[] = {
 	GDEX_FE(imagechannelextract,     arginfo_imagechannelextract)
 	GDEX_FE(imagechannelmerge,       arginfo_imagechannelmerge)
 	GDEX_FE(imagealphamask,          arginfo_imagealphamask)
-	GDEX_FE(imagebmp,                arginfo_imagewrite)
-	GDEX_FE(imageicon,               arginfo_imagewrite)
+	GDEX_FE(imagebmp,                arginfo_imagebmp)
+	GDEX_FE(imagecreatefrombmp,      arginfo_imagecreatefrom)
+	GDEX_FE(imageicon,               arginfo_imageicon)
+	GDEX_FE(imageiconfromimage,      arginfo_imageiconfromimage)
+	GDEX_FE(imagecreatefromicon,     arginfo_imagecreatefromicon)
+	GDEX_FE(imageqoi,                arginfo_imageqoi)
+	GDEX_FE(imagecreatefromqoi,      arginfo_imagecreatefromqoi)
+	GDEX_FE(imagepam,                arginfo_imagepam)
+	GDEX_FE(imagecreatefrompam,      arginfo_imagecreatefrompam)
+	GDEX_FE(imagegetpixels,          arginfo_imagegetpixels)
+	GDEX_FE(imagesetpixels,          arginfo_imagesetpixels)
+	GDEX_FE(imagefastpng,            arginfo_imagefastpng)
 	GDEX_FE(imagepalettetotruecolor, arginfo_image)
 	GDEX_FE(imagetowebsafepalette,   arginfo_imagetowebsafepalette)
 	GDEX_FE(imagecolorallocatecss,   arginfo_imagecolorallocatecss)
@@ -243,11 +399,15 @@ static zend_function_entry gdextra_functions[] = {
 	GDEX_FE(imagecolorallocatehsl,   arginfo_imagecolorallocatehsl)
 	GDEX_FE(imagecolorallocatehsv,   arginfo_imagecolorallocatehsv)
 	GDEX_FE(imagecolorcorrect,       arginfo_imagecolorcorrect)
+	GDEX_FE(imageapplyclut,          arginfo_imageapplyclut)
+	GDEX_FE(imageapplylut,           arginfo_imageapplylut)
 	GDEX_FE(imageflip,               arginfo_imageflip)
 	GDEX_FE(imagescale,              arginfo_imagescale)
-#if PHP_GDEXTRA_WITH_LQR
 	GDEX_FE(imagecarve,              arginfo_imagecarve)
+#if PHP_GDEXTRA_WITH_LQR
+	GDEX_FE(imagecarvemulti,         arginfo_imagecarvemulti)
 #endif
+	GDEX_FE(imagepipeline,           arginfo_imagepipeline)
 	{ NULL, NULL, NULL }
 };
 
@@ -269,6 +429,26 @@ static zend_function_entry gdextra_colorutility_methods[] = {
 	{ NULL, NULL, NULL }
 };
 
+/* }}} */
+/* {{{ gdextra_colorcorrector_methods[] */
+
+static zend_function_entry gdextra_colorcorrector_methods[] = {
+	PHP_ME(ColorCorrector, __construct, arginfo_corrector_construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	PHP_ME(ColorCorrector, apply,       arginfo_image,               ZEND_ACC_PUBLIC)
+	{ NULL, NULL, NULL }
+};
+
+/* }}} */
+/* {{{ gdextra_colorlookuptable_methods[] */
+
+static zend_function_entry gdextra_colorlookuptable_methods[] = {
+	PHP_ME(ColorLookupTable, __construct,   arginfo_clut_construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	PHP_ME(ColorLookupTable, fromHaldImage, arginfo_image,          ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	PHP_ME(ColorLookupTable, getSize,       NULL,                   ZEND_ACC_PUBLIC)
+	PHP_ME(ColorLookupTable, apply,         arginfo_image,          ZEND_ACC_PUBLIC)
+	{ NULL, NULL, NULL }
+};
+
 /* }}} */
 /* {{{ cross-extension dependencies */
 
@@ -305,6 +485,25 @@ static zend_module_entry gdextra_module_entry = {
 ZEND_GET_MODULE(gdextra)
 #endif
 
+/* {{{ ini entries */
+
+PHP_INI_BEGIN()
+	STD_PHP_INI_ENTRY("gdextra.threads", "1", PHP_INI_SYSTEM,
+			OnUpdateLong, threads, zend_gdextra_globals, gdextra_globals)
+#if PHP_GDEXTRA_WITH_MAGICK
+	STD_PHP_INI_ENTRY("gdextra.magick_threads", "0", PHP_INI_SYSTEM,
+			OnUpdateLong, magick_threads, zend_gdextra_globals, gdextra_globals)
+	STD_PHP_INI_ENTRY("gdextra.magick_memory_limit", "0", PHP_INI_SYSTEM,
+			OnUpdateLong, magick_memory_limit, zend_gdextra_globals, gdextra_globals)
+	STD_PHP_INI_ENTRY("gdextra.magick_map_limit", "0", PHP_INI_SYSTEM,
+			OnUpdateLong, magick_map_limit, zend_gdextra_globals, gdextra_globals)
+	STD_PHP_INI_ENTRY("gdextra.magick_disk_limit", "0", PHP_INI_SYSTEM,
+			OnUpdateLong, magick_disk_limit, zend_gdextra_globals, gdextra_globals)
+#endif
+PHP_INI_END()
+
+/* }}} */
+
 #define GDEX_REGISTER_CONSTANT(name) \
 	REGISTER_LONG_CONSTANT("IMAGE_EX_" #name, name, CONST_PERSISTENT | CONST_CS)
 
@@ -327,6 +526,11 @@ static PHP_MINIT_FUNCTION(gdextra)
 
 	gdex_mask_alpha_funcs_init();
 
+	REGISTER_INI_ENTRIES();
+#if PHP_GDEXTRA_WITH_MAGICK
+	gdex_magick_startup(TSRMLS_C);
+#endif
+
 #if GDEXTRA_USE_WRAPPERS
 	if (gdex_wrappers_init(INIT_FUNC_ARGS_PASSTHRU) == FAILURE) {
 		return FAILURE;
@@ -340,6 +544,7 @@ static PHP_MINIT_FUNCTION(gdextra)
 	GDEX_REGISTER_CONSTANT(COLORSPACE_CMYK);
 	GDEX_REGISTER_CONSTANT(COLORSPACE_ALPHA);
 	GDEX_REGISTER_CONSTANT(COLORSPACE_RAW_ALPHA);
+	GDEX_REGISTER_CONSTANT(COLORSPACE_PLANAR);
 	GDEX_REGISTER_CONSTANT(MASK_SET);
 	GDEX_REGISTER_CONSTANT(MASK_MERGE);
 	GDEX_REGISTER_CONSTANT(MASK_SCREEN);
@@ -369,9 +574,18 @@ static PHP_MINIT_FUNCTION(gdextra)
 	GDEX_REGISTER_CONSTANT(SCALE_PAD);
 	GDEX_REGISTER_CONSTANT(SCALE_STRETCH);
 	GDEX_REGISTER_CONSTANT(SCALE_TILE);
-#if PHP_GDEXTRA_WITH_LQR
 	GDEX_REGISTER_CONSTANT(SCALE_CARVE);
-#endif
+	GDEX_REGISTER_CONSTANT(ICON_LARGEST);
+	GDEX_REGISTER_CONSTANT(ICON_ALL);
+	GDEX_REGISTER_CONSTANT(PNM_AUTO);
+	GDEX_REGISTER_CONSTANT(PNM_PPM);
+	GDEX_REGISTER_CONSTANT(PNM_PGM);
+	GDEX_REGISTER_CONSTANT(PNM_PAM);
+	GDEX_REGISTER_CONSTANT(PIXELS_RGBA8);
+	GDEX_REGISTER_CONSTANT(PIXELS_BGRA8);
+	GDEX_REGISTER_CONSTANT(PIXELS_RGB8);
+	GDEX_REGISTER_CONSTANT(PIXELS_GRAY8);
+	GDEX_REGISTER_CONSTANT(PIXELS_ARGB32);
 
 	/* register class ColorUtility */
 	memset(&ce, 0, sizeof(zend_class_entry));
@@ -380,6 +594,24 @@ static PHP_MINIT_FUNCTION(gdextra)
 		return FAILURE;
 	}
 
+	/* register class ColorCorrector */
+	memset(&ce, 0, sizeof(zend_class_entry));
+	INIT_CLASS_ENTRY(ce, "ColorCorrector", gdextra_colorcorrector_methods);
+	ce.create_object = gdex_corrector_object_new;
+	if ((ce_corrector = zend_register_internal_class(&ce TSRMLS_CC)) == NULL) {
+		return FAILURE;
+	}
+	gdex_corrector_class_init(ce_corrector);
+
+	/* register class ColorLookupTable */
+	memset(&ce, 0, sizeof(zend_class_entry));
+	INIT_CLASS_ENTRY(ce, "ColorLookupTable", gdextra_colorlookuptable_methods);
+	ce.create_object = gdex_clut_object_new;
+	if ((ce_clut = zend_register_internal_class(&ce TSRMLS_CC)) == NULL) {
+		return FAILURE;
+	}
+	gdex_clut_class_init(ce_clut);
+
 	return SUCCESS;
 }
 
@@ -390,6 +622,11 @@ static PHP_MSHUTDOWN_FUNCTION(gdextra)
 {
 	zend_hash_destroy(&_svg_color_table);
 
+#if PHP_GDEXTRA_WITH_MAGICK
+	gdex_magick_shutdown();
+#endif
+	UNREGISTER_INI_ENTRIES();
+
 	return SUCCESS;
 }
 
@@ -398,6 +635,9 @@ static PHP_MSHUTDOWN_FUNCTION(gdextra)
 
 static PHP_RINIT_FUNCTION(gdextra)
 {
+#if PHP_GDEXTRA_WITH_LQR
+	GDEXG(lqr_context) = NULL;
+#endif
 #if GDEXTRA_USE_WRAPPERS
 #define GDEX_FCALL_INFO_INIT(name) \
 	if (gdex_fcall_info_init("image" #name, \
@@ -411,6 +651,7 @@ static PHP_RINIT_FUNCTION(gdextra)
 	GDEX_FCALL_INFO_INIT(copy);
 	GDEX_FCALL_INFO_INIT(copyresampled);
 /*	GDEX_FCALL_INFO_INIT(savealpha);*/
+	GDEX_FCALL_INFO_INIT(createfromstring);
 #undef GDEX_FCALL_INFO_INIT
 #endif
 	return SUCCESS;
@@ -431,6 +672,7 @@ static PHP_RSHUTDOWN_FUNCTION(gdextra)
 	GDEX_FCALL_INFO_DESTROY(copy);
 	GDEX_FCALL_INFO_DESTROY(copyresampled);
 /*	GDEX_FCALL_INFO_DESTROY(savealpha);*/
+	GDEX_FCALL_INFO_DESTROY(createfromstring);
 #undef GDEX_FCALL_INFO_DESTROY
 #endif
 	return SUCCESS;
@@ -453,10 +695,19 @@ static PHP_MINFO_FUNCTION(gdextra)
 #if PHP_GDEXTRA_WITH_MAGICK
 	php_info_print_table_row(2, "ImageMagick Loader Support", "enabled");
 	php_info_print_table_row(2, "ImageMagick Version", gdex_get_magick_version());
+	gdex_magick_info();
 #else
 	php_info_print_table_row(2, "ImageMagick Loader Support", "disabled");
+#endif
+#if PHP_GDEXTRA_WITH_PTHREADS
+	php_info_print_table_row(2, "Threaded PNG Encoder", "enabled");
+	php_info_print_table_row(2, "Threaded Seam Carver", "enabled");
+#else
+	php_info_print_table_row(2, "Threaded PNG Encoder", "disabled");
+	php_info_print_table_row(2, "Threaded Seam Carver", "disabled");
 #endif
 	php_info_print_table_end();
+	DISPLAY_INI_ENTRIES();
 }
 
 /* }}} */
@@ -623,6 +874,30 @@ gdex_calc_offset(int target, int length, int mode)
 	}
 }
 
+/* }}} */
+/* {{{ gdex_get_threads() */
+
+/*
+ * Get the number of worker threads.
+ * A negative number means the default of gdextra.threads, and 0 means
+ * the number of online CPUs. Always 1 without thread support.
+ */
+GDEXTRA_LOCAL int
+gdex_get_threads(long threads, int max TSRMLS_DC)
+{
+#if PHP_GDEXTRA_WITH_PTHREADS
+	if (threads < 0L) {
+		threads = GDEXG(threads);
+	}
+	if (threads == 0L) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	return (int)MINMAX(threads, 1L, (long)max);
+#else
+	return 1;
+#endif
+}
+
 /* }}} */
 /* {{{ gdex_get_colorspace_name() */
 
@@ -658,6 +933,167 @@ gdex_get_colorspace_name(int colorspace)
 	return "unknown";
 }
 
+/* }}} */
+/* {{{ gdex_input_open() */
+
+/*
+ * Read or map the whole file.
+ */
+GDEXTRA_LOCAL int
+gdex_input_open(gdex_input_t *input, const char *filename TSRMLS_DC)
+{
+	char *data = NULL;
+	size_t size = 0;
+
+	memset(input, 0, sizeof(gdex_input_t));
+
+	input->stream = php_stream_open_wrapper((char *)filename, "rb",
+			ENFORCE_SAFE_MODE | REPORT_ERRORS, NULL);
+	if (input->stream == NULL) {
+		return FAILURE;
+	}
+
+#if PHP_VERSION_ID >= 50300
+	/* map plain files, and read other streams */
+	data = php_stream_mmap_range(input->stream, 0, PHP_STREAM_MMAP_ALL,
+			PHP_STREAM_MAP_MODE_SHARED_READONLY, &size);
+	if (data != NULL) {
+		input->mapped = 1;
+	} else
+#endif
+	{
+		size = php_stream_copy_to_mem(input->stream, &data, PHP_STREAM_COPY_ALL, 0);
+	}
+
+	if (data == NULL || size == 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to read '%s'", filename);
+		gdex_input_close(input TSRMLS_CC);
+		return FAILURE;
+	}
+
+	input->data = (unsigned char *)data;
+	input->size = size;
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ gdex_input_close() */
+
+/*
+ * Release the contents and close the file.
+ */
+GDEXTRA_LOCAL void
+gdex_input_close(gdex_input_t *input TSRMLS_DC)
+{
+	if (input->data != NULL) {
+#if PHP_VERSION_ID >= 50300
+		if (input->mapped) {
+			php_stream_mmap_unmap(input->stream);
+		} else
+#endif
+		{
+			efree(input->data);
+		}
+	}
+	if (input->stream != NULL) {
+		php_stream_close(input->stream);
+	}
+	memset(input, 0, sizeof(gdex_input_t));
+}
+
+/* }}} */
+/* {{{ gdex_output_open() */
+
+/*
+ * Open the file, or prepare to write to the output buffer if filename is NULL.
+ */
+GDEXTRA_LOCAL int
+gdex_output_open(gdex_output_t *output, const char *filename TSRMLS_DC)
+{
+	output->stream = NULL;
+	output->used = 0;
+	output->failed = 0;
+
+	if (filename != NULL) {
+		output->stream = php_stream_open_wrapper((char *)filename, "wb",
+				IGNORE_URL | ENFORCE_SAFE_MODE | REPORT_ERRORS, NULL);
+		if (output->stream == NULL) {
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+
+/* }}} */
+/* {{{ gdex_output_flush() */
+
+/*
+ * Write the buffered data.
+ */
+GDEXTRA_LOCAL void
+gdex_output_flush(gdex_output_t *output TSRMLS_DC)
+{
+	if (output->used == 0) {
+		return;
+	}
+	if (output->stream == NULL) {
+		PHPWRITE((void *)output->buffer, (uint)output->used);
+	} else if (!output->failed) {
+		if (output->used != php_stream_write(output->stream,
+				(char *)output->buffer, output->used))
+		{
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to write data");
+			output->failed = 1;
+		}
+	}
+	output->used = 0;
+}
+
+/* }}} */
+/* {{{ gdex_output_write() */
+
+/*
+ * Write the data through the buffer, or directly if it is larger than the buffer.
+ */
+GDEXTRA_LOCAL void
+gdex_output_write(gdex_output_t *output, const void *data, size_t length TSRMLS_DC)
+{
+	if (output->used + length > GDEX_OUTPUT_BUFFER_SIZE) {
+		gdex_output_flush(output TSRMLS_CC);
+	}
+	if (length <= GDEX_OUTPUT_BUFFER_SIZE) {
+		memcpy(output->buffer + output->used, data, length);
+		output->used += length;
+	} else if (output->stream == NULL) {
+		PHPWRITE((void *)data, (uint)length);
+	} else if (!output->failed) {
+		if (length != php_stream_write(output->stream, (char *)data, length)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to write data");
+			output->failed = 1;
+		}
+	}
+}
+
+/* }}} */
+/* {{{ gdex_output_close() */
+
+/*
+ * Flush the buffer and close the file.
+ */
+GDEXTRA_LOCAL zend_bool
+gdex_output_close(gdex_output_t *output TSRMLS_DC)
+{
+	gdex_output_flush(output TSRMLS_CC);
+	if (output->stream != NULL) {
+		php_stream_close(output->stream);
+		output->stream = NULL;
+	}
+
+	return (zend_bool)!output->failed;
+}
+
 /* }}} */
 /* {{{ resource imageclone(resource im) */
 
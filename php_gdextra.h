@@ -85,6 +85,7 @@
 #define COLORSPACE_ALPHA 128
 #define COLORSPACE_RAW 1024
 #define COLORSPACE_RAW_ALPHA (COLORSPACE_ALPHA | COLORSPACE_RAW)
+#define COLORSPACE_PLANAR 2048
 
 #define MASK_SET        0
 #define MASK_MERGE      1
@@ -140,6 +141,20 @@
 #define SCALE_TILE      6
 #define SCALE_CARVE     7
 
+#define ICON_LARGEST    0
+#define ICON_ALL       -1
+
+#define PNM_AUTO        0
+#define PNM_PPM         1
+#define PNM_PGM         2
+#define PNM_PAM         3
+
+#define PIXELS_RGBA8    1
+#define PIXELS_BGRA8    2
+#define PIXELS_RGB8     3
+#define PIXELS_GRAY8    4
+#define PIXELS_ARGB32   5
+
 /* }}} */
 /* {{{ shorthand macros */
 
@@ -191,6 +206,17 @@ ZEND_BEGIN_MODULE_GLOBALS(gdextra)
 	gdextra_fcall_info func_copy;
 	gdextra_fcall_info func_copyresampled;
 /*	gdextra_fcall_info func_savealpha;*/
+	gdextra_fcall_info func_createfromstring;
+#endif
+	long threads;
+#if PHP_GDEXTRA_WITH_LQR
+	void *lqr_context;
+#endif
+#if PHP_GDEXTRA_WITH_MAGICK
+	long magick_threads;
+	long magick_memory_limit;
+	long magick_map_limit;
+	long magick_disk_limit;
 #endif
 ZEND_END_MODULE_GLOBALS(gdextra)
 
@@ -211,6 +237,61 @@ typedef void (*gdex_3ch_to_rgb_func_t)(float x, float y, float z, int *r, int *g
 typedef void (*gdex_rgb_to_4ch_func_t)(int r, int g, int b, float *w, float *x, float *y, float *z);
 typedef void (*gdex_4ch_to_rgb_func_t)(float w, float x, float y, float z, int *r, int *g, int *b);
 
+/* }}} */
+/* {{{ opaque type definitions */
+
+/*
+ * Compiled color correction parameters.
+ */
+typedef struct _gdex_corrector_t gdex_corrector_t;
+
+/*
+ * Compiled alpha mask.
+ */
+typedef struct _gdex_alphamask_t gdex_alphamask_t;
+
+/*
+ * 3D color lookup table.
+ */
+typedef struct _gdex_clut_t gdex_clut_t;
+
+/*
+ * Options common to liquid rescaling and the native carver.
+ */
+typedef struct _gdex_carve_options_t {
+	int max_step;
+	float rigidity;
+	int vertical_seam;
+	int save_alpha;
+	long timeout_ms;   /* 0 for no limit */
+	int fallback;      /* resample when the time budget runs out */
+} gdex_carve_options_t;
+
+/* }}} */
+/* {{{ input/output type definitions */
+
+/*
+ * Whole contents of a file, memory-mapped if possible.
+ */
+typedef struct _gdex_input_t {
+	php_stream *stream;
+	unsigned char *data;
+	size_t size;
+	int mapped;
+} gdex_input_t;
+
+/*
+ * Buffered writer to either the output buffer or a file.
+ */
+#define GDEX_OUTPUT_BUFFER_SIZE 8192
+
+typedef struct _gdex_output_t {
+	php_stream *stream;
+	unsigned char buffer[GDEX_OUTPUT_BUFFER_SIZE];
+	size_t used;
+	int failed;
+} gdex_output_t;
+
 /* }}} */
 /* {{{ utility function prototypes */
 
@@ -280,6 +361,38 @@ gdex_calc_offset(int target, int length, int mode);
 GDEXTRA_LOCAL const char *
 gdex_get_colorspace_name(int colorspace);
 
+/*
+ * Get the number of worker threads, up to 'max'.
+ * A negative number means gdextra.threads, and 0 the number of CPUs.
+ */
+GDEXTRA_LOCAL int
+gdex_get_threads(long threads, int max TSRMLS_DC);
+
+/*
+ * Read or map the whole file, and release it.
+ */
+GDEXTRA_LOCAL int
+gdex_input_open(gdex_input_t *input, const char *filename TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_input_close(gdex_input_t *input TSRMLS_DC);
+
+/*
+ * Open, write to and close the output.
+ * gdex_output_close() returns whether all data was written.
+ */
+GDEXTRA_LOCAL int
+gdex_output_open(gdex_output_t *output, const char *filename TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_output_flush(gdex_output_t *output TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_output_write(gdex_output_t *output, const void *data, size_t length TSRMLS_DC);
+
+GDEXTRA_LOCAL zend_bool
+gdex_output_close(gdex_output_t *output TSRMLS_DC);
+
 /*
  * Parse CSS3-style color strings.
  * @see http://www.w3.org/TR/css3-color/
@@ -337,6 +450,124 @@ gdex_image_to_web216(gdImagePtr im, zend_bool dither TSRMLS_DC);
 GDEXTRA_LOCAL void
 gdex_mask_alpha_funcs_init(void);
 
+/*
+ * Compile, apply and free the alpha mask.
+ * gdex_alphamask_apply() processes the rows [y0..y1) of a true color image.
+ */
+GDEXTRA_LOCAL gdex_alphamask_t *
+gdex_alphamask_new(gdImagePtr mask, long mode, long position TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_alphamask_apply(const gdex_alphamask_t *am, gdImagePtr im, int y0, int y1);
+
+GDEXTRA_LOCAL void
+gdex_alphamask_destroy(gdex_alphamask_t *am);
+
+/*
+ * Compile, apply and free the color correction parameters.
+ * gdex_corrector_apply() processes the rows [y0..y1) of a true color image.
+ */
+GDEXTRA_LOCAL gdex_corrector_t *
+gdex_corrector_new(HashTable *params, long colorspace TSRMLS_DC);
+
+GDEXTRA_LOCAL int
+gdex_corrector_is_empty(const gdex_corrector_t *corrector);
+
+GDEXTRA_LOCAL void
+gdex_corrector_apply(const gdex_corrector_t *corrector, gdImagePtr im, int y0, int y1);
+
+GDEXTRA_LOCAL void
+gdex_corrector_destroy(gdex_corrector_t *corrector);
+
+/*
+ * Create a ColorCorrector object and initialize its object handlers.
+ */
+GDEXTRA_LOCAL zend_object_value
+gdex_corrector_object_new(zend_class_entry *ce TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_corrector_class_init(zend_class_entry *ce);
+
+/*
+ * Get the color corrector from a ColorCorrector object.
+ */
+GDEXTRA_LOCAL gdex_corrector_t *
+gdex_corrector_fetch_object(zval *zv TSRMLS_DC);
+
+/*
+ * Get, apply and free the 3D color lookup table.
+ * gdex_clut_fetch() accepts a ColorLookupTable object, a .cube filename
+ * or a HALD CLUT image resource, and sets *shared to 0 if the caller
+ * should free the returned table.
+ */
+GDEXTRA_LOCAL gdex_clut_t *
+gdex_clut_fetch(zval *zv, int *shared TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_clut_apply(const gdex_clut_t *clut, gdImagePtr im, int y0, int y1);
+
+GDEXTRA_LOCAL int
+gdex_clut_get_size(const gdex_clut_t *clut);
+
+GDEXTRA_LOCAL void
+gdex_clut_destroy(gdex_clut_t *clut);
+
+/*
+ * Create a ColorLookupTable object and initialize its object handlers.
+ */
+GDEXTRA_LOCAL zend_object_value
+gdex_clut_object_new(zend_class_entry *ce TSRMLS_DC);
+
+GDEXTRA_LOCAL void
+gdex_clut_class_init(zend_class_entry *ce);
+
+/*
+ * Flip the image.
+ */
+GDEXTRA_LOCAL void
+gdex_image_flip(gdImagePtr im, int mode);
+
+/*
+ * Create a scaled copy of the image.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_image_scale(const gdImagePtr src, long width, long height, long mode,
+                 HashTable *options TSRMLS_DC);
+
+/*
+ * Encode an image as PNG in memory.
+ */
+GDEXTRA_LOCAL unsigned char *
+gdex_png_encode(const gdImagePtr im, int level, size_t *size TSRMLS_DC);
+
+/*
+ * Encode an image as PNG and write it to the output, band by band.
+ * True color images are stored as RGBA if force_alpha is set or the image
+ * has saveAlphaFlag, and as RGB otherwise. A negative number of threads
+ * means the default of gdextra.threads.
+ */
+GDEXTRA_LOCAL zend_bool
+gdex_png_write(gdex_output_t *output, const gdImagePtr im,
+               int level, int adaptive, int threads, int force_alpha TSRMLS_DC);
+
+/*
+ * Decode a Windows Bitmap image in memory.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_bmp_decode(const unsigned char *data, size_t size TSRMLS_DC);
+
+/*
+ * Decode the largest entry of an icon or a cursor in memory.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_icon_decode(const unsigned char *data, size_t size TSRMLS_DC);
+
+/*
+ * Decode a QOI image in memory.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_qoi_decode(const unsigned char *data, size_t size TSRMLS_DC);
+
 #if PHP_GDEXTRA_WITH_LQR
 /*
  * Do liquid rescaling.
@@ -346,12 +577,62 @@ gdex_liquid_rescale(const gdImagePtr src, int width, int height,
                     HashTable *options TSRMLS_DC);
 #endif
 
+/*
+ * Do seam carving without liblqr.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_seam_carve(const gdImagePtr src, int width, int height,
+                HashTable *options TSRMLS_DC);
+
+/*
+ * Do content-aware rescaling with the available carver.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_carve(const gdImagePtr src, int width, int height,
+           HashTable *options TSRMLS_DC);
+
+/*
+ * Get the options common to the carvers.
+ */
+GDEXTRA_LOCAL int
+gdex_get_carve_options(HashTable *options, gdex_carve_options_t *opts TSRMLS_DC);
+
+/*
+ * Resample the image instead of carving it.
+ */
+GDEXTRA_LOCAL gdImagePtr
+gdex_carve_fallback(const gdImagePtr src, int width, int height);
+
+/*
+ * Compare 64-bit sort keys for qsort().
+ */
+GDEXTRA_LOCAL int
+gdex_compare_keys(const void *a, const void *b);
+
 #if PHP_GDEXTRA_WITH_MAGICK
 /*
  * Get the version of ImageMagick.
  */
 GDEXTRA_LOCAL const char *
 gdex_get_magick_version(void);
+
+/*
+ * Initialize ImageMagick and apply the resource limits.
+ */
+GDEXTRA_LOCAL void
+gdex_magick_startup(TSRMLS_D);
+
+/*
+ * Terminate ImageMagick.
+ */
+GDEXTRA_LOCAL void
+gdex_magick_shutdown(void);
+
+/*
+ * Print the resource limits in effect.
+ */
+GDEXTRA_LOCAL void
+gdex_magick_info(void);
 #endif
 
 /* }}} */
@@ -368,6 +649,7 @@ gdex_get_magick_version(void);
 #if PHP_GDEXTRA_WITH_MAGICK
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatebymagick);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefromstring);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagewritebymagick);
 #endif
 GDEXTRA_LOCAL GDEX_FUNCTION(imageclone);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagehistgram);
@@ -376,7 +658,17 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelextract);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagechannelmerge);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagealphamask);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagebmp);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefrombmp);
 GDEXTRA_LOCAL GDEX_FUNCTION(imageicon);
+GDEXTRA_LOCAL GDEX_FUNCTION(imageiconfromimage);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefromicon);
+GDEXTRA_LOCAL GDEX_FUNCTION(imageqoi);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefromqoi);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagepam);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecreatefrompam);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagegetpixels);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagesetpixels);
+GDEXTRA_LOCAL GDEX_FUNCTION(imagefastpng);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagepalettetotruecolor);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagetowebsafepalette);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorallocatecss);
@@ -384,11 +676,15 @@ GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorallocatecmyk);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorallocatehsl);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorallocatehsv);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecolorcorrect);
+GDEXTRA_LOCAL GDEX_FUNCTION(imageapplyclut);
+GDEXTRA_LOCAL GDEX_FUNCTION(imageapplylut);
 GDEXTRA_LOCAL GDEX_FUNCTION(imageflip);
 GDEXTRA_LOCAL GDEX_FUNCTION(imagescale);
-#if PHP_GDEXTRA_WITH_LQR
 GDEXTRA_LOCAL GDEX_FUNCTION(imagecarve);
+#if PHP_GDEXTRA_WITH_LQR
+GDEXTRA_LOCAL GDEX_FUNCTION(imagecarvemulti);
 #endif
+GDEXTRA_LOCAL GDEX_FUNCTION(imagepipeline);
 
 GDEXTRA_LOCAL PHP_METHOD(ColorUtility, cmykToRgb);
 GDEXTRA_LOCAL PHP_METHOD(ColorUtility, hslToRgb);
@@ -399,6 +695,14 @@ GDEXTRA_LOCAL PHP_METHOD(ColorUtility, rgbToHsv);
 GDEXTRA_LOCAL PHP_METHOD(ColorUtility, parseCssColor);
 GDEXTRA_LOCAL PHP_METHOD(ColorUtility, getSvgColorTable);
 
+GDEXTRA_LOCAL PHP_METHOD(ColorCorrector, __construct);
+GDEXTRA_LOCAL PHP_METHOD(ColorCorrector, apply);
+
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, __construct);
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, fromHaldImage);
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, getSize);
+GDEXTRA_LOCAL PHP_METHOD(ColorLookupTable, apply);
+
 /* }}} */
 
 END_EXTERN_C()
@@ -342,6 +342,83 @@ spline_interpolate(const spline_t *spl, double x)
 	return SPLy(i) + x * (SPLq(i) + x * (SPLr(i) + x * SPLs(i)));
 }
 
+/* }}} */
+/* {{{ _spline_walk() */
+
+/*
+ * Get an interpolated value, advancing the knot index '*pi' incrementally.
+ * 'x' must not be less than the one given in the previous call.
+ */
+static inline double
+_spline_walk(const spline_t *spl, unsigned int *pi, double x)
+{
+	unsigned int i = *pi, n = spl->n - 1;
+
+	if (x <= SPLx(0)) {
+		return SPLy(0);
+	} else if (x >= SPLx(n)) {
+		*pi = n;
+		return SPLy(n);
+	}
+
+	while (i < n - 1 && x >= SPLx(i + 1)) {
+		i++;
+	}
+	*pi = i;
+
+	x -= SPLx(i);
+	return SPLy(i) + x * (SPLq(i) + x * (SPLr(i) + x * SPLs(i)));
+}
+
+/* }}} */
+/* {{{ spline_interpolate_many() */
+
+/*
+ * Get interpolated values for 'num' points at once.
+ * 'x' must be sorted in ascending order, and 'y' may be the same array as 'x'.
+ * 'spl' must be closed by spline_close().
+ */
+SPLINE_PUBLIC int
+spline_interpolate_many(const spline_t *spl, const double *x, double *y, unsigned int num)
+{
+	unsigned int i = 0, k;
+
+	if (!spl->closed) {
+		return 0;
+	}
+
+	for (k = 0; k < num; k++) {
+		y[k] = _spline_walk(spl, &i, x[k]);
+	}
+
+	return 1;
+}
+
+/* }}} */
+/* {{{ spline_bake() */
+
+/*
+ * Evaluate the spline on the uniform grid k / (num - 1) in range [0..1].
+ * 'spl' must be closed by spline_close().
+ */
+SPLINE_PUBLIC int
+spline_bake(const spline_t *spl, unsigned int num, double *out)
+{
+	unsigned int i = 0, k;
+	double step;
+
+	if (!spl->closed || num < 2) {
+		return 0;
+	}
+
+	step = 1.0 / (double)(num - 1);
+	for (k = 0; k < num; k++) {
+		out[k] = _spline_walk(spl, &i, (double)k * step);
+	}
+
+	return 1;
+}
+
 /* }}} */
 /* {{{ spline_destroy() */
 
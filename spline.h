@@ -132,6 +132,21 @@ spline_reopen(spline_t *spl);
 SPLINE_PUBLIC double
 spline_interpolate(const spline_t *spl, double x);
 
+/*
+ * Get interpolated values for 'num' points at once.
+ * 'x' must be sorted in ascending order, and 'y' may be the same array as 'x'.
+ * 'spl' must be closed by spline_close().
+ */
+SPLINE_PUBLIC int
+spline_interpolate_many(const spline_t *spl, const double *x, double *y, unsigned int num);
+
+/*
+ * Evaluate the spline on the uniform grid k / (num - 1) in range [0..1].
+ * 'spl' must be closed by spline_close().
+ */
+SPLINE_PUBLIC int
+spline_bake(const spline_t *spl, unsigned int num, double *out);
+
 /*
  * Destructor.
  */
@@ -0,0 +1,64 @@
+--TEST--
+ColorCorrector::apply() member function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im1 = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$im2 = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$params = array('gamma' => 1.8, 'b' => array('levels' => array(16, 240)));
+$corrector = new ColorCorrector($params);
+imagecolorcorrect($im1, $params);
+if ($corrector->apply($im2)
+    && imagecolorat($im1, 10, 10) === imagecolorat($im2, 10, 10)
+    && imagecolorat($im1, 100, 50) === imagecolorat($im2, 100, 50)
+) {
+    echo "OK\n";
+} else {
+    echo "NG\n";
+}
+
+// known values of the per-pixel float path
+function sample($corrector, $pixels)
+{
+    $im = imagecreatetruecolor(count($pixels), 1);
+    imagealphablending($im, false);
+    foreach ($pixels as $x => $p) {
+        imagesetpixel($im, $x, 0, imagecolorallocatealpha($im, $p[0], $p[1], $p[2], $p[3]));
+    }
+    $corrector->apply($im);
+    $result = array();
+    foreach ($pixels as $x => $p) {
+        $c = imagecolorsforindex($im, imagecolorat($im, $x, 0));
+        $result[] = implode(',', $c);
+    }
+    return implode(' ', $result);
+}
+
+$pixels = array(
+    array(0, 0, 0, 0),
+    array(64, 128, 192, 0),
+    array(200, 100, 50, 0),
+    array(255, 255, 255, 0),
+    array(30, 220, 140, 64),
+);
+echo sample(new ColorCorrector(array('gamma' => 1.8)), $pixels), "\n";
+echo sample(new ColorCorrector(array('tonecurve' => array(array(0.25, 0.4), array(0.75, 0.8)))), $pixels), "\n";
+echo sample(new ColorCorrector($params), $pixels), "\n";
+
+$pixels = array(
+    array(10, 20, 30, 0),
+    array(10, 20, 30, 32),
+    array(10, 20, 30, 64),
+    array(10, 20, 30, 100),
+    array(10, 20, 30, 127),
+);
+echo sample(new ColorCorrector(array('a' => array('gamma' => 2.0)),
+    IMAGE_EX_COLORSPACE_RGB | IMAGE_EX_COLORSPACE_ALPHA), $pixels), "\n";
+?>
+--EXPECT--
+OK
+0,0,0,0 118,174,218,0 223,151,103,0 255,255,255,0 77,235,183,64
+0,0,0,0 102,163,204,0 210,141,83,0 255,255,255,0 51,226,171,64
+0,0,0,0 118,174,223,0 223,151,89,0 255,255,255,0 77,235,183,64
+10,20,30,0 10,20,30,17 10,20,30,37 10,20,30,68 10,20,30,127
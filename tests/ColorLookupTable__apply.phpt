@@ -0,0 +1,34 @@
+--TEST--
+ColorLookupTable::apply() member function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+
+// negative 2x2x2 .cube LUT
+$cube = tempnam(sys_get_temp_dir(), 'clut');
+$data = "TITLE \"negative\"\nLUT_3D_SIZE 2\n";
+for ($b = 0; $b < 2; $b++) {
+    for ($g = 0; $g < 2; $g++) {
+        for ($r = 0; $r < 2; $r++) {
+            $data .= sprintf("%d.0 %d.0 %d.0\n", 1 - $r, 1 - $g, 1 - $b);
+        }
+    }
+}
+file_put_contents($cube, $data);
+
+$lut = new ColorLookupTable($cube);
+unlink($cube);
+
+$im = imagecreatetruecolor(1, 1);
+imagesetpixel($im, 0, 0, 0x204080);
+if ($lut->getSize() === 2 && $lut->apply($im)
+    && imagecolorat($im, 0, 0) === 0xdfbf7f
+) {
+    echo 'OK';
+} else {
+    echo 'NG';
+}
+?>
+--EXPECT--
+OK
@@ -0,0 +1,43 @@
+--TEST--
+imageapplyclut() function with worker threads
+--INI--
+gdextra.threads=4
+--FILE--
+<?php
+// negating HALD CLUT of level 2 (8x8 pixels, 4x4x4 lattice)
+$hald = imagecreatetruecolor(8, 8);
+for ($i = 0; $i < 64; $i++) {
+    $r = (int)round(($i % 4) * 255 / 3);
+    $g = (int)round((int)($i / 4) % 4 * 255 / 3);
+    $b = (int)round((int)($i / 16) * 255 / 3);
+    imagesetpixel($hald, $i % 8, (int)($i / 8), imagecolorallocate($hald, 255 - $r, 255 - $g, 255 - $b));
+}
+
+// tall enough for every thread to get a band
+$im = imagecreatetruecolor(64, 301);
+for ($y = 0; $y < 301; $y++) {
+    for ($x = 0; $x < 64; $x++) {
+        imagesetpixel($im, $x, $y, imagecolorallocate($im, $x * 4, $y % 256, ($x + $y) % 256));
+    }
+}
+$expected = imagecreatetruecolor(64, 301);
+imagecopy($expected, $im, 0, 0, 0, 0, 64, 301);
+imagefilter($expected, IMG_FILTER_NEGATE);
+
+var_dump(imageapplyclut($im, $hald));
+$diff = 0;
+for ($y = 0; $y < 301; $y++) {
+    for ($x = 0; $x < 64; $x++) {
+        $a = imagecolorat($im, $x, $y);
+        $b = imagecolorat($expected, $x, $y);
+        $diff = max($diff,
+            abs(($a >> 16 & 0xff) - ($b >> 16 & 0xff)),
+            abs(($a >> 8 & 0xff) - ($b >> 8 & 0xff)),
+            abs(($a & 0xff) - ($b & 0xff)));
+    }
+}
+var_dump($diff <= 1);
+?>
+--EXPECT--
+bool(true)
+bool(true)
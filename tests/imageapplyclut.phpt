@@ -0,0 +1,34 @@
+--TEST--
+imageapplyclut() function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+
+// identity HALD CLUT of level 2 (8x8 pixels, 4x4x4 lattice)
+$hald = imagecreatetruecolor(8, 8);
+for ($i = 0; $i < 64; $i++) {
+    $r = (int)round(($i % 4) * 255 / 3);
+    $g = (int)round((int)($i / 4) % 4 * 255 / 3);
+    $b = (int)round((int)($i / 16) * 255 / 3);
+    imagesetpixel($hald, $i % 8, (int)($i / 8), imagecolorallocate($hald, $r, $g, $b));
+}
+
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$before = imagecolorsforindex($im, imagecolorat($im, 100, 50));
+if (!imageapplyclut($im, $hald)) {
+    echo 'NG';
+    exit;
+}
+$after = imagecolorsforindex($im, imagecolorat($im, 100, 50));
+if (abs($before['red'] - $after['red']) <= 1
+    && abs($before['green'] - $after['green']) <= 1
+    && abs($before['blue'] - $after['blue']) <= 1
+) {
+    echo 'OK';
+} else {
+    echo 'NG';
+}
+?>
+--EXPECT--
+OK
@@ -0,0 +1,26 @@
+--TEST--
+imageapplylut() function
+--SKIPIF--
+--FILE--
+<?php
+$negate = '';
+for ($i = 0; $i < 256; $i++) {
+    $negate .= chr(255 - $i);
+}
+$half = range(0, 255);
+foreach ($half as $i => $v) {
+    $half[$i] = $v >> 1;
+}
+
+$im = imagecreatetruecolor(1, 1);
+imagesetpixel($im, 0, 0, 0x204080);
+if (imageapplylut($im, $negate, $half, null)
+    && imagecolorat($im, 0, 0) === 0xdf2080
+) {
+    echo 'OK';
+} else {
+    echo 'NG';
+}
+?>
+--EXPECT--
+OK
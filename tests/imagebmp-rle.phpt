@@ -0,0 +1,38 @@
+--TEST--
+imagebmp() function with RLE compression
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreate(64, 16);
+$colors = array();
+for ($i = 0; $i < 16; $i++) {
+    $colors[] = imagecolorallocate($im, $i * 16, 255 - $i * 16, 128);
+}
+for ($x = 0; $x < 64; $x++) {
+    imageline($im, $x, 0, $x, 15, $colors[($x >> 3) & 15]);
+}
+imagesetpixel($im, 5, 5, $colors[15]);
+if (!imagebmp($im, 'sample.bmp', true)) {
+    exit;
+}
+$compressed = filesize('sample.bmp');
+imagebmp($im, 'sample.bmp');
+$uncompressed = filesize('sample.bmp');
+imagebmp($im, 'sample.bmp', true);
+$dst = imagecreatefrombmp('sample.bmp');
+$same = true;
+for ($y = 0; $y < 16; $y++) {
+    for ($x = 0; $x < 64; $x++) {
+        $s = imagecolorsforindex($im, imagecolorat($im, $x, $y));
+        $d = imagecolorsforindex($dst, imagecolorat($dst, $x, $y));
+        if ($s['red'] != $d['red'] || $s['green'] != $d['green'] || $s['blue'] != $d['blue']) {
+            $same = false;
+        }
+    }
+}
+echo ($same && $compressed < $uncompressed) ? 'OK' : 'NG';
+@unlink('sample.bmp');
+?>
+--EXPECT--
+OK
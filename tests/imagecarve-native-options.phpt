@@ -0,0 +1,29 @@
+--TEST--
+imagecarve() function with native-only options and liblqr
+--SKIPIF--
+<?php
+if (!function_exists('imagecarvemulti')) {
+    die('skip liquid rescaling is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+
+$resized = imagecarve($im, 200, 200, array('forward_energy' => true, 'batch' => 4, 'threads' => 2));
+var_dump(imagesx($resized), imagesy($resized));
+
+$resized = imagecarve($im, 200, 200, array('native' => true, 'batch' => 4, 'threads' => 2));
+var_dump(imagesx($resized), imagesy($resized));
+?>
+--EXPECTF--
+Warning: imagecarve(): 'forward_energy' is only supported by the native carver in %s on line %d
+
+Warning: imagecarve(): 'batch' is only supported by the native carver in %s on line %d
+
+Warning: imagecarve(): 'threads' is only supported by the native carver in %s on line %d
+int(200)
+int(200)
+int(200)
+int(200)
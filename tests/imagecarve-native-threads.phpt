@@ -0,0 +1,41 @@
+--TEST--
+imagecarve() function with the native carver in several threads and a time budget
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$w = imagesx($im);
+$h = imagesy($im);
+
+function pixels($im)
+{
+    $data = '';
+    for ($y = 0; $y < imagesy($im); $y++) {
+        for ($x = 0; $x < imagesx($im); $x++) {
+            $data .= pack('N', imagecolorat($im, $x, $y));
+        }
+    }
+    return md5($data);
+}
+
+// the bands of the threads give the same seams as a single thread
+$single = imagecarve($im, 300, 600, array('native' => true, 'threads' => 1));
+$multi = imagecarve($im, 300, 600, array('native' => true, 'threads' => 4));
+var_dump(pixels($single) === pixels($multi));
+
+$single = imagecarve($im, $w + 40, $h, array('native' => true, 'threads' => 1));
+$multi = imagecarve($im, $w + 40, $h, array('native' => true, 'threads' => 4));
+var_dump(pixels($single) === pixels($multi));
+
+// the time budget is checked between the batches
+var_dump(@imagecarve($im, 200, 200, array('native' => true, 'batch' => 1, 'timeout_ms' => 1)));
+$resized = imagecarve($im, 200, 200, array('native' => true, 'batch' => 1,
+    'timeout_ms' => 1, 'fallback' => true));
+var_dump(imagesx($resized), imagesy($resized));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(false)
+int(200)
+int(200)
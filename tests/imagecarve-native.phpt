@@ -0,0 +1,56 @@
+--TEST--
+imagecarve() function with the native carver
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$w = imagesx($im);
+$h = imagesy($im);
+
+$resized = imagecarve($im, 200, 200, array('native' => true));
+var_dump(imagesx($resized), imagesy($resized));
+
+$resized = imagecarve($im, 200, 200, array('native' => true,
+    'forward_energy' => true, 'vertical_seam' => true, 'max_step' => 2, 'batch' => 1));
+var_dump(imagesx($resized), imagesy($resized));
+
+$resized = imagecarve($im, $w + 50, $h, array('native' => true, 'threads' => 2));
+var_dump(imagesx($resized) === $w + 50, imagesy($resized) === $h);
+
+$resized = imagescale($im, 200, 100, IMAGE_EX_SCALE_CARVE, array('carve' => array('native' => true)));
+var_dump(imagesx($resized), imagesy($resized));
+
+var_dump(@imagecarve($im, 200, 200, array('native' => true, 'batch' => -1)));
+
+// a textured stripe on a flat background survives, the flat columns go
+$im = imagecreatetruecolor(60, 40);
+imagefilledrectangle($im, 0, 0, 59, 39, 0x808080);
+imagefilledrectangle($im, 21, 0, 22, 39, 0xffffff);
+imageline($im, 20, 0, 20, 39, 0x000000);
+imageline($im, 23, 0, 23, 39, 0x000000);
+$resized = imagecarve($im, 30, 40, array('native' => true));
+$ok = true;
+for ($y = 0; $y < 40; $y++) {
+    $row = array();
+    for ($x = 0; $x < 30; $x++) {
+        $c = imagecolorat($resized, $x, $y);
+        if ($c != 0x808080) {
+            $row[] = $c;
+        }
+    }
+    $ok = $ok && $row === array(0x000000, 0xffffff, 0xffffff, 0x000000);
+}
+var_dump(imagesx($resized), $ok);
+?>
+--EXPECT--
+int(200)
+int(200)
+int(200)
+int(200)
+bool(true)
+bool(true)
+int(200)
+int(100)
+bool(false)
+int(30)
+bool(true)
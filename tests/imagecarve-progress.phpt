@@ -0,0 +1,35 @@
+--TEST--
+imagecarve() function with progress callback and time budget
+--SKIPIF--
+<?php
+if (!function_exists('imagecarve')) {
+    die('skip function imagecarve() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+
+$steps = array();
+$progress = function ($percent) use (&$steps) {
+    $steps[] = $percent;
+};
+$resized = imagecarve($im, 200, 200, array('progress' => $progress, 'progress_step' => 25));
+var_dump(is_resource($resized) && count($steps) > 0 && max($steps) <= 100);
+
+$cancel = function ($percent) {
+    return $percent < 50;
+};
+var_dump(imagecarve($im, 200, 200, array('progress' => $cancel)));
+
+var_dump(@imagecarve($im, 200, 200, array('timeout_ms' => 1)));
+$resized = imagecarve($im, 200, 200, array('timeout_ms' => 1, 'fallback' => true));
+var_dump(imagesx($resized), imagesy($resized));
+?>
+--EXPECT--
+bool(true)
+bool(false)
+bool(false)
+int(200)
+int(200)
@@ -0,0 +1,29 @@
+--TEST--
+imagecarve() function with proxy_scale
+--SKIPIF--
+<?php
+if (!function_exists('imagecarve')) {
+    die('skip function imagecarve() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+
+$resized = imagecarve($im, 200, 200, array('proxy_scale' => 0.25));
+var_dump(imagesx($resized), imagesy($resized));
+
+$resized = imagecarve($im, 200, 200, array('proxy_scale' => 0.5, 'vertical_seam' => true));
+var_dump(imagesx($resized), imagesy($resized));
+
+var_dump(@imagecarve($im, 200, 200, array('proxy_scale' => 0)));
+var_dump(@imagecarve($im, 200, 200, array('proxy_scale' => 1.5)));
+?>
+--EXPECT--
+int(200)
+int(200)
+int(200)
+int(200)
+bool(false)
+bool(false)
@@ -0,0 +1,72 @@
+--TEST--
+imagecarvemulti() function
+--SKIPIF--
+<?php
+if (!function_exists('imagecarvemulti')) {
+    die('skip function imagecarvemulti() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$w = imagesx($im);
+$h = imagesy($im);
+$sizes = array(
+    'small' => array($w - 100, $h),
+    'large' => array('width' => $w - 20, 'height' => $h),
+    array(100, 100),
+);
+$images = imagecarvemulti($im, $sizes, null, $vmap);
+foreach ($images as $key => $resized) {
+    echo $key, ': ', imagesx($resized), 'x', imagesy($resized), "\n";
+}
+var_dump($vmap['orientation'], $vmap['width'] == $w, $vmap['height'] == $h,
+    $vmap['depth'] >= 100, strlen($vmap['data']) == $w * $h * 4);
+
+$again = imagecarvemulti($im, array(array($w - 100, $h)), array('vmap' => $vmap));
+var_dump(imagegetpixels($again[0], IMAGE_EX_PIXELS_RGBA8)
+    === imagegetpixels($images['small'], IMAGE_EX_PIXELS_RGBA8));
+
+// broken or foreign maps are rejected
+$bad = $vmap;
+$bad['data'] = substr_replace($bad['data'], pack('l', $vmap['depth'] + 1), 0, 4);
+var_dump(imagecarvemulti($im, array(array($w - 100, $h)), array('vmap' => $bad)));
+$bad = $vmap;
+$bad['depth'] = $w;
+var_dump(imagecarvemulti($im, array(array($w - 100, $h)), array('vmap' => $bad)));
+$cropped = imagecreatetruecolor($w, $h - 1);
+var_dump(imagecarvemulti($cropped, array(array($w - 100, $h - 1)), array('vmap' => $vmap)));
+
+// a size equal to the image is copied even after the time budget ran out
+$images = imagecarvemulti($im, array(array(200, 200), array($w, $h), array(100, 300)),
+    array('timeout_ms' => 1, 'fallback' => true));
+foreach ($images as $key => $resized) {
+    echo $key, ': ', imagesx($resized), 'x', imagesy($resized), "\n";
+}
+var_dump(imagegetpixels($images[1], IMAGE_EX_PIXELS_RGBA8)
+    === imagegetpixels($im, IMAGE_EX_PIXELS_RGBA8));
+?>
+--EXPECTF--
+small: %dx%d
+large: %dx%d
+0: 100x100
+int(0)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+
+Warning: imagecarvemulti(): The visibility map has an invalid level (%d) in %s on line %d
+bool(false)
+
+Warning: imagecarvemulti(): The depth of the visibility map (%d) is too large for the image in %s on line %d
+bool(false)
+
+Warning: imagecarvemulti(): The visibility map is %dx%d, but the image is %dx%d in %s on line %d
+bool(false)
+0: 200x200
+1: %dx%d
+2: 100x300
+bool(true)
@@ -0,0 +1,25 @@
+--TEST--
+imagechannelextract() and imagechannelmerge() with planar byte strings
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefrompng('../examples/images/rgba-32bit.png');
+$width = imagesx($im);
+$height = imagesy($im);
+$planes = imagechannelextract($im, IMAGE_EX_COLORSPACE_RGB | IMAGE_EX_COLORSPACE_ALPHA | IMAGE_EX_COLORSPACE_PLANAR);
+$ok = (count($planes) == 4);
+foreach ($planes as $plane) {
+    $ok = $ok && is_string($plane) && strlen($plane) == $width * $height;
+}
+$c = imagecolorsforindex($im, imagecolorat($im, 2, 1));
+$ok = $ok && ord($planes[0][$width + 2]) == $c['red'] && ord($planes[2][$width + 2]) == $c['blue'];
+
+$merged = imagechannelmerge($planes, IMAGE_EX_COLORSPACE_RGB | IMAGE_EX_COLORSPACE_ALPHA, IMAGE_EX_POSITION_MIDDLE_CENTER, $width);
+$ok = $ok && imagesx($merged) == $width && imagesy($merged) == $height;
+$m = imagecolorsforindex($merged, imagecolorat($merged, 2, 1));
+$ok = $ok && $m['red'] == $c['red'] && $m['green'] == $c['green'] && $m['blue'] == $c['blue'];
+echo $ok ? 'OK' : 'NG';
+?>
+--EXPECT--
+OK
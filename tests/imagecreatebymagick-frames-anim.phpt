@@ -0,0 +1,47 @@
+--TEST--
+imagecreatebymagick() function with frame selection from an animated GIF
+--SKIPIF--
+<?php
+if (!function_exists('imagecreatebymagick')) {
+    die('skip function imagecreatebymagick() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+// three 4x4 frames filled with red, green and blue
+$file = '../examples/images/anim-3frames.gif';
+
+function frame_colors($images) {
+    $colors = array();
+    foreach ($images as $im) {
+        $c = imagecolorsforindex($im, imagecolorat($im, 1, 1));
+        $colors[] = sprintf('%02x%02x%02x', $c['red'], $c['green'], $c['blue']);
+    }
+    return implode(' ', $colors);
+}
+
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => 'all'))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => 1))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => '0,2'))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => '1-2'))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => array(2)))), "\n";
+echo frame_colors(array(imagecreatebymagick($file))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => '2,0'))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => array(1, 0, 1)))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => '2-0'))), "\n";
+echo frame_colors(imagecreatebymagick($file, false, array('frames' => '1,5'))), "\n";
+?>
+--EXPECTF--
+ff0000 00ff00 0000ff
+00ff00
+ff0000 0000ff
+00ff00 0000ff
+0000ff
+ff0000
+0000ff ff0000
+00ff00 ff0000 00ff00
+0000ff 00ff00 ff0000
+
+Warning: imagecreatebymagick(): Frame index (5) out of range, the image has 3 frames in %s on line %d
+00ff00
@@ -0,0 +1,31 @@
+--TEST--
+imagecreatebymagick() function with the frames of an optimized GIF
+--SKIPIF--
+<?php
+if (!function_exists('imagecreatebymagick')) {
+    die('skip function imagecreatebymagick() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+// a 4x4 red frame, then a 2x2 green frame at (1,1) and a 1x1 blue frame at (3,0)
+$file = '../examples/images/anim-optimized.gif';
+
+foreach (imagecreatebymagick($file, false, array('frames' => 'all')) as $im) {
+    $colors = array();
+    foreach (array(array(0, 0), array(1, 1), array(3, 0)) as $xy) {
+        $c = imagecolorsforindex($im, imagecolorat($im, $xy[0], $xy[1]));
+        $colors[] = sprintf('%02x%02x%02x', $c['red'], $c['green'], $c['blue']);
+    }
+    echo imagesx($im), 'x', imagesy($im), ' ', implode(' ', $colors), "\n";
+}
+
+$im = imagecreatebymagick($file, false, array('frames' => 2));
+echo imagesx($im[0]), 'x', imagesy($im[0]), "\n";
+?>
+--EXPECT--
+4x4 ff0000 ff0000 ff0000
+4x4 ff0000 00ff00 ff0000
+4x4 ff0000 00ff00 0000ff
+4x4
@@ -0,0 +1,33 @@
+--TEST--
+imagecreatebymagick() function with frame selection
+--SKIPIF--
+<?php
+if (!function_exists('imagecreatebymagick')) {
+    die('skip function imagecreatebymagick() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$file = '../examples/images/rgba-8bit.gif';
+$size = getimagesize($file);
+$ok = true;
+foreach (array(0, '0', array(0), 'all') as $frames) {
+    $images = imagecreatebymagick($file, false, array('frames' => $frames));
+    if (!is_array($images) || count($images) != 1
+        || imagesx($images[0]) != $size[0] || imagesy($images[0]) != $size[1])
+    {
+        $ok = false;
+    }
+}
+$images = imagecreatebymagick(file_get_contents($file), true, array('frames' => 'all'));
+if (!is_array($images) || count($images) != 1) {
+    $ok = false;
+}
+if (@imagecreatebymagick($file, false, array('frames' => '1x1')) !== false) {
+    $ok = false;
+}
+echo $ok ? 'OK' : 'NG';
+?>
+--EXPECT--
+OK
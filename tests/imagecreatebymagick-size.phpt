@@ -0,0 +1,25 @@
+--TEST--
+imagecreatebymagick() function with size limits
+--SKIPIF--
+<?php
+if (!function_exists('imagecreatebymagick')) {
+    die('skip function imagecreatebymagick() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$file = '../examples/images/mutzig.jpg';
+$info = getimagesize($file);
+$im = imagecreatebymagick($file, false, array('max_width' => 100, 'max_height' => 100));
+$ratio = min(100 / $info[0], 100 / $info[1]);
+if ($im && max(imagesx($im), imagesy($im)) == 100
+    && abs(imagesx($im) - $info[0] * $ratio) <= 1 && abs(imagesy($im) - $info[1] * $ratio) <= 1)
+{
+    echo 'OK';
+} else {
+    echo 'NG';
+}
+?>
+--EXPECT--
+OK
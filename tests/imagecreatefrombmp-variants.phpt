@@ -0,0 +1,33 @@
+--TEST--
+imagecreatefrombmp() function with compressed, bit field and top-down bitmaps
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$expected = array(
+    array(0xff0000, 0x00ff00, 0x0000ff, 0xffffff),
+    array(0x000000, 0xff0000, 0x00ff00, 0x0000ff),
+);
+foreach (array('rle8', 'rle4', 'bitfields', '16bit', 'topdown') as $name) {
+    $im = imagecreatefrombmp("../examples/images/bmp-{$name}.bmp");
+    $result = ($im && imagesx($im) == 4 && imagesy($im) == 2) ? 'OK' : 'NG';
+    for ($y = 0; $y < 2 && $result == 'OK'; $y++) {
+        for ($x = 0; $x < 4; $x++) {
+            $c = imagecolorsforindex($im, imagecolorat($im, $x, $y));
+            if ((($c['red'] << 16) | ($c['green'] << 8) | $c['blue']) != $expected[$y][$x]) {
+                $result = 'NG';
+                break;
+            }
+        }
+    }
+    echo "{$name}: {$result}\n";
+}
+var_dump(@imagecreatefrombmp('../examples/images/bmp-rle8-truncated.bmp'));
+?>
+--EXPECT--
+rle8: OK
+rle4: OK
+bitfields: OK
+16bit: OK
+topdown: OK
+bool(false)
@@ -0,0 +1,35 @@
+--TEST--
+imagecreatefrombmp() function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$result = 'OK';
+foreach (array('rgb-4bit.gif', 'rgba-8bit.gif', 'rgb-24bit.png') as $basename) {
+    $src = imagecreatefromstring(file_get_contents('../examples/images/' . $basename));
+    if (!imagebmp($src, 'sample.bmp')) {
+        exit;
+    }
+    $dst = imagecreatefrombmp('sample.bmp');
+    $width = imagesx($src);
+    $height = imagesy($src);
+    if (!$dst || imagesx($dst) != $width || imagesy($dst) != $height) {
+        $result = 'NG';
+        break;
+    }
+    for ($y = 0; $y < $height; $y++) {
+        for ($x = 0; $x < $width; $x++) {
+            $s = imagecolorsforindex($src, imagecolorat($src, $x, $y));
+            $d = imagecolorsforindex($dst, imagecolorat($dst, $x, $y));
+            if ($s['red'] != $d['red'] || $s['green'] != $d['green'] || $s['blue'] != $d['blue']) {
+                $result = 'NG';
+                break 3;
+            }
+        }
+    }
+}
+echo $result;
+@unlink('sample.bmp');
+?>
+--EXPECT--
+OK
@@ -0,0 +1,29 @@
+--TEST--
+imagecreatefromicon() function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32x32.png');
+$dst = imagecreatefrompng('../examples/images/rgba-16x16.png');
+if (!imageicon(array($dst, $src), 'read.ico', array('png' => false))) {
+    exit;
+}
+$im = imagecreatefromicon('read.ico', 24);
+$all = imagecreatefromicon('read.ico', IMAGE_EX_ICON_ALL);
+$ok = (imagesx($im) == 32 && count($all) == 2 && imagesx($all[0]) == 16);
+for ($y = 0; $ok && $y < 32; $y++) {
+    for ($x = 0; $x < 32; $x++) {
+        $a = imagecolorsforindex($src, imagecolorat($src, $x, $y));
+        $b = imagecolorsforindex($im, imagecolorat($im, $x, $y));
+        if ($a['alpha'] == 127 ? $b['alpha'] != 127 : $a != $b) {
+            $ok = false;
+            break;
+        }
+    }
+}
+echo $ok ? 'OK' : 'NG';
+@unlink('read.ico');
+?>
+--EXPECT--
+OK
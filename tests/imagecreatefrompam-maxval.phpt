@@ -0,0 +1,13 @@
+--TEST--
+imagecreatefrompam() function with samples above maxval
+--SKIPIF--
+--FILE--
+<?php
+$im = imagecreatefrompam("P6\n2 1\n1\n\xff\x00\x01\x00\x01\x00");
+printf("%06x %06x\n", imagecolorat($im, 0, 0), imagecolorat($im, 1, 0));
+$im = imagecreatefrompam("P5\n1 1\n1000\n\xff\xff");
+printf("%06x\n", imagecolorat($im, 0, 0));
+?>
+--EXPECT--
+ff00ff 00ff00
+ffffff
@@ -0,0 +1,44 @@
+--TEST--
+gdextra\imagecreatefromstring() function
+--SKIPIF--
+<?php
+if (!function_exists('gdextra\\imagecreatefromstring')) {
+    die('skip function gdextra\\imagecreatefromstring() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32x32.png');
+$data = array(
+    'png' => file_get_contents('../examples/images/rgba-32x32.png'),
+    'jpeg' => file_get_contents('../examples/images/mutzig.jpg'),
+    'gif' => file_get_contents('../examples/images/rgb-4bit.gif'),
+    'tiff' => file_get_contents('../examples/images/rgb-24bit.tif'),
+);
+ob_start();
+imagebmp($src);
+$data['bmp'] = ob_get_clean();
+ob_start();
+imageicon($src);
+$data['ico'] = ob_get_clean();
+ob_start();
+imageqoi($src);
+$data['qoi'] = ob_get_clean();
+foreach ($data as $format => $string) {
+    $im = gdextra\imagecreatefromstring($string);
+    echo $format, ': ', is_resource($im) ? 'OK' : 'NG', "\n";
+}
+$im = gdextra\imagecreatefromstring($data['qoi']);
+echo (imagesx($im) == 32 && imagesy($im) == 32
+    && imagecolorat($im, 16, 16) == imagecolorat($src, 16, 16)) ? 'OK' : 'NG', "\n";
+?>
+--EXPECT--
+png: OK
+jpeg: OK
+gif: OK
+tiff: OK
+bmp: OK
+ico: OK
+qoi: OK
+OK
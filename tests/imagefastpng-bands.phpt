@@ -0,0 +1,39 @@
+--TEST--
+imagefastpng() function with several bands and threads
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+// 512 RGBA pixels per row makes five bands of 256 KiB
+$width = 512;
+$height = 600;
+$src = imagecreatetruecolor($width, $height);
+imagealphablending($src, false);
+imagesavealpha($src, true);
+for ($y = 0; $y < $height; $y++) {
+    for ($x = 0; $x < $width; $x++) {
+        $c = imagecolorallocatealpha($src, $x & 255, $y & 255, ($x ^ $y) & 255, ($x + $y) % 128);
+        imagesetpixel($src, $x, $y, $c);
+    }
+}
+imagefastpng($src, 'bands-1.png', array('threads' => 1));
+imagefastpng($src, 'bands-4.png', array('threads' => 4));
+var_dump(file_get_contents('bands-1.png') === file_get_contents('bands-4.png'));
+
+$dst = imagecreatefrompng('bands-4.png');
+$ok = imagesx($dst) == $width && imagesy($dst) == $height;
+for ($y = 0; $ok && $y < $height; $y++) {
+    for ($x = 0; $x < $width; $x++) {
+        if (imagecolorat($dst, $x, $y) != imagecolorat($src, $x, $y)) {
+            $ok = false;
+            break;
+        }
+    }
+}
+var_dump($ok);
+@unlink('bands-1.png');
+@unlink('bands-4.png');
+?>
+--EXPECT--
+bool(true)
+bool(true)
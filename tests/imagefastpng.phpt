@@ -0,0 +1,31 @@
+--TEST--
+imagefastpng() function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32bit.png');
+imagesavealpha($src, true);
+$ok = imagefastpng($src, 'fast.png', array('level' => 1, 'threads' => 2));
+ob_start();
+imagefastpng($src, null, array('filter' => false));
+$data = ob_get_clean();
+$a = imagecreatefrompng('fast.png');
+$b = imagecreatefromstring($data);
+$width = imagesx($src);
+$height = imagesy($src);
+$ok = $ok && imagesx($a) == $width && imagesy($a) == $height;
+for ($y = 0; $ok && $y < $height; $y++) {
+    for ($x = 0; $x < $width; $x++) {
+        $c = imagecolorat($src, $x, $y);
+        if (imagecolorat($a, $x, $y) != $c || imagecolorat($b, $x, $y) != $c) {
+            $ok = false;
+            break;
+        }
+    }
+}
+echo $ok ? 'OK' : 'NG';
+@unlink('fast.png');
+?>
+--EXPECT--
+OK
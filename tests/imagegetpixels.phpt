@@ -0,0 +1,32 @@
+--TEST--
+imagegetpixels() and imagesetpixels() functions
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32bit.png');
+$width = imagesx($src);
+$height = imagesy($src);
+$region = array('x' => 1, 'y' => 2, 'width' => 5, 'height' => 3);
+
+$rgba = imagegetpixels($src, IMAGE_EX_PIXELS_RGBA8, $region);
+$ok = (strlen($rgba) == 5 * 3 * 4 && strlen(imagegetpixels($src, IMAGE_EX_PIXELS_RGB8)) == $width * $height * 3);
+$c = imagecolorsforindex($src, imagecolorat($src, 1, 2));
+$ok = $ok && (unpack('C4', substr($rgba, 0, 4)) == array(1 => $c['red'], $c['green'], $c['blue'], 255 - 2 * $c['alpha']));
+
+$dst = imagecreatetruecolor($width, $height);
+foreach (array(IMAGE_EX_PIXELS_RGBA8, IMAGE_EX_PIXELS_BGRA8, IMAGE_EX_PIXELS_ARGB32) as $format) {
+    $ok = $ok && imagesetpixels($dst, $format, imagegetpixels($src, $format));
+    for ($y = 0; $ok && $y < $height; $y++) {
+        for ($x = 0; $x < $width; $x++) {
+            if (imagecolorat($dst, $x, $y) != imagecolorat($src, $x, $y)) {
+                $ok = false;
+                break;
+            }
+        }
+    }
+}
+echo $ok ? 'OK' : 'NG';
+?>
+--EXPECT--
+OK
@@ -0,0 +1,23 @@
+--TEST--
+imageicon() function with PNG-compressed entries
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$images = array(imagecreatefrompng('../examples/images/rgba-32x32.png'),
+                imagecreatefrompng('../examples/images/rgba-256x256.png'));
+if (!imageicon($images, 'icons.ico', array('png' => true))) {
+    exit;
+}
+$output = file_get_contents('icons.ico');
+imageicon($images, 'icons.ico');
+$uncompressed = filesize('icons.ico');
+$bmp = unpack('V', substr($output, 6 + 12, 4));
+$png = unpack('V', substr($output, 6 + 16 + 12, 4));
+echo (substr($output, $bmp[1], 4) == "\x28\0\0\0"
+      && substr($output, $png[1], 8) == "\x89PNG\r\n\x1a\n"
+      && strlen($output) < $uncompressed) ? 'OK' : 'NG';
+@unlink('icons.ico');
+?>
+--EXPECT--
+OK
@@ -0,0 +1,29 @@
+--TEST--
+imageiconfromimage() function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefrompng('../examples/images/rgba-256x256.png');
+if (!imageiconfromimage($im, array(48, 16, 32, 16), 'icons.ico')) {
+    exit;
+}
+$output = file_get_contents('icons.ico');
+$header = unpack('vreserved/vtype/vcount', substr($output, 0, 6));
+$widths = array();
+for ($i = 0; $i < $header['count']; $i++) {
+    $widths[] = ord($output[6 + 16 * $i]);
+}
+echo ($header['type'] == 1 && $widths == array(16, 32, 48)) ? 'OK' : 'NG', "\n";
+@unlink('icons.ico');
+
+if (!imageiconfromimage($im, array(16, 32), 'icons-png.ico', array('png' => 32))) {
+    exit;
+}
+$output = file_get_contents('icons-png.ico');
+echo (substr($output, 4, 2) === "\x02\x00" && strpos($output, "\x89PNG") !== false) ? 'OK' : 'NG';
+@unlink('icons-png.ico');
+?>
+--EXPECT--
+OK
+OK
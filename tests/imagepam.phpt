@@ -0,0 +1,32 @@
+--TEST--
+imagepam() and imagecreatefrompam() functions
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32bit.png');
+imagesavealpha($src, true);
+ob_start();
+imagepam($src);
+$pam = ob_get_clean();
+imagepam($src, 'test.ppm', IMAGE_EX_PNM_PPM);
+$a = imagecreatefrompam($pam);
+$b = imagecreatefrompam('test.ppm');
+$width = imagesx($src);
+$height = imagesy($src);
+$ok = (substr($pam, 0, 3) == "P7\n" && strpos($pam, "TUPLTYPE RGB_ALPHA\n") !== false
+    && strlen(file_get_contents('test.ppm')) == strlen("P6\n{$width} {$height}\n255\n") + $width * $height * 3);
+for ($y = 0; $ok && $y < $height; $y++) {
+    for ($x = 0; $x < $width; $x++) {
+        $c = imagecolorat($src, $x, $y);
+        if (imagecolorat($a, $x, $y) != $c || imagecolorat($b, $x, $y) != ($c & 0xffffff)) {
+            $ok = false;
+            break;
+        }
+    }
+}
+echo $ok ? 'OK' : 'NG';
+@unlink('test.ppm');
+?>
+--EXPECT--
+OK
@@ -0,0 +1,45 @@
+--TEST--
+imagepipeline() function
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$im = imagecreatefromjpeg('../examples/images/mutzig.jpg');
+$mask = imagecreatefrompng('../examples/images/alpha-star.png');
+$dst = imagepipeline($im, array(
+    array('scale', 200, 200, IMAGE_EX_SCALE_STRETCH),
+    array('colorcorrect', array('gamma' => 1.8)),
+    array('alphamask', $mask),
+));
+if (is_resource($dst) && 200 === imagesx($dst) && 200 === imagesy($dst)) {
+    echo "OK\n";
+} else {
+    echo "NG\n";
+}
+
+// the fused stages give the same pixels as the functions one at a time,
+// with a tiled mask whose period does not divide the band height
+$modes = array(
+    array(IMAGE_EX_MASK_SET, IMAGE_EX_POSITION_MIDDLE_CENTER),
+    array(IMAGE_EX_MASK_MERGE | IMAGE_EX_MASK_TILE, IMAGE_EX_POSITION_TOP_LEFT),
+    array(IMAGE_EX_MASK_SET | IMAGE_EX_MASK_TILE, IMAGE_EX_POSITION_BOTTOM_RIGHT),
+);
+$params = array('gamma' => 1.8, 'b' => array('levels' => array(16, 240)));
+foreach ($modes as $m) {
+    $fused = imagepipeline($im, array(
+        array('scale', 200, 400, IMAGE_EX_SCALE_STRETCH),
+        array('colorcorrect', $params),
+        array('alphamask', $mask, $m[0], $m[1]),
+    ));
+    $step = imagescale($im, 200, 400, IMAGE_EX_SCALE_STRETCH);
+    imagecolorcorrect($step, $params);
+    imagealphamask($step, $mask, $m[0], $m[1]);
+    var_dump(imagegetpixels($fused, IMAGE_EX_PIXELS_RGBA8)
+        === imagegetpixels($step, IMAGE_EX_PIXELS_RGBA8));
+}
+?>
+--EXPECT--
+OK
+bool(true)
+bool(true)
+bool(true)
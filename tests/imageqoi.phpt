@@ -0,0 +1,32 @@
+--TEST--
+imageqoi() and imagecreatefromqoi() functions
+--SKIPIF--
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32bit.png');
+imagesavealpha($src, true);
+ob_start();
+imageqoi($src);
+$blob = ob_get_clean();
+imageqoi($src, 'test.qoi');
+$a = imagecreatefromqoi($blob);
+$b = imagecreatefromqoi('test.qoi');
+$ok = (substr($blob, 0, 4) == 'qoif' && ord($blob[12]) == 4
+    && $blob === file_get_contents('test.qoi'));
+$width = imagesx($src);
+$height = imagesy($src);
+for ($y = 0; $ok && $y < $height; $y++) {
+    for ($x = 0; $x < $width; $x++) {
+        $c = imagecolorat($src, $x, $y);
+        if (imagecolorat($a, $x, $y) != $c || imagecolorat($b, $x, $y) != $c) {
+            $ok = false;
+            break;
+        }
+    }
+}
+echo $ok ? 'OK' : 'NG';
+@unlink('test.qoi');
+?>
+--EXPECT--
+OK
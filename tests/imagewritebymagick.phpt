@@ -0,0 +1,57 @@
+--TEST--
+imagewritebymagick() function
+--SKIPIF--
+<?php
+if (!function_exists('imagewritebymagick')) {
+    die('skip function imagewritebymagick() is not enabled');
+}
+?>
+--FILE--
+<?php
+chdir(dirname(__FILE__));
+$src = imagecreatefrompng('../examples/images/rgba-32x32.png');
+imagesavealpha($src, true);
+
+ob_start();
+$result = imagewritebymagick($src, null, 'TIFF', array('compression' => 'lzw'));
+$data = ob_get_clean();
+var_dump($result);
+var_dump(substr($data, 0, 4) === "II*\0" || substr($data, 0, 4) === "MM\0*");
+
+$file = tempnam(sys_get_temp_dir(), 'gdextra');
+var_dump(imagewritebymagick($src, $file, 'PNG'));
+$im = imagecreatefrompng($file);
+unlink($file);
+$same = true;
+for ($y = 0; $y < 32; $y++) {
+    for ($x = 0; $x < 32; $x++) {
+        $c = imagecolorat($src, $x, $y);
+        if (($c >> 24) != 127 && imagecolorat($im, $x, $y) != $c) {
+            $same = false;
+        }
+    }
+}
+var_dump($same);
+
+// a palette image with a translucent entry keeps its alpha
+$pal = imagecreate(4, 4);
+imagecolorallocatealpha($pal, 255, 0, 0, 64);
+$file = tempnam(sys_get_temp_dir(), 'gdextra');
+var_dump(imagewritebymagick($pal, $file, 'PNG'));
+$im = imagecreatefrompng($file);
+unlink($file);
+$c = imagecolorsforindex($im, imagecolorat($im, 1, 1));
+var_dump($c['red'] == 255 && abs($c['alpha'] - 64) <= 1);
+
+var_dump(@imagewritebymagick($src, null, 'JPEG', array('compression' => 'foo')));
+var_dump(@imagewritebymagick($src, null, 'JPEG', array('quality' => 101)));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(false)
+bool(false)
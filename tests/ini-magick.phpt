@@ -0,0 +1,23 @@
+--TEST--
+ImageMagick resource limit settings
+--SKIPIF--
+<?php
+if (!function_exists('imagecreatebymagick')) {
+    die('skip function imagecreatebymagick() is not enabled');
+}
+?>
+--INI--
+gdextra.magick_threads=1
+gdextra.magick_memory_limit=64M
+--FILE--
+<?php
+var_dump(ini_get('gdextra.magick_threads'));
+var_dump(ini_get('gdextra.magick_memory_limit'));
+var_dump(ini_get('gdextra.magick_map_limit'));
+var_dump(ini_set('gdextra.magick_threads', '4'));
+?>
+--EXPECT--
+string(1) "1"
+string(3) "64M"
+string(1) "0"
+bool(false)
@@ -0,0 +1,12 @@
+--TEST--
+Default number of worker threads
+--INI--
+gdextra.threads=2
+--FILE--
+<?php
+var_dump(ini_get('gdextra.threads'));
+var_dump(ini_set('gdextra.threads', '4'));
+?>
+--EXPECT--
+string(1) "2"
+bool(false)